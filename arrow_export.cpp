@@ -0,0 +1,396 @@
+#include "arrow_export.h"
+#include <algorithm>
+#include <iostream>
+
+// Arrow IPC file layout: "ARROW1\0\0", then a stream of messages (the
+// schema, then record batches, then an end-of-stream marker), then the
+// footer, its int32 length and "ARROW1". Each message is
+//
+//   u32 0xFFFFFFFF, i32 metadata length, Message flatbuffer, body
+//
+// with the metadata padded so the body starts 8-byte aligned.
+
+static const char ARROW_MAGIC[8] = {'A', 'R', 'R', 'O', 'W', '1', '\0', '\0'};
+static const size_t ARROW_BUFFER_ALIGNMENT = 64;
+
+// Schema.fbs and Message.fbs enumerations
+static const int16_t METADATA_V5 = 4;
+static const uint8_t HEADER_SCHEMA = 1;
+static const uint8_t HEADER_RECORD_BATCH = 3;
+static const uint8_t TYPE_INT = 2;
+static const uint8_t TYPE_FLOATING_POINT = 3;
+static const uint8_t TYPE_BOOL = 6;
+static const int16_t PRECISION_SINGLE = 1;
+static const int16_t PRECISION_DOUBLE = 2;
+
+enum ArrowType {
+    ARROW_UINT8,
+    ARROW_UINT64,
+    ARROW_FLOAT32,
+    ARROW_FLOAT64,
+    ARROW_BOOL
+};
+
+struct ArrowColumn {
+    const char* name; // Snapshot column names where the field is a Star's
+    ArrowType type;
+};
+
+static const ArrowColumn ARROW_COLUMNS[] = {
+    {"step", ARROW_UINT64},
+    {"time", ARROW_FLOAT64},
+    {"species", ARROW_UINT8},
+    {"pos_x", ARROW_FLOAT32},
+    {"pos_y", ARROW_FLOAT32},
+    {"pos_z", ARROW_FLOAT32},
+    {"vel_x", ARROW_FLOAT32},
+    {"vel_y", ARROW_FLOAT32},
+    {"vel_z", ARROW_FLOAT32},
+    {"mass", ARROW_FLOAT32},
+    {"black_hole", ARROW_BOOL}
+};
+static const size_t ARROW_COLUMN_COUNT = sizeof(ARROW_COLUMNS) / sizeof(ARROW_COLUMNS[0]);
+
+static size_t columnBytes(ArrowType type, size_t rows) {
+    switch (type) {
+        case ARROW_UINT8: return rows;
+        case ARROW_UINT64: return rows * 8;
+        case ARROW_FLOAT32: return rows * 4;
+        case ARROW_FLOAT64: return rows * 8;
+        case ARROW_BOOL: return (rows + 7) / 8;
+    }
+    return 0;
+}
+
+static size_t alignUp(size_t bytes, size_t alignment) {
+    return (bytes + alignment - 1) / alignment * alignment;
+}
+
+// Minimal FlatBuffers encoder for Arrow's metadata. Objects are laid out
+// front to back: a table is emitted whole, with placeholders where it
+// refers to other objects, and the placeholders are patched once those
+// objects follow. FlatBuffers references only point forward, so any
+// parent-before-child order is valid.
+class FlatBuffer {
+public:
+    struct Slot {
+        int field;     // Field id in the .fbs table
+        uint8_t size;  // 1, 2, 4 or 8 bytes; references are 4
+        uint64_t value;
+        bool reference;
+    };
+    
+    static Slot scalar(int field, uint8_t size, uint64_t value) { return {field, size, value, false}; }
+    static Slot reference(int field) { return {field, 4, 0, true}; }
+    
+    // Room for the root reference
+    FlatBuffer() : bytes(4, 0) {}
+    
+    // Emits a table and its vtable. refs receives the positions of the
+    // reference slots in field order, to patch later.
+    size_t table(std::vector<Slot> slots, std::vector<size_t>* refs = NULL) {
+        int fieldCount = 0;
+        for (const Slot& slot : slots) fieldCount = std::max(fieldCount, slot.field + 1);
+        
+        // vtable: u16 vtable size, u16 table size, u16 offset per field
+        align(2);
+        size_t vtable = bytes.size();
+        bytes.resize(vtable + 4 + 2 * fieldCount, 0);
+        
+        // Table: i32 distance back to the vtable, then the fields, largest
+        // first to keep padding down
+        align(4);
+        size_t start = bytes.size();
+        putScalar(start - vtable, 4);
+        std::stable_sort(slots.begin(), slots.end(), [](const Slot& a, const Slot& b) { return a.size > b.size; });
+        std::vector<std::pair<int, size_t>> placed;
+        for (const Slot& slot : slots) {
+            align(slot.size);
+            size_t at = bytes.size();
+            putScalar(slot.value, slot.size);
+            setU16(vtable + 4 + 2 * slot.field, (uint16_t)(at - start));
+            if (slot.reference) placed.push_back(std::make_pair(slot.field, at));
+        }
+        setU16(vtable, (uint16_t)(4 + 2 * fieldCount));
+        setU16(vtable + 2, (uint16_t)(bytes.size() - start));
+        
+        if (refs) {
+            std::sort(placed.begin(), placed.end());
+            refs->clear();
+            for (const auto& p : placed) refs->push_back(p.second);
+        }
+        return start;
+    }
+    
+    // Vector of count references, whose positions go to refs
+    size_t referenceVector(size_t count, std::vector<size_t>& refs) {
+        align(4);
+        size_t start = bytes.size();
+        putScalar(count, 4);
+        refs.clear();
+        for (size_t i = 0; i < count; i++) {
+            refs.push_back(bytes.size());
+            putScalar(0, 4);
+        }
+        return start;
+    }
+    
+    // Vector of 8-byte aligned structs
+    size_t structVector(const void* data, size_t count, size_t size) {
+        align(4);
+        if ((bytes.size() + 4) % 8 != 0) putScalar(0, 4);
+        size_t start = bytes.size();
+        putScalar(count, 4);
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        bytes.insert(bytes.end(), p, p + count * size);
+        return start;
+    }
+    
+    size_t string(const char* text) {
+        align(4);
+        size_t start = bytes.size();
+        size_t length = std::strlen(text);
+        putScalar(length, 4);
+        bytes.insert(bytes.end(), text, text + length + 1);
+        return start;
+    }
+    
+    void patch(size_t ref, size_t target) {
+        uint32_t offset = (uint32_t)(target - ref);
+        std::memcpy(&bytes[ref], &offset, 4);
+    }
+    
+    void setRoot(size_t table) { patch(0, table); }
+    
+    std::vector<unsigned char> bytes;
+    
+private:
+    void align(size_t alignment) {
+        bytes.resize(alignUp(bytes.size(), alignment), 0);
+    }
+    
+    // Little-endian hosts only, like the rest of the file formats
+    void putScalar(uint64_t value, size_t size) {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(&value);
+        bytes.insert(bytes.end(), p, p + size);
+    }
+    
+    void setU16(size_t at, uint16_t value) {
+        std::memcpy(&bytes[at], &value, 2);
+    }
+};
+
+static size_t writeType(FlatBuffer& fb, ArrowType type) {
+    switch (type) {
+        case ARROW_UINT8:
+            return fb.table({FlatBuffer::scalar(0, 4, 8), FlatBuffer::scalar(1, 1, 0)});
+        case ARROW_UINT64:
+            return fb.table({FlatBuffer::scalar(0, 4, 64), FlatBuffer::scalar(1, 1, 0)});
+        case ARROW_FLOAT32:
+            return fb.table({FlatBuffer::scalar(0, 2, PRECISION_SINGLE)});
+        case ARROW_FLOAT64:
+            return fb.table({FlatBuffer::scalar(0, 2, PRECISION_DOUBLE)});
+        case ARROW_BOOL:
+            break;
+    }
+    return fb.table({});
+}
+
+static uint8_t typeTag(ArrowType type) {
+    switch (type) {
+        case ARROW_UINT8:
+        case ARROW_UINT64:
+            return TYPE_INT;
+        case ARROW_FLOAT32:
+        case ARROW_FLOAT64:
+            return TYPE_FLOATING_POINT;
+        case ARROW_BOOL:
+            break;
+    }
+    return TYPE_BOOL;
+}
+
+// Schema { fields: [Field] }, each
+// Field { name, nullable, type_type, type, children: [] }
+static size_t writeSchema(FlatBuffer& fb) {
+    std::vector<size_t> refs;
+    size_t schema = fb.table({FlatBuffer::scalar(0, 2, 0), FlatBuffer::reference(1)}, &refs);
+    std::vector<size_t> fieldRefs;
+    fb.patch(refs[0], fb.referenceVector(ARROW_COLUMN_COUNT, fieldRefs));
+    
+    for (size_t c = 0; c < ARROW_COLUMN_COUNT; c++) {
+        const ArrowColumn& column = ARROW_COLUMNS[c];
+        size_t field = fb.table({FlatBuffer::reference(0), FlatBuffer::scalar(1, 1, 0),
+                                 FlatBuffer::scalar(2, 1, typeTag(column.type)), FlatBuffer::reference(3),
+                                 FlatBuffer::reference(5)}, &refs);
+        fb.patch(fieldRefs[c], field);
+        fb.patch(refs[0], fb.string(column.name));
+        fb.patch(refs[1], writeType(fb, column.type));
+        fb.patch(refs[2], fb.structVector(NULL, 0, 0));
+    }
+    return schema;
+}
+
+// Message { version, header_type, header, bodyLength }
+static size_t writeMessageTable(FlatBuffer& fb, uint8_t headerType, uint64_t bodyBytes, size_t* headerRef) {
+    std::vector<size_t> refs;
+    size_t message = fb.table({FlatBuffer::scalar(0, 2, METADATA_V5), FlatBuffer::scalar(1, 1, headerType),
+                               FlatBuffer::reference(2), FlatBuffer::scalar(3, 8, bodyBytes)}, &refs);
+    fb.setRoot(message);
+    *headerRef = refs[0];
+    return message;
+}
+
+// Writing
+
+ArrowWriter::~ArrowWriter() {
+    if (file.isOpen()) close();
+}
+
+bool ArrowWriter::open(const std::string& filePath, size_t rowsPerBatch) {
+    path = filePath;
+    batchRows = std::max<size_t>(rowsPerBatch, 1);
+    failed = false;
+    rows = 0;
+    batches.clear();
+    
+    if (!file.open(path)) {
+        std::cerr << "Failed to create Arrow file " << path << std::endl;
+        return false;
+    }
+    
+    FlatBuffer fb;
+    size_t headerRef;
+    writeMessageTable(fb, HEADER_SCHEMA, 0, &headerRef);
+    fb.patch(headerRef, writeSchema(fb));
+    return file.append(ARROW_MAGIC, sizeof(ARROW_MAGIC)) && writeMessage(fb.bytes, NULL, 0, NULL);
+}
+
+bool ArrowWriter::writeMessage(const std::vector<unsigned char>& metadata, const unsigned char* body,
+                               size_t bodyBytes, Block* block) {
+    uint64_t offset = file.offset();
+    int32_t metadataBytes = (int32_t)alignUp(metadata.size(), 8);
+    uint32_t continuation = 0xFFFFFFFF;
+    static const unsigned char padding[8] = {0};
+    bool ok = file.append(&continuation, 4) && file.append(&metadataBytes, 4) &&
+              file.append(metadata.data(), metadata.size()) &&
+              file.append(padding, metadataBytes - metadata.size()) &&
+              (bodyBytes == 0 || file.append(body, bodyBytes));
+    if (block) {
+        block->offset = (int64_t)offset;
+        block->metadataBytes = 8 + metadataBytes;
+        block->padding = 0;
+        block->bodyBytes = (int64_t)bodyBytes;
+    }
+    return ok;
+}
+
+bool ArrowWriter::writeBatch(const Star* stars, size_t count, uint64_t step, double time) {
+    // Body: per column an empty validity bitmap (nothing is null) and the
+    // values, each buffer starting on a 64-byte boundary
+    struct BufferRange {
+        int64_t offset;
+        int64_t length;
+    };
+    struct FieldNode {
+        int64_t length;
+        int64_t nullCount;
+    };
+    std::vector<FieldNode> nodes;
+    std::vector<BufferRange> buffers;
+    size_t bodyBytes = 0;
+    for (size_t c = 0; c < ARROW_COLUMN_COUNT; c++) {
+        size_t bytes = columnBytes(ARROW_COLUMNS[c].type, count);
+        nodes.push_back({(int64_t)count, 0});
+        buffers.push_back({(int64_t)bodyBytes, 0});
+        buffers.push_back({(int64_t)bodyBytes, (int64_t)bytes});
+        bodyBytes += alignUp(bytes, ARROW_BUFFER_ALIGNMENT);
+    }
+    body.assign(bodyBytes, 0);
+    
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t c = 0; c < ARROW_COLUMN_COUNT; c++) {
+        const ArrowColumn& column = ARROW_COLUMNS[c];
+        unsigned char* out = body.data() + buffers[2 * c + 1].offset;
+        switch (column.type) {
+            case ARROW_UINT64:
+                std::fill((uint64_t*)out, (uint64_t*)out + count, step);
+                break;
+            case ARROW_FLOAT64:
+                std::fill((double*)out, (double*)out + count, time);
+                break;
+            case ARROW_BOOL:
+                // Bit i of byte i / 8, least significant first
+                for (size_t i = 0; i < count; i++) {
+                    if (stars[i].isBlackHole) out[i >> 3] |= (unsigned char)(1u << (i & 7));
+                }
+                break;
+            case ARROW_UINT8:
+            case ARROW_FLOAT32:
+                if (column.type == ARROW_UINT8) {
+                    gatherColumn(COLUMNS[findColumn(column.name, COLUMN_UINT8, 1)], stars, count, out);
+                } else {
+                    gatherColumn(COLUMNS[findColumn(column.name, COLUMN_FLOAT32, 4)], stars, count, out);
+                }
+                break;
+        }
+    }
+    
+    // RecordBatch { length, nodes: [FieldNode], buffers: [Buffer] }
+    FlatBuffer fb;
+    size_t headerRef;
+    writeMessageTable(fb, HEADER_RECORD_BATCH, bodyBytes, &headerRef);
+    std::vector<size_t> refs;
+    fb.patch(headerRef, fb.table({FlatBuffer::scalar(0, 8, count), FlatBuffer::reference(1),
+                                  FlatBuffer::reference(2)}, &refs));
+    fb.patch(refs[0], fb.structVector(nodes.data(), nodes.size(), sizeof(FieldNode)));
+    fb.patch(refs[1], fb.structVector(buffers.data(), buffers.size(), sizeof(BufferRange)));
+    
+    Block block;
+    if (!writeMessage(fb.bytes, body.data(), bodyBytes, &block)) return false;
+    batches.push_back(block);
+    return true;
+}
+
+bool ArrowWriter::append(const std::vector<Star>& stars, uint64_t step, double time) {
+    if (!file.isOpen() || failed) return false;
+    
+    for (size_t first = 0; first < stars.size(); first += batchRows) {
+        size_t count = std::min(batchRows, stars.size() - first);
+        if (!writeBatch(stars.data() + first, count, step, time)) {
+            std::cerr << "Failed to write " << path << std::endl;
+            failed = true;
+            return false;
+        }
+        rows += count;
+    }
+    return true;
+}
+
+bool ArrowWriter::close() {
+    if (!file.isOpen()) return false;
+    
+    // End of stream, then Footer { version, schema, dictionaries, recordBatches }
+    uint32_t endOfStream[2] = {0xFFFFFFFF, 0};
+    bool ok = !failed && file.append(endOfStream, sizeof(endOfStream));
+    
+    FlatBuffer fb;
+    std::vector<size_t> refs;
+    fb.setRoot(fb.table({FlatBuffer::scalar(0, 2, METADATA_V5), FlatBuffer::reference(1),
+                         FlatBuffer::reference(2), FlatBuffer::reference(3)}, &refs));
+    fb.patch(refs[0], writeSchema(fb));
+    fb.patch(refs[1], fb.structVector(NULL, 0, sizeof(Block)));
+    fb.patch(refs[2], fb.structVector(batches.data(), batches.size(), sizeof(Block)));
+    
+    int32_t footerBytes = (int32_t)fb.bytes.size();
+    ok = ok && file.append(fb.bytes.data(), fb.bytes.size()) && file.append(&footerBytes, 4) &&
+         file.append(ARROW_MAGIC, 6);
+    ok = file.close() && ok;
+    if (!ok) std::cerr << "Failed to finish Arrow file " << path << std::endl;
+    return ok;
+}
+
+bool writeArrow(const std::string& path, const std::vector<Star>& stars, uint64_t step, double time) {
+    ArrowWriter writer;
+    return writer.open(path) && writer.append(stars, step, time) && writer.close();
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "snapshot_columns.h"
+#include "star.h"
+
+// Particle state as an Apache Arrow IPC file (Feather v2), which pandas
+// (read_feather), Polars (read_ipc, scan_ipc) and DuckDB open directly.
+// Columns, one row per star:
+//
+//   step uint64, time float64, species uint8,
+//   pos_x pos_y pos_z vel_x vel_y vel_z mass float32, black_hole bool
+//
+// Every appended snapshot becomes record batches of at most batchRows rows,
+// so a file can hold a whole run and be filtered on step or time. Only one
+// batch is staged in memory at a time, whatever the star count. Buffers are
+// uncompressed and 64-byte aligned, so readers can memory-map the file and
+// use the columns in place.
+const size_t ARROW_BATCH_ROWS = 1 << 20;
+
+class ArrowWriter {
+public:
+    ArrowWriter() = default;
+    ~ArrowWriter();
+    
+    ArrowWriter(const ArrowWriter&) = delete;
+    ArrowWriter& operator=(const ArrowWriter&) = delete;
+    
+    bool open(const std::string& path, size_t batchRows = ARROW_BATCH_ROWS);
+    bool append(const std::vector<Star>& stars, uint64_t step, double time);
+    
+    // Writes the footer; returns false if any batch failed
+    bool close();
+    
+    uint64_t rowCount() const { return rows; }
+    
+private:
+    // Location of one message, as recorded in the footer
+    struct Block {
+        int64_t offset;
+        int32_t metadataBytes;
+        int32_t padding;
+        int64_t bodyBytes;
+    };
+    
+    bool writeMessage(const std::vector<unsigned char>& metadata, const unsigned char* body,
+                      size_t bodyBytes, Block* block);
+    bool writeBatch(const Star* stars, size_t count, uint64_t step, double time);
+    
+    SequentialFile file;
+    std::string path;
+    size_t batchRows = ARROW_BATCH_ROWS;
+    bool failed = false;
+    uint64_t rows = 0;
+    std::vector<Block> batches;
+    std::vector<unsigned char> body; // Staging for one batch
+};
+
+// One snapshot in a file of its own
+bool writeArrow(const std::string& path, const std::vector<Star>& stars, uint64_t step, double time);
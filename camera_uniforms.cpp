@@ -0,0 +1,40 @@
+#include "camera_uniforms.h"
+
+CameraUniforms::CameraUniforms() {
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    slotStride = ((GLsizeiptr)sizeof(CameraBlock) + alignment - 1) / alignment * alignment;
+    
+    glGenBuffers(1, &ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferData(GL_UNIFORM_BUFFER, slotStride * MAX_VIEWS, NULL, GL_DYNAMIC_DRAW);
+    bindSlot(0);
+}
+
+CameraUniforms::~CameraUniforms() {
+    glDeleteBuffers(1, &ubo);
+}
+
+void CameraUniforms::attach(const ShaderProgram& program) const {
+    GLuint index = glGetUniformBlockIndex(program.id(), "Camera");
+    if (index != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program.id(), index, BINDING);
+    }
+}
+
+void CameraUniforms::update(GLuint slot, const glm::mat4& projection, const glm::mat4& view,
+                            const glm::vec3& position, int width, int height) {
+    CameraBlock block;
+    block.projection = projection;
+    block.view = view;
+    block.viewProjection = projection * view;
+    block.cameraPosition = glm::vec4(position, 1.0f);
+    block.viewportSize = glm::vec4((float)width, (float)height, 1.0f / width, 1.0f / height);
+    
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, slot * slotStride, sizeof(CameraBlock), &block);
+}
+
+void CameraUniforms::bindSlot(GLuint slot) const {
+    glBindBufferRange(GL_UNIFORM_BUFFER, BINDING, ubo, slot * slotStride, sizeof(CameraBlock));
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "shader.h"
+
+// GLSL declaration of the shared camera block. Splice it into shader sources
+// right after the #version line via string literal concatenation.
+#define CAMERA_UNIFORM_BLOCK                \
+    "layout (std140) uniform Camera {\n"    \
+    "    mat4 projection;\n"                \
+    "    mat4 view;\n"                      \
+    "    mat4 viewProjection;\n"            \
+    "    vec4 cameraPosition;\n"            \
+    "    vec4 viewportSize;\n"              \
+    "};\n"
+
+// CPU mirror of the Camera block; every member is 16-byte aligned under std140
+struct CameraBlock {
+    glm::mat4 projection;
+    glm::mat4 view;
+    glm::mat4 viewProjection;
+    glm::vec4 cameraPosition; // xyz, w unused
+    glm::vec4 viewportSize;   // width, height, 1/width, 1/height
+};
+static_assert(sizeof(CameraBlock) == 3 * 64 + 2 * 16, "CameraBlock must match std140 layout");
+
+// Camera matrices in a uniform buffer bound to a fixed binding point, shared
+// by every program that declares CAMERA_UNIFORM_BLOCK. The buffer holds one
+// slot per simultaneous view; bindSlot() selects which one draws read.
+// Uploads happen only after the camera was marked dirty.
+class CameraUniforms {
+public:
+    static const GLuint BINDING = 0;
+    static const GLuint MAX_VIEWS = 8;
+    
+    CameraUniforms();
+    ~CameraUniforms();
+    
+    CameraUniforms(const CameraUniforms&) = delete;
+    CameraUniforms& operator=(const CameraUniforms&) = delete;
+    
+    // Points the program's Camera block at BINDING; no-op if it has none
+    void attach(const ShaderProgram& program) const;
+    
+    void markDirty() { dirty = true; }
+    void markClean() { dirty = false; }
+    bool isDirty() const { return dirty; }
+    
+    // Uploads the camera state of one view
+    void update(GLuint slot, const glm::mat4& projection, const glm::mat4& view,
+                const glm::vec3& position, int width, int height);
+    
+    // Makes BINDING point at the given view's slot
+    void bindSlot(GLuint slot) const;
+    
+private:
+    GLuint ubo = 0;
+    GLsizeiptr slotStride = 0; // sizeof(CameraBlock) rounded to the UBO offset alignment
+    bool dirty = true;
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "galaxy_core.h"
+
+// Symplectic composition integrators: a step is a fixed sequence of drifts
+// x += c[k] v dt and kicks v += d[k] a(x) dt under the black hole. The
+// coefficients are constexpr, so each scheme unrolls at compile time, and
+// since stars move independently the whole sequence runs in one pass over
+// the stars, in registers, in double precision.
+
+// First order, kick then drift, as advanceStar
+struct KickDrift {
+    static constexpr int ORDER = 1;
+    static constexpr size_t STAGES = 2;
+    static constexpr double drift[STAGES] = {0.0, 1.0};
+    static constexpr double kick[STAGES] = {1.0, 0.0};
+};
+
+// Second order, drift-kick-drift
+struct Leapfrog {
+    static constexpr int ORDER = 2;
+    static constexpr size_t STAGES = 2;
+    static constexpr double drift[STAGES] = {0.5, 0.5};
+    static constexpr double kick[STAGES] = {1.0, 0.0};
+};
+
+// Fourth order (Forest & Ruth 1990); theta = 1 / (2 - 2^(1/3))
+struct ForestRuth {
+    static constexpr int ORDER = 4;
+    static constexpr size_t STAGES = 4;
+    static constexpr double theta = 1.3512071919596578;
+    static constexpr double drift[STAGES] = {theta / 2, (1 - theta) / 2, (1 - theta) / 2, theta / 2};
+    static constexpr double kick[STAGES] = {theta, 1 - 2 * theta, theta, 0.0};
+};
+
+// Sixth order (Yoshida 1990, solution A): seven leapfrogs of weights
+// w3 w2 w1 w0 w1 w2 w3, with adjacent half drifts merged
+struct Yoshida6 {
+    static constexpr int ORDER = 6;
+    static constexpr size_t STAGES = 8;
+    static constexpr double w1 = -1.17767998417887;
+    static constexpr double w2 = 0.235573213359357;
+    static constexpr double w3 = 0.784513610477560;
+    static constexpr double w0 = 1 - 2 * (w1 + w2 + w3);
+    static constexpr double drift[STAGES] = {w3 / 2, (w3 + w2) / 2, (w2 + w1) / 2, (w1 + w0) / 2,
+                                             (w0 + w1) / 2, (w1 + w2) / 2, (w2 + w3) / 2, w3 / 2};
+    static constexpr double kick[STAGES] = {w3, w2, w1, w0, w1, w2, w3, 0.0};
+};
+
+namespace composition {
+
+struct State {
+    double x, y, z;
+    double vx, vy, vz;
+};
+
+template <class Scheme, size_t K>
+inline void stage(State& s, double mu, double dt) {
+    constexpr double c = Scheme::drift[K];
+    constexpr double d = Scheme::kick[K];
+    s.x += c * dt * s.vx;
+    s.y += c * dt * s.vy;
+    s.z += c * dt * s.vz;
+    if (d != 0.0) {
+        double r2 = s.x * s.x + s.y * s.y + s.z * s.z;
+        double k = -mu * d * dt / (r2 * std::sqrt(r2));
+        s.vx += k * s.x;
+        s.vy += k * s.y;
+        s.vz += k * s.z;
+    }
+}
+
+template <class Scheme, size_t... K>
+inline void stages(State& s, double mu, double dt, std::index_sequence<K...>) {
+    (stage<Scheme, K>(s, mu, dt), ...);
+}
+
+}
+
+// One step of Scheme for every star but the black holes, and but the stars
+// whose entry in skip is nonzero. Returns the stable step from those stars,
+// from the same pass: the criteria of starTimestep, with the accuracy taken
+// to the power 1 / ORDER, as a scheme of order p needs a step of about
+// accuracy^(1/p) of the shortest time scale to keep the error of a
+// kick-drift step at accuracy.
+template <class Scheme>
+float integrateCompositionExcept(std::vector<Star>& stars, float dt, const TimestepCriteria& criteria,
+                                 const uint8_t* skip) {
+    const glm::dvec3 origin(stars[0].position);
+    const double mu = G * stars[0].mass;
+    const double scale = std::pow((double)criteria.accuracy, 1.0 / Scheme::ORDER);
+    float limit = (float)(criteria.maxStep / scale);
+    #pragma omp parallel for reduction(min:limit)
+    for (size_t i = 0; i < stars.size(); i++) {
+        Star& star = stars[i];
+        if (star.isBlackHole || (skip && skip[i])) continue;
+        composition::State s = {star.position.x - origin.x, star.position.y - origin.y, star.position.z - origin.z,
+                                star.velocity.x, star.velocity.y, star.velocity.z};
+        composition::stages<Scheme>(s, mu, dt, std::make_index_sequence<Scheme::STAGES>());
+        star.position = glm::vec3((float)(origin.x + s.x), (float)(origin.y + s.y), (float)(origin.z + s.z));
+        star.velocity = glm::vec3((float)s.vx, (float)s.vy, (float)s.vz);
+        limit = std::min(limit, starTimestep(star, stars[0], criteria));
+    }
+    return std::max((float)(limit * scale), criteria.minStep);
+}
+
+// Fits StepFunction: every star but the black holes
+template <class Scheme>
+float integrateComposition(std::vector<Star>& stars, float dt, const TimestepCriteria& criteria) {
+    return integrateCompositionExcept<Scheme>(stars, dt, criteria, NULL);
+}
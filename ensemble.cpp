@@ -0,0 +1,54 @@
+#include "ensemble.h"
+#include <algorithm>
+#include <utility>
+#include "snapshot.h"
+
+size_t Ensemble::addSystem(const GalaxyParameters& parameters) {
+    std::vector<Star> generated;
+    generateGalaxy(parameters, generated);
+    particles.insert(particles.end(), generated.begin(), generated.end());
+    offsets.push_back(particles.size());
+    addSlices(systemCount() - 1);
+    return systemCount() - 1;
+}
+
+size_t Ensemble::addSystem(std::vector<Star>&& loaded, float blackHoleMass) {
+    adoptStars(loaded, blackHoleMass);
+    particles.insert(particles.end(), loaded.begin(), loaded.end());
+    offsets.push_back(particles.size());
+    addSlices(systemCount() - 1);
+    return systemCount() - 1;
+}
+
+// Slices never straddle two systems, so each has one black hole to pull
+// towards and the loop body needs no lookup
+void Ensemble::addSlices(size_t system) {
+    size_t begin = offsets[system];
+    size_t end = offsets[system + 1];
+    for (size_t first = begin; first < end; first += ENSEMBLE_SLICE) {
+        slices.push_back({first, std::min(first + ENSEMBLE_SLICE, end), begin});
+    }
+}
+
+void Ensemble::step(float dt, uint64_t count) {
+    Star* stars = particles.data();
+    for (uint64_t n = 0; n < count; n++) {
+        // Systems differ in size, so slices are handed out as threads free up
+        #pragma omp parallel for schedule(dynamic)
+        for (size_t s = 0; s < slices.size(); s++) {
+            const Slice& slice = slices[s];
+            const Star blackHole = stars[slice.blackHole];
+            for (size_t i = slice.begin; i < slice.end; i++) {
+                if (stars[i].isBlackHole) continue;
+                advanceStar(stars[i], blackHole, dt);
+            }
+        }
+        steps++;
+        simulationTime += dt;
+    }
+}
+
+bool Ensemble::checkpoint(size_t system, const std::string& path) const {
+    std::vector<Star> copy(systemStars(system), systemStars(system) + systemSize(system));
+    return writeSnapshot(path, copy, steps, simulationTime, SnapshotOptions());
+}
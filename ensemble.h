@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "galaxy_core.h"
+
+// Many small independent galaxies in one process, for parameter sweeps.
+// Their stars are packed into one array, system after system, each led by
+// its own black hole. A step is a single parallel loop over fixed-size
+// slices of that array, so every core stays busy however small the
+// systems are, instead of one process (or one parallel loop) per system.
+
+const size_t ENSEMBLE_SLICE = 4096; // Stars per unit of work
+
+class Ensemble {
+public:
+    // Systems can only be added before the first step; adding one may move
+    // the star array
+    size_t addSystem(const GalaxyParameters& parameters);
+    // Takes over particles read from initial conditions
+    size_t addSystem(std::vector<Star>&& loaded, float blackHoleMass);
+    
+    // Advances every system by the same dt
+    void step(float dt, uint64_t count = 1);
+    
+    size_t systemCount() const { return offsets.size() - 1; }
+    size_t starCount() const { return particles.size(); }
+    
+    // A system's stars, black hole first
+    Star* systemStars(size_t system) { return particles.data() + offsets[system]; }
+    const Star* systemStars(size_t system) const { return particles.data() + offsets[system]; }
+    size_t systemSize(size_t system) const { return offsets[system + 1] - offsets[system]; }
+    size_t systemOffset(size_t system) const { return offsets[system]; }
+    
+    std::vector<Star>& stars() { return particles; }
+    const std::vector<Star>& stars() const { return particles; }
+    
+    uint64_t stepCount() const { return steps; }
+    double time() const { return simulationTime; }
+    
+    // Lossless snapshot of one system
+    bool checkpoint(size_t system, const std::string& path) const;
+    
+private:
+    struct Slice {
+        size_t begin;
+        size_t end;
+        size_t blackHole; // Index of the slice's system's black hole
+    };
+    
+    void addSlices(size_t system);
+    
+    std::vector<Star> particles;
+    std::vector<size_t> offsets{0}; // System s holds [offsets[s], offsets[s + 1])
+    std::vector<Slice> slices;
+    uint64_t steps = 0;
+    double simulationTime = 0.0;
+};
@@ -0,0 +1,63 @@
+/*
+ * Follows a running galaxy_sim --publish NAME from another process and
+ * prints a summary of each new frame:
+ *
+ *   galaxy_shm_reader /galaxy
+ *
+ * Build: cc -O2 -I.. shm_reader.c -o galaxy_shm_reader (add -lrt on older glibc)
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "galaxy_shm.h"
+
+int main(int argc, char** argv) {
+    struct galaxy_shm_reader reader;
+    struct galaxy_shm_star* stars;
+    uint64_t seen = 0, last_step = UINT64_MAX;
+    const struct timespec poll = {0, 10 * 1000 * 1000};
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s NAME\n", argv[0]);
+        return 1;
+    }
+    if (galaxy_shm_open(&reader, argv[1]) != 0) {
+        fprintf(stderr, "No simulation publishing to %s\n", argv[1]);
+        return 1;
+    }
+    stars = malloc(reader.header->capacity * sizeof(*stars));
+    if (!stars) return 1;
+
+    while (!galaxy_shm_closed(&reader)) {
+        uint64_t step;
+        double time, radius = 0.0, speed = 0.0;
+        int64_t count, i, holes = 0;
+
+        if (galaxy_shm_frames(&reader) == seen) {
+            nanosleep(&poll, NULL);
+            continue;
+        }
+        seen = galaxy_shm_frames(&reader);
+        count = galaxy_shm_read(&reader, stars, reader.header->capacity, &step, &time);
+        /* The frame counter can run ahead of the frame we copied */
+        if (count <= 0 || step == last_step) continue;
+        last_step = step;
+
+        for (i = 0; i < count; i++) {
+            const float* p = stars[i].position;
+            const float* v = stars[i].velocity;
+            radius += sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+            speed += sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+            holes += stars[i].black_hole;
+        }
+        printf("step %llu  t %.3f yr  %lld stars  %lld black holes  mean radius %.1f ly  mean speed %.2f\n",
+               (unsigned long long)step, time, (long long)count, (long long)holes,
+               radius / count, speed / count);
+        fflush(stdout);
+    }
+    printf("Simulation finished\n");
+    free(stars);
+    galaxy_shm_close(&reader);
+    return 0;
+}
@@ -0,0 +1,79 @@
+// Connects to galaxy_sim --stream, asks for a view of the galaxy and prints
+// what arrives:
+//
+//   galaxy_stream_client HOST PORT [BUDGET] [FRAMES]
+//
+// A real viewer would draw the decoded points, sending a new request
+// whenever its camera moves.
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "stream_protocol.h"
+
+static bool receiveAll(int fd, void* data, size_t bytes) {
+    char* p = static_cast<char*>(data);
+    while (bytes > 0) {
+        ssize_t n = recv(fd, p, bytes, 0);
+        if (n <= 0) return false;
+        p += n;
+        bytes -= (size_t)n;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " HOST PORT [BUDGET] [FRAMES]" << std::endl;
+        return 1;
+    }
+    uint32_t budget = argc > 3 ? (uint32_t)atol(argv[3]) : 100000;
+    long frames = argc > 4 ? atol(argv[4]) : 100;
+    
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)atoi(argv[2]));
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (inet_pton(AF_INET, argv[1], &addr.sin_addr) != 1 || connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        std::cerr << "Cannot connect to " << argv[1] << ":" << argv[2] << std::endl;
+        return 1;
+    }
+    
+    // Same starting camera as the simulation's own window
+    glm::vec3 eye(0.0f, 25000.0f, 25000.0f);
+    glm::mat4 viewProjection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 200000.0f) *
+                               glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    StreamRequest request;
+    request.budget = budget;
+    std::memcpy(request.eye, glm::value_ptr(eye), sizeof(request.eye));
+    std::memcpy(request.viewProjection, glm::value_ptr(viewProjection), sizeof(request.viewProjection));
+    if (send(fd, &request, sizeof(request), 0) != (ssize_t)sizeof(request)) return 1;
+    
+    StreamPoints points;
+    std::vector<unsigned char> payload;
+    for (long f = 0; f < frames; f++) {
+        StreamFrameHeader header;
+        if (!receiveAll(fd, &header, sizeof(header))) break;
+        payload.resize(header.payloadBytes);
+        if (!receiveAll(fd, payload.data(), payload.size()) || !decodeStreamFrame(header, payload.data(), points)) {
+            std::cerr << "Bad frame" << std::endl;
+            return 1;
+        }
+        
+        uint64_t represented = 0;
+        for (uint32_t weight : points.weights) represented += weight;
+        std::cout << "step " << header.step << (header.flags & STREAM_FRAME_KEY ? " key" : "")
+                  << ": " << header.count << " points for " << represented << " of " << header.visible
+                  << " visible stars, " << header.payloadBytes << " bytes ("
+                  << (header.count ? (double)header.payloadBytes / header.count : 0.0) << " per point)" << std::endl;
+    }
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include "frame_capture.h"
+#include "gl_state.h"
+#include <algorithm>
+#include <cstring>
+
+FrameCapture::FrameCapture(int width, int height) : width(width), height(height) {
+    glGenBuffers(2, pbo);
+    for (int i = 0; i < 2; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 3, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+FrameCapture::~FrameCapture() {
+    glDeleteBuffers(2, pbo);
+    if (fbo) {
+        glstate::forgetFramebuffer(fbo);
+        glDeleteFramebuffers(1, &fbo);
+        glDeleteRenderbuffers(1, &colour);
+    }
+}
+
+// Blits the back buffer into fbo, keeping its aspect ratio, and leaves fbo
+// bound for reading
+void FrameCapture::scaleWindow(int windowWidth, int windowHeight) {
+    if (!fbo) {
+        glGenRenderbuffers(1, &colour);
+        glBindRenderbuffer(GL_RENDERBUFFER, colour);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGB8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glGenFramebuffers(1, &fbo);
+        glstate::bindFramebuffer(fbo);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colour);
+    }
+    
+    float scale = std::min((float)width / windowWidth, (float)height / windowHeight);
+    int scaledWidth = (int)(windowWidth * scale), scaledHeight = (int)(windowHeight * scale);
+    int x = (width - scaledWidth) / 2, y = (height - scaledHeight) / 2;
+    
+    glstate::bindFramebuffer(fbo);
+    const GLfloat black[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    glClearBufferfv(GL_COLOR, 0, black);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glReadBuffer(GL_BACK);
+    glBlitFramebuffer(0, 0, windowWidth, windowHeight, x, y, x + scaledWidth, y + scaledHeight,
+                      GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo); // Back in step with glstate
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+}
+
+bool FrameCapture::copyPending(unsigned char* out) {
+    int index = next;
+    if (!pending[index]) return false;
+    pending[index] = false;
+    
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[index]);
+    const void* data = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    bool ok = data != NULL;
+    if (ok) {
+        std::memcpy(out, data, (size_t)width * height * 3);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return ok;
+}
+
+bool FrameCapture::capture(unsigned char* out, int windowWidth, int windowHeight) {
+    // Start this frame's readback into the other buffer first, then collect
+    // the one queued last frame, which the GPU has had a frame to finish
+    if (windowWidth <= 0 || windowHeight <= 0) return flush(out); // Minimized
+    int current = next;
+    if (windowWidth == width && windowHeight == height) {
+        glstate::bindFramebuffer(0);
+        glReadBuffer(GL_BACK);
+    } else {
+        scaleWindow(windowWidth, windowHeight);
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[current]);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    pending[current] = true;
+    
+    next = 1 - current;
+    return copyPending(out);
+}
+
+bool FrameCapture::flush(unsigned char* out) {
+    next = 1 - next;
+    return copyPending(out);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <GL/glew.h>
+
+// Asynchronous readback of the window through two pixel buffer objects.
+// Each capture() starts reading the current frame and returns the frame
+// started on the previous call, so the CPU never waits on the GPU. The
+// frame size is fixed when capture starts, as a video's must be; if the
+// window is resized later, it is scaled into that size, letterboxed.
+class FrameCapture {
+public:
+    FrameCapture(int width, int height);
+    ~FrameCapture();
+    
+    FrameCapture(const FrameCapture&) = delete;
+    FrameCapture& operator=(const FrameCapture&) = delete;
+    
+    int frameWidth() const { return width; }
+    int frameHeight() const { return height; }
+    
+    // Queues a readback of the back buffer, which is windowWidth by
+    // windowHeight. If a previous frame is ready, copies it as bottom-up
+    // RGB24 into out and returns true.
+    bool capture(unsigned char* out, int windowWidth, int windowHeight);
+    
+    // Copies the last queued frame, if any, into out
+    bool flush(unsigned char* out);
+    
+private:
+    bool copyPending(unsigned char* out);
+    void scaleWindow(int windowWidth, int windowHeight);
+    
+    int width, height;
+    GLuint pbo[2];
+    GLuint fbo = 0, colour = 0; // Frame-sized target for a resized window, made on first need
+    int next = 0;
+    bool pending[2] = {false, false};
+};
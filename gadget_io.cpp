@@ -0,0 +1,693 @@
+#include "gadget_io.h"
+#include "snapshot_columns.h"
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef GALAXY_HAVE_HDF5
+#include <hdf5.h>
+#endif
+
+namespace fs = std::filesystem;
+
+static const uint64_t CHUNK_PARTICLES = 1 << 20;
+static const double LIGHT_SPEED_KMS = 299792.458; // So one light year per km/s is this many years
+
+// Conversion factors from file units to simulation units
+struct UnitScale {
+    double length;
+    double velocity;
+    double mass;
+    double time; // Years; GADGET's time unit is its length unit over its velocity unit
+};
+
+static UnitScale unitScale(const GadgetUnits& units, double hubbleParam) {
+    double h = units.hubbleScaled && hubbleParam > 0.0 ? hubbleParam : 1.0;
+    UnitScale scale = {units.lengthInLightYears / h, units.velocityInKms, units.massInSolarMasses / h,
+                       units.lengthInLightYears / h / units.velocityInKms * LIGHT_SPEED_KMS};
+    return scale;
+}
+
+static bool hasExtension(const std::string& path, const char* extension) {
+    size_t n = std::strlen(extension);
+    return path.size() >= n && path.compare(path.size() - n, n, extension) == 0;
+}
+
+static uint8_t particleType(const Star& star) {
+    return std::min<uint8_t>(star.species, SPECIES_COUNT - 1);
+}
+
+// Species, black hole flag and display size for particles [first, first + n)
+static void finishParticles(Star* stars, uint64_t n, int type) {
+    #pragma omp parallel for
+    for (int64_t i = 0; i < (int64_t)n; i++) {
+        Star& star = stars[i];
+        star.species = (uint8_t)type;
+        star.isBlackHole = type == SPECIES_BLACK_HOLE;
+        star.size = star.isBlackHole ? BLACK_HOLE_DISPLAY_SIZE : starDisplaySize(star.mass);
+    }
+}
+
+// Indices of stars in type-major order, and the count of each type
+static std::vector<uint64_t> typeOrder(const std::vector<Star>& stars, uint64_t counts[SPECIES_COUNT]) {
+    std::fill(counts, counts + SPECIES_COUNT, 0);
+    for (const Star& star : stars) counts[particleType(star)]++;
+    
+    uint64_t next[SPECIES_COUNT] = {0};
+    for (int t = 1; t < SPECIES_COUNT; t++) next[t] = next[t - 1] + counts[t - 1];
+    std::vector<uint64_t> order(stars.size());
+    for (size_t i = 0; i < stars.size(); i++) order[next[particleType(stars[i])]++] = i;
+    return order;
+}
+
+bool readGadget(const std::string& path, std::vector<Star>& stars, GadgetHeader* header, const GadgetUnits& units) {
+    if (hasExtension(path, ".hdf5") || hasExtension(path, ".h5"))
+        return readGadgetHDF5(path, stars, header, units);
+    return readGadgetBinary(path, stars, header, units);
+}
+
+bool writeGadget(const std::string& path, const std::vector<Star>& stars, double time, const GadgetUnits& units) {
+    if (hasExtension(path, ".hdf5") || hasExtension(path, ".h5"))
+        return writeGadgetHDF5(path, stars, time, units);
+    return writeGadgetBinary(path, stars, time, units);
+}
+
+// GADGET-2 binary
+//
+// Every block is a Fortran record: u32 size, data, u32 size. SnapFormat 2
+// puts an 8-byte record before each block holding its 4-character label and
+// the size of the block with its markers; SnapFormat 1 relies on the order.
+
+struct GadgetFileHeader {
+    int32_t npart[6];
+    double mass[6];
+    double time;
+    double redshift;
+    int32_t flagSfr;
+    int32_t flagFeedback;
+    uint32_t npartTotal[6];
+    int32_t flagCooling;
+    int32_t numFiles;
+    double boxSize;
+    double omega0;
+    double omegaLambda;
+    double hubbleParam;
+    int32_t flagStellarAge;
+    int32_t flagMetals;
+    uint32_t npartTotalHighWord[6];
+    int32_t flagEntropyInsteadU;
+    char fill[60];
+};
+static_assert(sizeof(GadgetFileHeader) == 256, "GADGET header must be 256 bytes");
+
+struct BlockLocation {
+    uint64_t offset; // Of the data, past the record marker
+    uint64_t bytes;
+};
+
+// Finds every block of a file by walking the record markers
+static bool scanBlocks(int fd, const std::string& path, std::map<std::string, BlockLocation>& blocks) {
+    static const char* FORMAT1_ORDER[] = {"HEAD", "POS", "VEL", "ID", "MASS", "U", "RHO", "HSML"};
+    const uint64_t fileSize = (uint64_t)lseek(fd, 0, SEEK_END);
+    
+    uint32_t first = 0;
+    if (!readExact(fd, &first, 4, 0) || (first != 8 && first != 256)) {
+        std::cerr << path << " is not a little-endian GADGET-2 file" << std::endl;
+        return false;
+    }
+    const bool format2 = first == 8;
+    
+    uint64_t pos = 0;
+    for (size_t index = 0; pos < fileSize; index++) {
+        std::string label;
+        if (format2) {
+            char record[16];
+            uint32_t open, close;
+            if (!readExact(fd, record, sizeof(record), pos)) break;
+            std::memcpy(&open, record, 4);
+            std::memcpy(&close, record + 12, 4);
+            if (open != 8 || close != 8) break;
+            label.assign(record + 4, 4);
+            label.erase(label.find_last_not_of(' ') + 1);
+            pos += sizeof(record);
+        } else if (index < sizeof(FORMAT1_ORDER) / sizeof(FORMAT1_ORDER[0])) {
+            label = FORMAT1_ORDER[index];
+        }
+        
+        uint32_t size, trailer;
+        if (!readExact(fd, &size, 4, pos) || pos + 8 + size > fileSize ||
+            !readExact(fd, &trailer, 4, pos + 4 + size) || trailer != size) {
+            std::cerr << path << ": broken record at offset " << pos << std::endl;
+            return false;
+        }
+        if (!label.empty()) blocks[label] = {pos + 4, size};
+        pos += 8 + (uint64_t)size;
+    }
+    
+    if (!blocks.count("HEAD") || blocks["HEAD"].bytes != sizeof(GadgetFileHeader)) {
+        std::cerr << path << " has no GADGET header" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Reads elements [first, first + count) of a block of float or double
+// vectors in parallel chunks; store(i, values) receives element first + i
+template <class Store>
+static bool readElements(int fd, const BlockLocation& block, size_t valueBytes, int components,
+                         uint64_t first, uint64_t count, Store store) {
+    const size_t elementBytes = valueBytes * components;
+    if ((first + count) * elementBytes > block.bytes) return false;
+    
+    const int64_t chunks = (int64_t)((count + CHUNK_PARTICLES - 1) / CHUNK_PARTICLES);
+    std::atomic<bool> ok(true);
+    #pragma omp parallel
+    {
+        std::vector<unsigned char> buffer;
+        #pragma omp for schedule(dynamic)
+        for (int64_t chunk = 0; chunk < chunks; chunk++) {
+            uint64_t begin = (uint64_t)chunk * CHUNK_PARTICLES;
+            uint64_t n = std::min(CHUNK_PARTICLES, count - begin);
+            buffer.resize(n * elementBytes);
+            if (!readExact(fd, buffer.data(), buffer.size(), block.offset + (first + begin) * elementBytes)) {
+                ok = false;
+                continue;
+            }
+            double values[3];
+            for (uint64_t i = 0; i < n; i++) {
+                const unsigned char* element = &buffer[i * elementBytes];
+                for (int c = 0; c < components; c++) {
+                    if (valueBytes == 4) {
+                        float f;
+                        std::memcpy(&f, element + c * 4, 4);
+                        values[c] = f;
+                    } else {
+                        std::memcpy(&values[c], element + c * 8, 8);
+                    }
+                }
+                store(begin + i, values);
+            }
+        }
+    }
+    return ok;
+}
+
+// Part files of a snapshot: base.0, base.1, ... or just the path
+static std::vector<std::string> snapshotFiles(const std::string& path, int numFiles) {
+    std::vector<std::string> files;
+    std::string base = path;
+    if (hasExtension(path, ".0")) base = path.substr(0, path.size() - 2);
+    if (numFiles <= 1 && fs::exists(path)) {
+        files.push_back(path);
+        return files;
+    }
+    for (int i = 0; i < std::max(numFiles, 1); i++) {
+        files.push_back(base + "." + std::to_string(i));
+    }
+    return files;
+}
+
+static void copyHeader(const GadgetFileHeader& file, GadgetHeader& header) {
+    for (int t = 0; t < SPECIES_COUNT; t++) {
+        header.count[t] = file.npartTotal[t] | ((uint64_t)file.npartTotalHighWord[t] << 32);
+        header.massTable[t] = file.mass[t];
+    }
+    header.time = file.time;
+    header.redshift = file.redshift;
+    header.boxSize = file.boxSize;
+    header.omega0 = file.omega0;
+    header.omegaLambda = file.omegaLambda;
+    header.hubbleParam = file.hubbleParam;
+    header.numFiles = std::max(file.numFiles, 1);
+}
+
+static bool readBinaryFile(const std::string& path, std::vector<Star>& stars, uint64_t& next,
+                           const GadgetUnits& units) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Failed to open GADGET file " << path << std::endl;
+        return false;
+    }
+    
+    std::map<std::string, BlockLocation> blocks;
+    GadgetFileHeader header;
+    bool ok = scanBlocks(fd, path, blocks) && readExact(fd, &header, sizeof(header), blocks["HEAD"].offset);
+    
+    uint64_t fileCount = 0;
+    for (int t = 0; ok && t < SPECIES_COUNT; t++) fileCount += (uint64_t)header.npart[t];
+    ok = ok && next + fileCount <= stars.size();
+    ok = ok && (fileCount == 0 || (blocks.count("POS") && blocks.count("VEL")));
+    if (!ok || fileCount == 0) {
+        if (!ok) std::cerr << "Malformed GADGET file " << path << std::endl;
+        ::close(fd);
+        return ok;
+    }
+    
+    const UnitScale scale = unitScale(units, header.hubbleParam);
+    Star* out = &stars[next];
+    const size_t posBytes = blocks["POS"].bytes / (3 * fileCount);
+    const size_t velBytes = blocks["VEL"].bytes / (3 * fileCount);
+    ok = (posBytes == 4 || posBytes == 8) && (velBytes == 4 || velBytes == 8);
+    
+    ok = ok && readElements(fd, blocks["POS"], posBytes, 3, 0, fileCount, [&](uint64_t i, const double* v) {
+        out[i].position = glm::vec3(v[0] * scale.length, v[1] * scale.length, v[2] * scale.length);
+    });
+    ok = ok && readElements(fd, blocks["VEL"], velBytes, 3, 0, fileCount, [&](uint64_t i, const double* v) {
+        out[i].velocity = glm::vec3(v[0] * scale.velocity, v[1] * scale.velocity, v[2] * scale.velocity);
+    });
+    
+    // Types with a mass table entry have no MASS block entries
+    uint64_t variableMasses = 0;
+    for (int t = 0; t < SPECIES_COUNT; t++) {
+        if (header.mass[t] == 0.0) variableMasses += (uint64_t)header.npart[t];
+    }
+    size_t massBytes = 4;
+    if (variableMasses > 0) {
+        ok = ok && blocks.count("MASS");
+        if (ok) massBytes = blocks["MASS"].bytes / variableMasses;
+        ok = ok && (massBytes == 4 || massBytes == 8);
+    }
+    
+    uint64_t first = 0, massCursor = 0;
+    for (int t = 0; t < SPECIES_COUNT && ok; t++) {
+        uint64_t n = (uint64_t)header.npart[t];
+        Star* typeStars = out + first;
+        if (header.mass[t] != 0.0) {
+            float mass = (float)(header.mass[t] * scale.mass);
+            for (uint64_t i = 0; i < n; i++) typeStars[i].mass = mass;
+        } else {
+            ok = readElements(fd, blocks["MASS"], massBytes, 1, massCursor, n, [&](uint64_t i, const double* v) {
+                typeStars[i].mass = (float)(v[0] * scale.mass);
+            });
+            massCursor += n;
+        }
+        finishParticles(typeStars, n, t);
+        first += n;
+    }
+    
+    ::close(fd);
+    if (!ok) {
+        std::cerr << "Malformed GADGET file " << path << std::endl;
+        return false;
+    }
+    next += fileCount;
+    return true;
+}
+
+bool readGadgetBinary(const std::string& path, std::vector<Star>& stars, GadgetHeader* header,
+                      const GadgetUnits& units) {
+    // The first part file says how many there are and how many particles in all
+    std::string firstPath = fs::exists(path) ? path : path + ".0";
+    int fd = ::open(firstPath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Failed to open GADGET file " << path << std::endl;
+        return false;
+    }
+    std::map<std::string, BlockLocation> blocks;
+    GadgetFileHeader fileHeader;
+    bool ok = scanBlocks(fd, firstPath, blocks) &&
+              readExact(fd, &fileHeader, sizeof(fileHeader), blocks["HEAD"].offset);
+    ::close(fd);
+    if (!ok) return false;
+    
+    GadgetHeader info;
+    copyHeader(fileHeader, info);
+    uint64_t total = 0;
+    for (int t = 0; t < SPECIES_COUNT; t++) total += info.count[t];
+    
+    std::vector<std::string> files = snapshotFiles(firstPath, info.numFiles);
+    stars.assign(total, Star());
+    uint64_t next = 0;
+    for (const std::string& file : files) {
+        if (!readBinaryFile(file, stars, next, units)) return false;
+    }
+    if (next != total) {
+        std::cerr << path << ": expected " << total << " particles, found " << next << std::endl;
+        return false;
+    }
+    if (header) *header = info;
+    return true;
+}
+
+// Writes a block in bounded chunks; fill(order index, out) produces one element
+template <class Fill>
+static bool appendBlock(SequentialFile& file, const char* label, uint64_t count, size_t elementBytes, Fill fill) {
+    uint64_t bytes = count * elementBytes;
+    if (bytes > 0xFFFFFFFFull - 8) {
+        std::cerr << "GADGET block " << label << " exceeds 4 GB; split the snapshot" << std::endl;
+        return false;
+    }
+    char name[4] = {' ', ' ', ' ', ' '};
+    std::memcpy(name, label, std::min<size_t>(std::strlen(label), 4));
+    uint32_t eight = 8, next = (uint32_t)(bytes + 8), size = (uint32_t)bytes;
+    bool ok = file.append(&eight, 4) && file.append(name, 4) && file.append(&next, 4) &&
+              file.append(&eight, 4) && file.append(&size, 4);
+    
+    std::vector<unsigned char> buffer;
+    for (uint64_t begin = 0; begin < count && ok; begin += CHUNK_PARTICLES) {
+        uint64_t n = std::min(CHUNK_PARTICLES, count - begin);
+        buffer.resize(n * elementBytes);
+        #pragma omp parallel for
+        for (int64_t i = 0; i < (int64_t)n; i++) {
+            fill(begin + i, &buffer[i * elementBytes]);
+        }
+        ok = file.append(buffer.data(), buffer.size());
+    }
+    return ok && file.append(&size, 4);
+}
+
+bool writeGadgetBinary(const std::string& path, const std::vector<Star>& stars, double time,
+                       const GadgetUnits& units) {
+    uint64_t counts[SPECIES_COUNT];
+    std::vector<uint64_t> order = typeOrder(stars, counts);
+    const UnitScale scale = unitScale(units, 1.0);
+    
+    GadgetFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    for (int t = 0; t < SPECIES_COUNT; t++) {
+        if (counts[t] > 0x7FFFFFFF) {
+            std::cerr << "Too many particles of type " << t << " for one GADGET file" << std::endl;
+            return false;
+        }
+        header.npart[t] = (int32_t)counts[t];
+        header.npartTotal[t] = (uint32_t)counts[t];
+        header.npartTotalHighWord[t] = (uint32_t)(counts[t] >> 32);
+    }
+    header.time = time / scale.time;
+    header.numFiles = 1;
+    header.hubbleParam = 1.0;
+    
+    SequentialFile file;
+    if (!file.open(path)) {
+        std::cerr << "Failed to create GADGET file " << path << std::endl;
+        return false;
+    }
+    bool ok = appendBlock(file, "HEAD", 1, sizeof(header), [&](uint64_t, unsigned char* out) {
+        std::memcpy(out, &header, sizeof(header));
+    });
+    
+    const uint64_t n = stars.size();
+    ok = ok && appendBlock(file, "POS", n, 12, [&](uint64_t i, unsigned char* out) {
+        glm::vec3 p = stars[order[i]].position / (float)scale.length;
+        std::memcpy(out, &p, 12);
+    });
+    ok = ok && appendBlock(file, "VEL", n, 12, [&](uint64_t i, unsigned char* out) {
+        glm::vec3 v = stars[order[i]].velocity / (float)scale.velocity;
+        std::memcpy(out, &v, 12);
+    });
+    
+    // IDs identify each particle's index in the simulation, counting from 1
+    const bool wideIds = n >= 0xFFFFFFFFull;
+    ok = ok && appendBlock(file, "ID", n, wideIds ? 8 : 4, [&](uint64_t i, unsigned char* out) {
+        uint64_t id = order[i] + 1;
+        std::memcpy(out, &id, wideIds ? 8 : 4);
+    });
+    ok = ok && appendBlock(file, "MASS", n, 4, [&](uint64_t i, unsigned char* out) {
+        float m = (float)(stars[order[i]].mass / scale.mass);
+        std::memcpy(out, &m, 4);
+    });
+    
+    // Gas needs an internal energy block to be valid initial conditions
+    ok = ok && (counts[SPECIES_GAS] == 0 || appendBlock(file, "U", counts[SPECIES_GAS], 4,
+        [](uint64_t, unsigned char* out) { std::memset(out, 0, 4); }));
+    ok = file.close() && ok;
+    
+    if (!ok) std::cerr << "Failed to write GADGET file " << path << std::endl;
+    return ok;
+}
+
+// GADGET-style HDF5
+//
+// /Header carries the GADGET header fields as attributes; particles of type
+// t live in /PartTypet as Coordinates (N x 3), Velocities (N x 3),
+// ParticleIDs (N) and, where the mass table has no entry, Masses (N).
+
+#ifdef GALAXY_HAVE_HDF5
+
+static bool readAttribute(hid_t group, const char* name, hid_t type, void* out) {
+    if (H5Aexists(group, name) <= 0) return false;
+    hid_t attribute = H5Aopen(group, name, H5P_DEFAULT);
+    bool ok = attribute >= 0 && H5Aread(attribute, type, out) >= 0;
+    if (attribute >= 0) H5Aclose(attribute);
+    return ok;
+}
+
+static bool writeAttribute(hid_t group, const char* name, hid_t type, hsize_t length, const void* value) {
+    hid_t space = length > 1 ? H5Screate_simple(1, &length, NULL) : H5Screate(H5S_SCALAR);
+    hid_t attribute = H5Acreate2(group, name, type, space, H5P_DEFAULT, H5P_DEFAULT);
+    bool ok = attribute >= 0 && H5Awrite(attribute, type, value) >= 0;
+    if (attribute >= 0) H5Aclose(attribute);
+    H5Sclose(space);
+    return ok;
+}
+
+static bool readHeaderHDF5(hid_t file, GadgetHeader& header, uint64_t thisFile[SPECIES_COUNT]) {
+    if (H5Lexists(file, "Header", H5P_DEFAULT) <= 0) return false;
+    hid_t group = H5Gopen2(file, "Header", H5P_DEFAULT);
+    uint64_t total[SPECIES_COUNT] = {0}, high[SPECIES_COUNT] = {0};
+    bool ok = readAttribute(group, "NumPart_ThisFile", H5T_NATIVE_UINT64, thisFile) &&
+              readAttribute(group, "NumPart_Total", H5T_NATIVE_UINT64, total) &&
+              readAttribute(group, "MassTable", H5T_NATIVE_DOUBLE, header.massTable);
+    readAttribute(group, "NumPart_Total_HighWord", H5T_NATIVE_UINT64, high);
+    readAttribute(group, "Time", H5T_NATIVE_DOUBLE, &header.time);
+    readAttribute(group, "Redshift", H5T_NATIVE_DOUBLE, &header.redshift);
+    readAttribute(group, "BoxSize", H5T_NATIVE_DOUBLE, &header.boxSize);
+    readAttribute(group, "Omega0", H5T_NATIVE_DOUBLE, &header.omega0);
+    readAttribute(group, "OmegaLambda", H5T_NATIVE_DOUBLE, &header.omegaLambda);
+    readAttribute(group, "HubbleParam", H5T_NATIVE_DOUBLE, &header.hubbleParam);
+    readAttribute(group, "NumFilesPerSnapshot", H5T_NATIVE_INT, &header.numFiles);
+    H5Gclose(group);
+    
+    for (int t = 0; t < SPECIES_COUNT; t++) header.count[t] = total[t] | (high[t] << 32);
+    header.numFiles = std::max(header.numFiles, 1);
+    return ok;
+}
+
+// Reads rows [0, rows) of a dataset as doubles, one hyperslab of
+// CHUNK_PARTICLES rows at a time; the library converts from the stored type.
+// Conversion into stars runs in parallel, the HDF5 calls stay on this thread
+// as the library is not thread-safe in its usual build.
+template <class Store>
+static bool readRows(hid_t file, const std::string& name, int components, uint64_t rows, Store store) {
+    if (H5Lexists(file, name.c_str(), H5P_DEFAULT) <= 0) return false;
+    hid_t dataset = H5Dopen2(file, name.c_str(), H5P_DEFAULT);
+    hid_t space = H5Dget_space(dataset);
+    int rank = H5Sget_simple_extent_ndims(space);
+    hsize_t dims[2] = {0, 1};
+    H5Sget_simple_extent_dims(space, dims, NULL);
+    bool ok = (rank == 1 || rank == 2) && dims[0] == rows && (rank == 1 ? 1 : (int)dims[1]) == components;
+    
+    std::vector<double> buffer;
+    for (uint64_t begin = 0; begin < rows && ok; begin += CHUNK_PARTICLES) {
+        hsize_t start[2] = {begin, 0};
+        hsize_t count[2] = {std::min(CHUNK_PARTICLES, rows - begin), (hsize_t)components};
+        buffer.resize(count[0] * components);
+        hid_t memory = H5Screate_simple(rank, count, NULL);
+        ok = H5Sselect_hyperslab(space, H5S_SELECT_SET, start, NULL, count, NULL) >= 0 &&
+             H5Dread(dataset, H5T_NATIVE_DOUBLE, memory, space, H5P_DEFAULT, buffer.data()) >= 0;
+        H5Sclose(memory);
+        
+        #pragma omp parallel for
+        for (int64_t i = 0; i < (int64_t)count[0]; i++) {
+            store(begin + i, &buffer[i * components]);
+        }
+    }
+    H5Sclose(space);
+    H5Dclose(dataset);
+    return ok;
+}
+
+// Writes rows from fill(row, out) in hyperslabs into a new chunked dataset
+template <class Fill>
+static bool writeRows(hid_t group, const char* name, hid_t type, size_t valueBytes, int components,
+                      uint64_t rows, Fill fill) {
+    int rank = components > 1 ? 2 : 1;
+    hsize_t dims[2] = {rows, (hsize_t)components};
+    hsize_t chunk[2] = {std::max<hsize_t>(1, std::min<hsize_t>(rows, CHUNK_PARTICLES)), (hsize_t)components};
+    hid_t space = H5Screate_simple(rank, dims, NULL);
+    hid_t properties = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(properties, rank, chunk);
+    hid_t dataset = H5Dcreate2(group, name, type, space, H5P_DEFAULT, properties, H5P_DEFAULT);
+    bool ok = dataset >= 0;
+    
+    std::vector<unsigned char> buffer;
+    const size_t rowBytes = valueBytes * components;
+    for (uint64_t begin = 0; begin < rows && ok; begin += CHUNK_PARTICLES) {
+        hsize_t start[2] = {begin, 0};
+        hsize_t count[2] = {std::min(CHUNK_PARTICLES, rows - begin), (hsize_t)components};
+        buffer.resize(count[0] * rowBytes);
+        #pragma omp parallel for
+        for (int64_t i = 0; i < (int64_t)count[0]; i++) {
+            fill(begin + i, &buffer[i * rowBytes]);
+        }
+        hid_t memory = H5Screate_simple(rank, count, NULL);
+        ok = H5Sselect_hyperslab(space, H5S_SELECT_SET, start, NULL, count, NULL) >= 0 &&
+             H5Dwrite(dataset, type, memory, space, H5P_DEFAULT, buffer.data()) >= 0;
+        H5Sclose(memory);
+    }
+    if (dataset >= 0) H5Dclose(dataset);
+    H5Pclose(properties);
+    H5Sclose(space);
+    return ok;
+}
+
+// Part files are named base.0.hdf5, base.1.hdf5, ...
+static std::string hdf5PartPath(const std::string& path, int index) {
+    size_t dot = path.rfind('.');
+    size_t part = dot == std::string::npos || dot == 0 ? std::string::npos : path.rfind('.', dot - 1);
+    if (part == std::string::npos || path.compare(part, dot - part, ".0") != 0) return path;
+    return path.substr(0, part) + "." + std::to_string(index) + path.substr(dot);
+}
+
+static bool readHDF5File(const std::string& path, std::vector<Star>& stars, uint64_t& next, const GadgetUnits& units) {
+    hid_t file = H5Fopen(path.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (file < 0) {
+        std::cerr << "Failed to open HDF5 file " << path << std::endl;
+        return false;
+    }
+    
+    GadgetHeader header;
+    uint64_t thisFile[SPECIES_COUNT] = {0};
+    bool ok = readHeaderHDF5(file, header, thisFile);
+    const UnitScale scale = unitScale(units, header.hubbleParam);
+    
+    for (int t = 0; t < SPECIES_COUNT && ok; t++) {
+        uint64_t n = thisFile[t];
+        if (n == 0) continue;
+        ok = next + n <= stars.size();
+        if (!ok) break;
+        
+        Star* out = &stars[next];
+        std::string group = "PartType" + std::to_string(t) + "/";
+        ok = readRows(file, group + "Coordinates", 3, n, [&](uint64_t i, const double* v) {
+            out[i].position = glm::vec3(v[0] * scale.length, v[1] * scale.length, v[2] * scale.length);
+        });
+        ok = ok && readRows(file, group + "Velocities", 3, n, [&](uint64_t i, const double* v) {
+            out[i].velocity = glm::vec3(v[0] * scale.velocity, v[1] * scale.velocity, v[2] * scale.velocity);
+        });
+        if (header.massTable[t] != 0.0) {
+            float mass = (float)(header.massTable[t] * scale.mass);
+            for (uint64_t i = 0; i < n; i++) out[i].mass = mass;
+        } else {
+            ok = ok && readRows(file, group + "Masses", 1, n, [&](uint64_t i, const double* v) {
+                out[i].mass = (float)(v[0] * scale.mass);
+            });
+        }
+        finishParticles(out, n, t);
+        next += n;
+    }
+    H5Fclose(file);
+    if (!ok) std::cerr << "Malformed GADGET HDF5 file " << path << std::endl;
+    return ok;
+}
+
+bool readGadgetHDF5(const std::string& path, std::vector<Star>& stars, GadgetHeader* header,
+                    const GadgetUnits& units) {
+    hid_t file = H5Fopen(path.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (file < 0) {
+        std::cerr << "Failed to open HDF5 file " << path << std::endl;
+        return false;
+    }
+    GadgetHeader info;
+    uint64_t thisFile[SPECIES_COUNT];
+    bool ok = readHeaderHDF5(file, info, thisFile);
+    H5Fclose(file);
+    if (!ok) {
+        std::cerr << path << " has no GADGET header" << std::endl;
+        return false;
+    }
+    
+    uint64_t total = 0;
+    for (int t = 0; t < SPECIES_COUNT; t++) total += info.count[t];
+    stars.assign(total, Star());
+    uint64_t next = 0;
+    for (int i = 0; i < info.numFiles; i++) {
+        if (!readHDF5File(info.numFiles > 1 ? hdf5PartPath(path, i) : path, stars, next, units)) return false;
+    }
+    if (next != total) {
+        std::cerr << path << ": expected " << total << " particles, found " << next << std::endl;
+        return false;
+    }
+    if (header) *header = info;
+    return true;
+}
+
+bool writeGadgetHDF5(const std::string& path, const std::vector<Star>& stars, double time,
+                     const GadgetUnits& units) {
+    uint64_t counts[SPECIES_COUNT];
+    std::vector<uint64_t> order = typeOrder(stars, counts);
+    const UnitScale scale = unitScale(units, 1.0);
+    
+    hid_t file = H5Fcreate(path.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    if (file < 0) {
+        std::cerr << "Failed to create HDF5 file " << path << std::endl;
+        return false;
+    }
+    
+    uint64_t high[SPECIES_COUNT];
+    for (int t = 0; t < SPECIES_COUNT; t++) high[t] = counts[t] >> 32;
+    double massTable[SPECIES_COUNT] = {0};
+    double zero = 0.0, one = 1.0;
+    double fileTime = time / scale.time;
+    int numFiles = 1;
+    hid_t headerGroup = H5Gcreate2(file, "Header", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    bool ok = headerGroup >= 0 &&
+              writeAttribute(headerGroup, "NumPart_ThisFile", H5T_NATIVE_UINT64, SPECIES_COUNT, counts) &&
+              writeAttribute(headerGroup, "NumPart_Total", H5T_NATIVE_UINT64, SPECIES_COUNT, counts) &&
+              writeAttribute(headerGroup, "NumPart_Total_HighWord", H5T_NATIVE_UINT64, SPECIES_COUNT, high) &&
+              writeAttribute(headerGroup, "MassTable", H5T_NATIVE_DOUBLE, SPECIES_COUNT, massTable) &&
+              writeAttribute(headerGroup, "Time", H5T_NATIVE_DOUBLE, 1, &fileTime) &&
+              writeAttribute(headerGroup, "Redshift", H5T_NATIVE_DOUBLE, 1, &zero) &&
+              writeAttribute(headerGroup, "BoxSize", H5T_NATIVE_DOUBLE, 1, &zero) &&
+              writeAttribute(headerGroup, "HubbleParam", H5T_NATIVE_DOUBLE, 1, &one) &&
+              writeAttribute(headerGroup, "NumFilesPerSnapshot", H5T_NATIVE_INT, 1, &numFiles);
+    if (headerGroup >= 0) H5Gclose(headerGroup);
+    
+    uint64_t first = 0;
+    for (int t = 0; t < SPECIES_COUNT && ok; t++) {
+        uint64_t n = counts[t];
+        if (n == 0) continue;
+        const uint64_t* typeOrder = &order[first];
+        std::string name = "PartType" + std::to_string(t);
+        hid_t group = H5Gcreate2(file, name.c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        ok = group >= 0 &&
+             writeRows(group, "Coordinates", H5T_NATIVE_FLOAT, 4, 3, n, [&](uint64_t i, unsigned char* out) {
+                 glm::vec3 p = stars[typeOrder[i]].position / (float)scale.length;
+                 std::memcpy(out, &p, 12);
+             }) &&
+             writeRows(group, "Velocities", H5T_NATIVE_FLOAT, 4, 3, n, [&](uint64_t i, unsigned char* out) {
+                 glm::vec3 v = stars[typeOrder[i]].velocity / (float)scale.velocity;
+                 std::memcpy(out, &v, 12);
+             }) &&
+             writeRows(group, "ParticleIDs", H5T_NATIVE_UINT64, 8, 1, n, [&](uint64_t i, unsigned char* out) {
+                 uint64_t id = typeOrder[i] + 1;
+                 std::memcpy(out, &id, 8);
+             }) &&
+             writeRows(group, "Masses", H5T_NATIVE_FLOAT, 4, 1, n, [&](uint64_t i, unsigned char* out) {
+                 float m = (float)(stars[typeOrder[i]].mass / scale.mass);
+                 std::memcpy(out, &m, 4);
+             });
+        if (group >= 0) H5Gclose(group);
+        first += n;
+    }
+    ok = H5Fclose(file) >= 0 && ok;
+    if (!ok) std::cerr << "Failed to write HDF5 file " << path << std::endl;
+    return ok;
+}
+
+#else
+
+bool readGadgetHDF5(const std::string& path, std::vector<Star>&, GadgetHeader*, const GadgetUnits&) {
+    std::cerr << "Cannot read " << path << ": built without HDF5 support" << std::endl;
+    return false;
+}
+
+bool writeGadgetHDF5(const std::string& path, const std::vector<Star>&, double, const GadgetUnits&) {
+    std::cerr << "Cannot write " << path << ": built without HDF5 support" << std::endl;
+    return false;
+}
+
+#endif
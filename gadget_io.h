@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "star.h"
+
+// Initial conditions and snapshots in GADGET-2 binary (SnapFormat 1 and 2)
+// and GADGET-style HDF5, as written by MUSIC, GalIC and GADGET itself.
+// Particle type t becomes species t (see StarSpecies); type 5 particles are
+// black holes. Star ordering on disk is type-major, as GADGET requires.
+//
+// Snapshots split over several files are found by name: "snap" with
+// snap.0, snap.1, ... for binary, "snap.0.hdf5" with snap.1.hdf5, ... for
+// HDF5. Blocks are read and written in 1M-particle chunks, so memory use
+// beyond the Star array stays bounded: pread() from several threads for
+// binary, hyperslabs with parallel conversion for HDF5.
+
+// GADGET internal units expressed in the simulation's, with lengths and
+// masses divided by the file's HubbleParam when hubbleScaled is set
+struct GadgetUnits {
+    double lengthInLightYears = 3261.56; // kpc
+    double massInSolarMasses = 1.0e10;
+    double velocityInKms = 1.0;
+    bool hubbleScaled = true;
+};
+
+struct GadgetHeader {
+    uint64_t count[SPECIES_COUNT] = {0}; // Whole snapshot, all files
+    double massTable[SPECIES_COUNT] = {0};
+    double time = 0.0; // As stored: the scale factor for cosmological runs, else in internal units
+    double redshift = 0.0;
+    double boxSize = 0.0;
+    double omega0 = 0.0;
+    double omegaLambda = 0.0;
+    double hubbleParam = 1.0;
+    int numFiles = 1;
+};
+
+// Picks binary or HDF5 from the extension (.hdf5 or .h5 for HDF5). Writers
+// take time in years and store it in GADGET's time unit, length over
+// velocity, about 0.98 Gyr for kpc and km/s.
+bool readGadget(const std::string& path, std::vector<Star>& stars,
+                GadgetHeader* header = NULL, const GadgetUnits& units = GadgetUnits());
+bool writeGadget(const std::string& path, const std::vector<Star>& stars, double time,
+                 const GadgetUnits& units = GadgetUnits());
+
+bool readGadgetBinary(const std::string& path, std::vector<Star>& stars,
+                      GadgetHeader* header = NULL, const GadgetUnits& units = GadgetUnits());
+// Always SnapFormat 2, single precision, one file
+bool writeGadgetBinary(const std::string& path, const std::vector<Star>& stars, double time,
+                       const GadgetUnits& units = GadgetUnits());
+
+// Fail with a message unless built with HDF5 (GALAXY_HAVE_HDF5)
+bool readGadgetHDF5(const std::string& path, std::vector<Star>& stars,
+                    GadgetHeader* header = NULL, const GadgetUnits& units = GadgetUnits());
+bool writeGadgetHDF5(const std::string& path, const std::vector<Star>& stars, double time,
+                     const GadgetUnits& units = GadgetUnits());
@@ -0,0 +1,195 @@
+#include "galaxy_core.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <utility>
+#include "snapshot.h"
+
+Star centralBlackHole(float mass) {
+    Star blackHole;
+    blackHole.position = glm::vec3(0.0f);
+    blackHole.velocity = glm::vec3(0.0f);
+    blackHole.mass = mass;
+    blackHole.size = BLACK_HOLE_DISPLAY_SIZE;
+    blackHole.isBlackHole = true;
+    blackHole.species = SPECIES_BLACK_HOLE;
+    return blackHole;
+}
+
+void generateGalaxy(const GalaxyParameters& parameters, std::vector<Star>& stars) {
+    std::random_device rd;
+    std::mt19937 gen(parameters.seed ? parameters.seed : rd());
+    std::normal_distribution<float> massDist(1.0f, 0.5f); // Solar masses
+    std::uniform_real_distribution<float> posDist(-parameters.size/2, parameters.size/2);
+    std::uniform_real_distribution<float> velDist(-100.0f, 100.0f); // km/s
+    
+    stars.clear();
+    stars.reserve(parameters.starCount + 1);
+    stars.push_back(centralBlackHole(parameters.blackHoleMass));
+    
+    // Generate random stars
+    for (size_t i = 0; i < parameters.starCount; i++) {
+        Star star;
+        star.position = glm::vec3(posDist(gen), posDist(gen), posDist(gen));
+        star.velocity = glm::vec3(velDist(gen), velDist(gen), velDist(gen));
+        star.mass = std::max(0.1f, massDist(gen));
+        star.size = starDisplaySize(star.mass);
+        star.isBlackHole = false;
+        star.species = SPECIES_DISK;
+        stars.push_back(star);
+    }
+    
+    // Keep consecutive stars spatially close so chunks cull well
+    sortStarsSpatially(stars, 1);
+}
+
+void adoptStars(std::vector<Star>& stars, float blackHoleMass) {
+    size_t heaviest = stars.size();
+    for (size_t i = 0; i < stars.size(); i++) {
+        if (stars[i].isBlackHole && (heaviest == stars.size() || stars[i].mass > stars[heaviest].mass))
+            heaviest = i;
+    }
+    if (heaviest < stars.size()) {
+        std::swap(stars[0], stars[heaviest]);
+    } else {
+        stars.insert(stars.begin(), centralBlackHole(blackHoleMass));
+    }
+    sortStarsSpatially(stars, 1);
+}
+
+// Spread the low 10 bits of v so there are two zero bits between each
+static uint32_t expandBits(uint32_t v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+void sortStarsSpatially(std::vector<Star>& stars, size_t first) {
+    if (stars.size() <= first + 1) return;
+    
+    glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+    for (size_t i = first; i < stars.size(); i++) {
+        lo = glm::min(lo, stars[i].position);
+        hi = glm::max(hi, stars[i].position);
+    }
+    glm::vec3 scale = 1023.0f / glm::max(hi - lo, glm::vec3(1e-6f));
+    
+    std::vector<std::pair<uint32_t, uint32_t>> keys(stars.size() - first);
+    #pragma omp parallel for
+    for (size_t i = first; i < stars.size(); i++) {
+        glm::vec3 q = (stars[i].position - lo) * scale;
+        uint32_t code = (expandBits((uint32_t)q.x) << 2) |
+                        (expandBits((uint32_t)q.y) << 1) |
+                         expandBits((uint32_t)q.z);
+        keys[i - first] = std::make_pair(code, (uint32_t)i);
+    }
+    std::sort(keys.begin(), keys.end());
+    
+    std::vector<Star> sorted(stars.begin(), stars.begin() + first);
+    sorted.reserve(stars.size());
+    for (const auto& key : keys) {
+        sorted.push_back(stars[key.second]);
+    }
+    stars.swap(sorted);
+}
+
+void integrateStars(std::vector<Star>& stars, float deltaTime) {
+    #pragma omp parallel for
+    for (size_t i = 0; i < stars.size(); i++) {
+        if (stars[i].isBlackHole) continue;
+        advanceStar(stars[i], stars[0], deltaTime);
+    }
+}
+
+float starTimestep(const Star& star, const Star& blackHole, const TimestepCriteria& criteria) {
+    glm::vec3 r = blackHole.position - star.position;
+    float distance2 = glm::dot(r, r);
+    float distance = std::sqrt(distance2);
+    float gm = (float)(G * blackHole.mass);
+    float acceleration = gm / distance2;
+    float limit = std::sqrt(criteria.softening / acceleration);               // Courant-like
+    limit = std::min(limit, distance / glm::length(star.velocity));           // Crossing time
+    limit = std::min(limit, std::sqrt(distance * distance2 / gm));            // Dynamical time
+    return limit;
+}
+
+float integrateStars(std::vector<Star>& stars, float deltaTime, const TimestepCriteria& criteria) {
+    float limit = criteria.maxStep / criteria.accuracy;
+    #pragma omp parallel for reduction(min:limit)
+    for (size_t i = 0; i < stars.size(); i++) {
+        if (stars[i].isBlackHole) continue;
+        advanceStar(stars[i], stars[0], deltaTime);
+        limit = std::min(limit, starTimestep(stars[i], stars[0], criteria));
+    }
+    return std::max(limit * criteria.accuracy, criteria.minStep);
+}
+
+TimestepController::TimestepController(const TimestepCriteria& criteria, StepFunction integrate)
+    : criteria(criteria), integrate(std::move(integrate)) {}
+
+StepFunction TimestepController::defaultIntegrator() {
+    return [](std::vector<Star>& stars, float dt, const TimestepCriteria& criteria) {
+        return integrateStars(stars, dt, criteria);
+    };
+}
+
+void TimestepController::accumulate(double interval, int maxSteps) {
+    backlog += interval;
+    if (dt > 0.0f) backlog = std::min(backlog, (double)dt * maxSteps);
+}
+
+float TimestepController::step(std::vector<Star>& stars) {
+    if (dt <= 0.0f) dt = integrate(stars, 0.0f, criteria);
+    if (backlog < dt) return 0.0f;
+    float taken = dt;
+    dt = integrate(stars, taken, criteria);
+    backlog -= taken;
+    return taken;
+}
+
+GalaxyCore::GalaxyCore(const GalaxyParameters& parameters) {
+    generateGalaxy(parameters, particles);
+}
+
+GalaxyCore::GalaxyCore(std::vector<Star>&& loaded, float blackHoleMass) : particles(std::move(loaded)) {
+    adoptStars(particles, blackHoleMass);
+}
+
+void GalaxyCore::step(float dt, uint64_t count) {
+    for (uint64_t i = 0; i < count; i++) {
+        integrateStars(particles, dt);
+        steps++;
+        simulationTime += dt;
+    }
+}
+
+bool GalaxyCore::checkpoint(const std::string& path) const {
+    return writeSnapshot(path, particles, steps, simulationTime, SnapshotOptions());
+}
+
+bool GalaxyCore::restore(const std::string& path) {
+    SnapshotReader reader;
+    if (!reader.open(path)) return false;
+    if (reader.info().count != particles.size()) {
+        std::cerr << path << " holds " << reader.info().count << " stars, not " << particles.size() << std::endl;
+        return false;
+    }
+    if (!reader.read(0, particles.size(), particles.data())) return false;
+    steps = reader.info().step;
+    simulationTime = reader.info().time;
+    return true;
+}
+
+std::vector<uint32_t> GalaxyCore::queryRadius(const glm::vec3& center, float radius) const {
+    std::vector<uint32_t> found;
+    float radius2 = radius * radius;
+    for (size_t i = 0; i < particles.size(); i++) {
+        glm::vec3 d = particles[i].position - center;
+        if (glm::dot(d, d) <= radius2) found.push_back((uint32_t)i);
+    }
+    return found;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "star.h"
+
+// The simulation without any rendering: galaxy setup, the integrator and
+// the clock. The viewer, tools and the Python module all drive this.
+
+const double G = 6.67430e-11; // Gravitational constant
+
+struct GalaxyParameters {
+    size_t starCount = 1000000;
+    float size = 100000.0f;         // Light years
+    float blackHoleMass = 4.154e6f; // Solar masses (Sagittarius A*)
+    uint32_t seed = 0;              // 0 for a different galaxy every run
+};
+
+Star centralBlackHole(float mass);
+
+// A central black hole in a uniform cube of stars, spatially sorted
+void generateGalaxy(const GalaxyParameters& parameters, std::vector<Star>& stars);
+
+// Prepares particles read from initial conditions. The integrator pulls
+// everything towards stars[0], so the heaviest black hole goes there, or a
+// new one of blackHoleMass if there is none.
+void adoptStars(std::vector<Star>& stars, float blackHoleMass);
+
+// Reorders stars[first..] along a Morton curve so consecutive indices are
+// spatially close. Everything before first (the black hole) stays in place.
+void sortStarsSpatially(std::vector<Star>& stars, size_t first);
+
+// One kick and drift of star under the pull of blackHole
+inline void advanceStar(Star& star, const Star& blackHole, float dt) {
+    glm::vec3 r = blackHole.position - star.position;
+    float distance = glm::length(r);
+    float forceMagnitude = G * blackHole.mass * star.mass / (distance * distance);
+    glm::vec3 totalForce = forceMagnitude * glm::normalize(r);
+    
+    star.velocity += totalForce / star.mass * dt;
+    star.position += star.velocity * dt;
+}
+
+// Advances every star but the black holes by dt under the pull of stars[0]
+void integrateStars(std::vector<Star>& stars, float dt);
+
+// Limits on the step size; each is a time scale scaled by accuracy
+struct TimestepCriteria {
+    float accuracy = 0.02f;   // Fraction of the shortest time scale per step
+    float softening = 1.0f;   // Light years; the acceleration limit is sqrt(softening / |a|)
+    float minStep = 1.0e-4f;  // Years; keeps a star on the black hole from stalling the run
+    float maxStep = 1.0f;     // Years; keeps the display moving when nothing is close
+};
+
+// Stable step for one star under the black hole, before scaling by accuracy
+float starTimestep(const Star& star, const Star& blackHole, const TimestepCriteria& criteria);
+
+// integrateStars that also returns the stable step for the positions it
+// leaves, reduced in the same parallel pass: the minimum over stars of the
+// acceleration limit, the time to cross the distance to the black hole and
+// the dynamical time there, times accuracy
+float integrateStars(std::vector<Star>& stars, float dt, const TimestepCriteria& criteria);
+
+// An integration scheme: advances stars by dt and returns the stable step
+// for where it leaves them. A dt of 0 only measures the stable step.
+using StepFunction = std::function<float(std::vector<Star>& stars, float dt, const TimestepCriteria& criteria)>;
+
+// Decouples the physical step from the frame rate. Frames add the simulated
+// time they want to show; the controller pays it off in stable steps, only
+// once a whole step is owed, so steps are never shorter than stability
+// needs. A step is chosen from the stars as the previous step left them.
+class TimestepController {
+public:
+    explicit TimestepController(const TimestepCriteria& criteria = TimestepCriteria(),
+                                StepFunction integrate = defaultIntegrator());
+    
+    // Adds time to catch up on. At most maxSteps steps are kept owed, so a
+    // slow machine shows the simulation slower instead of falling behind.
+    void accumulate(double interval, int maxSteps);
+    // Takes one stable step if that much time is owed; returns its size or 0
+    float step(std::vector<Star>& stars);
+    
+    float stableStep() const { return dt; }
+    double owed() const { return backlog; }
+    // For when the stars were changed other than by step()
+    void reset() { dt = 0.0f; }
+    
+    // Kick-drift under the black hole alone
+    static StepFunction defaultIntegrator();
+    
+private:
+    TimestepCriteria criteria;
+    StepFunction integrate;
+    float dt = 0.0f; // Not yet known
+    double backlog = 0.0;
+};
+
+class GalaxyCore {
+public:
+    explicit GalaxyCore(const GalaxyParameters& parameters = GalaxyParameters());
+    // Takes over particles read from initial conditions
+    GalaxyCore(std::vector<Star>&& loaded, float blackHoleMass);
+    
+    void step(float dt, uint64_t count = 1);
+    
+    // The star array is allocated once and never moves, so pointers into
+    // it stay valid for the life of the core
+    std::vector<Star>& stars() { return particles; }
+    const std::vector<Star>& stars() const { return particles; }
+    
+    uint64_t stepCount() const { return steps; }
+    double time() const { return simulationTime; }
+    
+    // Lossless snapshot of the stars and the clock
+    bool checkpoint(const std::string& path) const;
+    // Fails unless the checkpoint has the same star count
+    bool restore(const std::string& path);
+    
+    // Indices of the stars within radius of center
+    std::vector<uint32_t> queryRadius(const glm::vec3& center, float radius) const;
+    
+private:
+    std::vector<Star> particles;
+    uint64_t steps = 0;
+    double simulationTime = 0.0;
+};
@@ -0,0 +1,153 @@
+/*
+ * Shared-memory view of a running simulation, for external tools.
+ * Plain C so dashboards and analysis scripts (ctypes, cffi) can use it.
+ *
+ * galaxy_sim --publish /name creates a POSIX shared-memory segment:
+ *
+ *   struct galaxy_shm_header          magic, layout, the two slots
+ *   stars of slot 0, stars of slot 1  capacity records each
+ *
+ * The simulation fills the slots alternately. Each slot is a seqlock: its
+ * sequence is odd while being written and advances by two per frame, and
+ * "latest" names the slot finished last. A reader copies the latest slot
+ * and keeps the copy only if the sequence was even and unchanged
+ * throughout; the writer never waits for readers, and readers never write.
+ * With two slots a reader is only retried if its copy takes longer than a
+ * whole frame.
+ *
+ * Readers map the segment read-only with galaxy_shm_open() and take
+ * frames with galaxy_shm_read(). The writer unlinks the segment when it
+ * exits and sets GALAXY_SHM_CLOSED first; existing mappings stay valid.
+ */
+#ifndef GALAXY_SHM_H
+#define GALAXY_SHM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define GALAXY_SHM_MAGIC 0x4D48535958414C47ULL /* "GLAXYSHM" */
+#define GALAXY_SHM_VERSION 1
+#define GALAXY_SHM_CLOSED 1u
+#define GALAXY_SHM_READ_ATTEMPTS 64
+
+/* One star, laid out as the simulation's Star */
+struct galaxy_shm_star {
+    float position[3]; /* Light years */
+    float velocity[3];
+    float mass;        /* Solar masses */
+    float size;        /* Display size */
+    uint8_t black_hole;
+    uint8_t species;   /* 0 gas, 1 halo, 2 disk, 3 bulge, 4 star, 5 black hole */
+    uint8_t reserved[2];
+};
+
+struct galaxy_shm_slot {
+    uint64_t sequence; /* Odd while the slot is being written */
+    uint64_t count;    /* Stars in this frame, at most capacity */
+    uint64_t step;
+    double time;       /* Simulation years */
+    uint64_t offset;   /* Byte offset of the slot's stars in the segment */
+    uint64_t reserved[3];
+};
+
+struct galaxy_shm_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t star_bytes; /* sizeof(struct galaxy_shm_star) */
+    uint64_t capacity;   /* Stars per slot */
+    uint64_t latest;     /* Index of the slot finished last */
+    uint64_t frames;     /* Frames published; 0 until the first one */
+    uint32_t flags;
+    uint32_t writer_pid;
+    uint64_t reserved[2];
+    struct galaxy_shm_slot slots[2];
+};
+
+static inline uint64_t galaxy_shm_segment_bytes(uint64_t capacity) {
+    return sizeof(struct galaxy_shm_header) + 2 * capacity * sizeof(struct galaxy_shm_star);
+}
+
+struct galaxy_shm_reader {
+    const struct galaxy_shm_header* header;
+    size_t bytes;
+};
+
+/* Maps an existing segment read-only; returns 0 on success, -1 if it does
+ * not exist or has the wrong layout */
+static inline int galaxy_shm_open(struct galaxy_shm_reader* reader, const char* name) {
+    struct stat st;
+    void* map;
+    int fd = shm_open(name, O_RDONLY, 0);
+    reader->header = NULL;
+    reader->bytes = 0;
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct galaxy_shm_header)) {
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+    reader->header = (const struct galaxy_shm_header*)map;
+    reader->bytes = (size_t)st.st_size;
+    if (reader->header->magic != GALAXY_SHM_MAGIC || reader->header->version != GALAXY_SHM_VERSION ||
+        reader->header->star_bytes != sizeof(struct galaxy_shm_star) ||
+        galaxy_shm_segment_bytes(reader->header->capacity) > reader->bytes) {
+        munmap(map, reader->bytes);
+        reader->header = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static inline void galaxy_shm_close(struct galaxy_shm_reader* reader) {
+    if (reader->header) munmap((void*)reader->header, reader->bytes);
+    reader->header = NULL;
+}
+
+/* Copies the latest complete frame into out, which has room for max_count
+ * stars. Returns the star count, 0 if nothing has been published yet, or
+ * -1 if no consistent copy could be taken (the writer kept overtaking us,
+ * or the frame does not fit). */
+static inline int64_t galaxy_shm_read(const struct galaxy_shm_reader* reader, struct galaxy_shm_star* out,
+                                      uint64_t max_count, uint64_t* step, double* time) {
+    const struct galaxy_shm_header* h = reader->header;
+    int attempt;
+    if (__atomic_load_n(&h->frames, __ATOMIC_ACQUIRE) == 0) return 0;
+    for (attempt = 0; attempt < GALAXY_SHM_READ_ATTEMPTS; attempt++) {
+        const struct galaxy_shm_slot* slot = &h->slots[__atomic_load_n(&h->latest, __ATOMIC_ACQUIRE) & 1];
+        uint64_t before = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        uint64_t count = slot->count;
+        uint64_t frame_step = slot->step;
+        double frame_time = slot->time;
+        if (before & 1) continue;
+        if (count > max_count || count > h->capacity) {
+            /* Only trust the count if it was not torn */
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == before) return -1;
+            continue;
+        }
+        memcpy(out, (const char*)h + slot->offset, count * sizeof(struct galaxy_shm_star));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) != before) continue;
+        if (step) *step = frame_step;
+        if (time) *time = frame_time;
+        return (int64_t)count;
+    }
+    return -1;
+}
+
+/* Frames published so far; poll it to wait for a new one */
+static inline uint64_t galaxy_shm_frames(const struct galaxy_shm_reader* reader) {
+    return __atomic_load_n(&reader->header->frames, __ATOMIC_ACQUIRE);
+}
+
+static inline int galaxy_shm_closed(const struct galaxy_shm_reader* reader) {
+    return (__atomic_load_n(&reader->header->flags, __ATOMIC_ACQUIRE) & GALAXY_SHM_CLOSED) != 0;
+}
+
+#endif
@@ -0,0 +1,129 @@
+#include "gl_state.h"
+
+namespace glstate {
+
+static const GLuint UNKNOWN = ~0u;
+static const GLuint MAX_TEXTURE_UNITS = 16;
+
+enum class Toggle { Unknown, Off, On };
+
+struct State {
+    GLuint program = UNKNOWN;
+    GLuint vao = UNKNOWN;
+    GLuint arrayBuffer = UNKNOWN;
+    GLuint framebuffer = UNKNOWN;
+    GLuint activeUnit = UNKNOWN;
+    GLuint textures[MAX_TEXTURE_UNITS];
+    Toggle blend = Toggle::Unknown;
+    Toggle depthTest = Toggle::Unknown;
+    Toggle depthMask = Toggle::Unknown;
+    GLenum blendSrc = UNKNOWN, blendDst = UNKNOWN;
+    GLint viewport[4] = {-1, -1, -1, -1};
+    
+    State() {
+        for (GLuint& bound : textures) bound = UNKNOWN;
+    }
+};
+
+static State state;
+
+static Toggle toggle(bool enabled) {
+    return enabled ? Toggle::On : Toggle::Off;
+}
+
+void useProgram(GLuint program) {
+    if (state.program == program) return;
+    glUseProgram(program);
+    state.program = program;
+}
+
+void bindVertexArray(GLuint vao) {
+    if (state.vao == vao) return;
+    glBindVertexArray(vao);
+    state.vao = vao;
+}
+
+void bindArrayBuffer(GLuint buffer) {
+    if (state.arrayBuffer == buffer) return;
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    state.arrayBuffer = buffer;
+}
+
+void bindFramebuffer(GLuint fbo) {
+    if (state.framebuffer == fbo) return;
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    state.framebuffer = fbo;
+}
+
+void bindTexture2D(GLuint unit, GLuint texture) {
+    if (unit >= MAX_TEXTURE_UNITS) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        state.activeUnit = unit;
+        return;
+    }
+    if (state.textures[unit] == texture) return;
+    if (state.activeUnit != unit) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        state.activeUnit = unit;
+    }
+    glBindTexture(GL_TEXTURE_2D, texture);
+    state.textures[unit] = texture;
+}
+
+static void setCapability(GLenum cap, Toggle& cached, bool enabled) {
+    if (cached == toggle(enabled)) return;
+    if (enabled)
+        glEnable(cap);
+    else
+        glDisable(cap);
+    cached = toggle(enabled);
+}
+
+void setBlend(bool enabled) {
+    setCapability(GL_BLEND, state.blend, enabled);
+}
+
+void setDepthTest(bool enabled) {
+    setCapability(GL_DEPTH_TEST, state.depthTest, enabled);
+}
+
+void setDepthMask(bool enabled) {
+    if (state.depthMask == toggle(enabled)) return;
+    glDepthMask(enabled ? GL_TRUE : GL_FALSE);
+    state.depthMask = toggle(enabled);
+}
+
+void blendFunc(GLenum src, GLenum dst) {
+    if (state.blendSrc == src && state.blendDst == dst) return;
+    glBlendFunc(src, dst);
+    state.blendSrc = src;
+    state.blendDst = dst;
+}
+
+void viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+    GLint* v = state.viewport;
+    if (v[0] == x && v[1] == y && v[2] == width && v[3] == height) return;
+    glViewport(x, y, width, height);
+    v[0] = x; v[1] = y; v[2] = width; v[3] = height;
+}
+
+void forgetProgram(GLuint program) {
+    if (state.program == program) state.program = UNKNOWN;
+}
+
+void forgetFramebuffer(GLuint fbo) {
+    if (state.framebuffer == fbo) state.framebuffer = UNKNOWN;
+}
+
+void forgetTexture(GLuint texture) {
+    for (GLuint& bound : state.textures) {
+        if (bound == texture) bound = UNKNOWN;
+    }
+}
+
+void invalidate() {
+    state = State();
+}
+
+}
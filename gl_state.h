@@ -0,0 +1,30 @@
+#pragma once
+
+#include <GL/glew.h>
+
+// Shadow copy of the GL bindings this program changes every frame, so
+// redundant binds and state toggles never reach the driver. All code that
+// touches these bindings must go through here, or call invalidate() after.
+namespace glstate {
+
+void useProgram(GLuint program);
+void bindVertexArray(GLuint vao);
+void bindArrayBuffer(GLuint buffer);
+void bindFramebuffer(GLuint fbo);
+void bindTexture2D(GLuint unit, GLuint texture);
+void setBlend(bool enabled);
+void setDepthTest(bool enabled);
+void setDepthMask(bool enabled);
+void blendFunc(GLenum src, GLenum dst);
+void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+// Drop cached bindings to objects that are about to be deleted, since GL
+// may hand the same name out again
+void forgetProgram(GLuint program);
+void forgetFramebuffer(GLuint fbo);
+void forgetTexture(GLuint texture);
+
+// Forget everything, e.g. after third-party code touched the context
+void invalidate();
+
+}
@@ -0,0 +1,183 @@
+#include "hdr_pipeline.h"
+#include "gl_state.h"
+
+// Fullscreen triangle generated from gl_VertexID, no vertex buffer needed
+static const char* fullscreenVertexSource = R"(
+    #version 330 core
+    out vec2 TexCoord;
+    
+    void main() {
+        vec2 pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+        TexCoord = pos;
+        gl_Position = vec4(pos * 2.0 - 1.0, 0.0, 1.0);
+    }
+)";
+
+// Extract the over-threshold part of the scene while downsampling
+static const char* brightFragmentSource = R"(
+    #version 330 core
+    in vec2 TexCoord;
+    out vec4 FragColor;
+    
+    uniform sampler2D scene;
+    uniform float threshold;
+    
+    void main() {
+        vec3 color = texture(scene, TexCoord).rgb;
+        FragColor = vec4(max(color - vec3(threshold), vec3(0.0)), 1.0);
+    }
+)";
+
+// Separable 9-tap Gaussian, run once horizontally and once vertically
+static const char* blurFragmentSource = R"(
+    #version 330 core
+    in vec2 TexCoord;
+    out vec4 FragColor;
+    
+    uniform sampler2D image;
+    uniform vec2 direction;
+    
+    const float weights[5] = float[](0.227027, 0.1945946, 0.1216216, 0.054054, 0.016216);
+    
+    void main() {
+        vec2 texel = direction / vec2(textureSize(image, 0));
+        vec3 result = texture(image, TexCoord).rgb * weights[0];
+        for (int i = 1; i < 5; i++) {
+            result += texture(image, TexCoord + texel * float(i)).rgb * weights[i];
+            result += texture(image, TexCoord - texel * float(i)).rgb * weights[i];
+        }
+        FragColor = vec4(result, 1.0);
+    }
+)";
+
+// Add bloom, then ACES filmic tone mapping and gamma encoding
+static const char* compositeFragmentSource = R"(
+    #version 330 core
+    in vec2 TexCoord;
+    out vec4 FragColor;
+    
+    uniform sampler2D scene;
+    uniform sampler2D bloom;
+    uniform float exposure;
+    uniform float bloomStrength;
+    
+    vec3 aces(vec3 x) {
+        return clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+    }
+    
+    void main() {
+        vec3 hdr = texture(scene, TexCoord).rgb + bloomStrength * texture(bloom, TexCoord).rgb;
+        vec3 mapped = aces(hdr * exposure);
+        FragColor = vec4(pow(mapped, vec3(1.0 / 2.2)), 1.0);
+    }
+)";
+
+static void createColorTarget(GLuint& fbo, GLuint& texture, int width, int height) {
+    glGenTextures(1, &texture);
+    glstate::bindTexture2D(0, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_HALF_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    
+    glGenFramebuffers(1, &fbo);
+    glstate::bindFramebuffer(fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+}
+
+HDRPipeline::HDRPipeline(int width, int height)
+    : width(width), height(height),
+      brightProgram(fullscreenVertexSource, brightFragmentSource),
+      blurProgram(fullscreenVertexSource, blurFragmentSource),
+      compositeProgram(fullscreenVertexSource, compositeFragmentSource) {
+    // Core profile requires a bound VAO even for attribute-less draws
+    glGenVertexArrays(1, &fullscreenVAO);
+    
+    createTargets();
+}
+
+HDRPipeline::~HDRPipeline() {
+    destroyTargets();
+    glDeleteVertexArrays(1, &fullscreenVAO);
+}
+
+void HDRPipeline::createTargets() {
+    createColorTarget(sceneFBO, sceneTexture, width, height);
+    for (int i = 0; i < 2; i++) {
+        createColorTarget(bloomFBO[i], bloomTexture[i], width / 2, height / 2);
+    }
+    glstate::bindFramebuffer(0);
+}
+
+void HDRPipeline::destroyTargets() {
+    glstate::forgetFramebuffer(sceneFBO);
+    glstate::forgetTexture(sceneTexture);
+    for (int i = 0; i < 2; i++) {
+        glstate::forgetFramebuffer(bloomFBO[i]);
+        glstate::forgetTexture(bloomTexture[i]);
+    }
+    glDeleteFramebuffers(1, &sceneFBO);
+    glDeleteTextures(1, &sceneTexture);
+    glDeleteFramebuffers(2, bloomFBO);
+    glDeleteTextures(2, bloomTexture);
+}
+
+void HDRPipeline::resize(int newWidth, int newHeight) {
+    if (newWidth == width && newHeight == height) return;
+    if (newWidth <= 0 || newHeight <= 0) return; // Minimized
+    width = newWidth;
+    height = newHeight;
+    destroyTargets();
+    createTargets();
+}
+
+void HDRPipeline::beginScene() {
+    glstate::bindFramebuffer(sceneFBO);
+    glstate::viewport(0, 0, width, height);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    
+    // Additive accumulation is order independent: no sorting, no depth
+    glstate::setDepthTest(false);
+    glstate::setDepthMask(false);
+    glstate::setBlend(true);
+    glstate::blendFunc(GL_ONE, GL_ONE);
+}
+
+void HDRPipeline::endScene(GLuint targetFBO) {
+    glstate::setBlend(false);
+    glstate::bindVertexArray(fullscreenVAO);
+    
+    // Bright pass into half resolution
+    glstate::viewport(0, 0, width / 2, height / 2);
+    glstate::bindFramebuffer(bloomFBO[0]);
+    brightProgram.use();
+    glUniform1i(brightProgram.uniform("scene"), 0);
+    glUniform1f(brightProgram.uniform("threshold"), bloomThreshold);
+    glstate::bindTexture2D(0, sceneTexture);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    
+    // Horizontal then vertical blur, ending back in bloomTexture[0]
+    blurProgram.use();
+    glUniform1i(blurProgram.uniform("image"), 0);
+    GLint directionLoc = blurProgram.uniform("direction");
+    for (int pass = 0; pass < 2; pass++) {
+        glstate::bindFramebuffer(bloomFBO[1 - pass]);
+        glUniform2f(directionLoc, pass == 0 ? 1.0f : 0.0f, pass == 0 ? 0.0f : 1.0f);
+        glstate::bindTexture2D(0, bloomTexture[pass]);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+    
+    // Composite and tone map into the window
+    glstate::bindFramebuffer(targetFBO);
+    glstate::viewport(0, 0, width, height);
+    compositeProgram.use();
+    glUniform1i(compositeProgram.uniform("scene"), 0);
+    glUniform1i(compositeProgram.uniform("bloom"), 1);
+    glUniform1f(compositeProgram.uniform("exposure"), exposure);
+    glUniform1f(compositeProgram.uniform("bloomStrength"), bloomStrength);
+    glstate::bindTexture2D(0, sceneTexture);
+    glstate::bindTexture2D(1, bloomTexture[0]);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
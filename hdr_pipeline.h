@@ -0,0 +1,42 @@
+#pragma once
+
+#include <GL/glew.h>
+#include "shader.h"
+
+// Order-independent star rendering: points are accumulated additively into a
+// half-float target with depth disabled, then a single bloom + tone-mapping
+// pass resolves the result into the default framebuffer.
+class HDRPipeline {
+public:
+    HDRPipeline(int width, int height);
+    ~HDRPipeline();
+    
+    HDRPipeline(const HDRPipeline&) = delete;
+    HDRPipeline& operator=(const HDRPipeline&) = delete;
+    
+    // Recreates the render targets if the framebuffer size changed
+    void resize(int width, int height);
+    
+    // Binds and clears the HDR target and sets additive blend state
+    void beginScene();
+    
+    // Bloom and tone-map the accumulated scene into targetFBO, by default the
+    // window; the target must be at least as large as the pipeline
+    void endScene(GLuint targetFBO = 0);
+    
+    float exposure = 1.0f;
+    float bloomThreshold = 1.0f;
+    float bloomStrength = 0.6f;
+    
+private:
+    void createTargets();
+    void destroyTargets();
+    
+    int width, height;
+    
+    GLuint sceneFBO = 0, sceneTexture = 0;
+    GLuint bloomFBO[2] = {0, 0}, bloomTexture[2] = {0, 0}; // Half resolution ping-pong
+    GLuint fullscreenVAO = 0;
+    
+    ShaderProgram brightProgram, blurProgram, compositeProgram;
+};
@@ -0,0 +1,221 @@
+#include "hermite.h"
+#include <algorithm>
+#include <cmath>
+#include "composition.h"
+
+static const double HERMITE_START_ACCURACY = 0.01; // eta for the first step, from |a| / |j| alone
+
+bool HermiteRegion::contains(const Star& star, const Star& blackHole) const {
+    if (species & (1u << star.species)) return true;
+    glm::vec3 r = star.position - blackHole.position;
+    return glm::dot(r, r) < radius * radius;
+}
+
+HermiteIntegrator::HermiteIntegrator(const HermiteRegion& region, double accuracy, double softening)
+    : region(region), eta(accuracy), softening2(softening * softening) {}
+
+// Coarsest level whose block step is within the desired step
+int HermiteIntegrator::levelFor(double desired, double dt) {
+    int level = 0;
+    while (level < HERMITE_MAX_LEVELS && dt / (double)(1ull << level) > desired) level++;
+    return level;
+}
+
+void HermiteIntegrator::load(const std::vector<Star>& stars) {
+    size_t n = members.size();
+    gm.resize(n);
+    for (int d = 0; d < 3; d++) {
+        x[d].resize(n);
+        v[d].resize(n);
+        a[d].resize(n);
+        j[d].resize(n);
+        xp[d].resize(n);
+        vp[d].resize(n);
+    }
+    time.assign(n, 0);
+    stepTicks.resize(n);
+    desired.resize(n);
+    for (size_t k = 0; k < n; k++) {
+        const Star& star = stars[members[k]];
+        gm[k] = G * star.mass;
+        for (int d = 0; d < 3; d++) {
+            x[d][k] = (double)star.position[d] - origin[d];
+            v[d][k] = star.velocity[d];
+        }
+    }
+}
+
+// Every member to the given tick, from its own last correction
+void HermiteIntegrator::predict(uint64_t tick, double tickSeconds) {
+    #pragma omp parallel for
+    for (size_t k = 0; k < members.size(); k++) {
+        double h = (double)(tick - time[k]) * tickSeconds;
+        for (int d = 0; d < 3; d++) {
+            xp[d][k] = x[d][k] + h * (v[d][k] + h / 2 * (a[d][k] + h / 3 * j[d][k]));
+            vp[d][k] = v[d][k] + h * (a[d][k] + h / 2 * j[d][k]);
+        }
+    }
+}
+
+// Acceleration and jerk on member i at its predicted state. The member sum
+// runs over arrays, so it vectorizes; softening makes the self term zero.
+void HermiteIntegrator::force(size_t i, double acceleration[3], double jerk[3]) const {
+    double xi = xp[0][i], yi = xp[1][i], zi = xp[2][i];
+    double vxi = vp[0][i], vyi = vp[1][i], vzi = vp[2][i];
+    
+    // The black hole, at the origin and unsoftened
+    double r2 = xi * xi + yi * yi + zi * zi;
+    double inv2 = 1.0 / r2;
+    double inv3 = mu * inv2 * std::sqrt(inv2);
+    double rv = 3.0 * (xi * vxi + yi * vyi + zi * vzi) * inv2;
+    double ax = -inv3 * xi, ay = -inv3 * yi, az = -inv3 * zi;
+    double jx = -inv3 * (vxi - rv * xi), jy = -inv3 * (vyi - rv * yi), jz = -inv3 * (vzi - rv * zi);
+    
+    const double* px = xp[0].data();
+    const double* py = xp[1].data();
+    const double* pz = xp[2].data();
+    const double* qx = vp[0].data();
+    const double* qy = vp[1].data();
+    const double* qz = vp[2].data();
+    const double* m = gm.data();
+    size_t n = members.size();
+    #pragma omp simd reduction(+:ax, ay, az, jx, jy, jz)
+    for (size_t k = 0; k < n; k++) {
+        double dx = px[k] - xi, dy = py[k] - yi, dz = pz[k] - zi;
+        double dvx = qx[k] - vxi, dvy = qy[k] - vyi, dvz = qz[k] - vzi;
+        double s2 = 1.0 / (dx * dx + dy * dy + dz * dz + softening2);
+        double s3 = m[k] * s2 * std::sqrt(s2);
+        double sv = 3.0 * (dx * dvx + dy * dvy + dz * dvz) * s2;
+        ax += s3 * dx;
+        ay += s3 * dy;
+        az += s3 * dz;
+        jx += s3 * (dvx - sv * dx);
+        jy += s3 * (dvy - sv * dy);
+        jz += s3 * (dvz - sv * dz);
+    }
+    
+    acceleration[0] = ax;
+    acceleration[1] = ay;
+    acceleration[2] = az;
+    jerk[0] = jx;
+    jerk[1] = jy;
+    jerk[2] = jz;
+}
+
+float HermiteIntegrator::step(std::vector<Star>& stars, float dt, const TimestepCriteria& criteria) {
+    const Star blackHole = stars[0];
+    mu = G * blackHole.mass;
+    for (int d = 0; d < 3; d++) origin[d] = blackHole.position[d];
+    
+    members.clear();
+    isMember.assign(stars.size(), 0);
+    for (size_t i = 0; i < stars.size(); i++) {
+        if (stars[i].isBlackHole || !region.contains(stars[i], blackHole)) continue;
+        members.push_back((uint32_t)i);
+        isMember[i] = 1;
+    }
+    
+    // Everyone else takes a leapfrog step, and sets the stable step alone.
+    // Being second order, it allows longer steps than kick-drift.
+    float stable = integrateCompositionExcept<Leapfrog>(stars, dt, criteria, &isMember[0]);
+    evaluations = 0;
+    deepest = 0;
+    if (members.empty()) return stable;
+    
+    // Members start together with their own first-step estimate
+    load(stars);
+    size_t n = members.size();
+    uint64_t total = 1ull << HERMITE_MAX_LEVELS;
+    double tickSeconds = dt / (double)total;
+    predict(0, tickSeconds);
+    #pragma omp parallel for
+    for (size_t k = 0; k < n; k++) {
+        double acc[3], jerk[3];
+        force(k, acc, jerk);
+        double a2 = 0.0, j2 = 0.0;
+        for (int d = 0; d < 3; d++) {
+            a[d][k] = acc[d];
+            j[d][k] = jerk[d];
+            a2 += acc[d] * acc[d];
+            j2 += jerk[d] * jerk[d];
+        }
+        desired[k] = j2 > 0.0 ? HERMITE_START_ACCURACY * std::sqrt(a2 / j2) : (double)criteria.maxStep;
+        stepTicks[k] = total >> levelFor(desired[k], dt);
+    }
+    evaluations = n;
+    
+    for (uint64_t now = 0; dt > 0.0f && now < total;) {
+        uint64_t next = total;
+        for (size_t k = 0; k < n; k++) next = std::min(next, time[k] + stepTicks[k]);
+        active.clear();
+        for (size_t k = 0; k < n; k++) {
+            if (time[k] + stepTicks[k] == next) active.push_back((uint32_t)k);
+        }
+        predict(next, tickSeconds);
+        
+        #pragma omp parallel for schedule(dynamic, 16)
+        for (size_t s = 0; s < active.size(); s++) {
+            size_t i = active[s];
+            double h = (double)stepTicks[i] * tickSeconds;
+            double acc[3], jerk[3];
+            force(i, acc, jerk);
+            
+            // Time-symmetric corrector, then the snap and crackle it
+            // implies, for the Aarseth criterion
+            double a1 = 0.0, j1 = 0.0, s1 = 0.0, c1 = 0.0;
+            for (int d = 0; d < 3; d++) {
+                double a0 = a[d][i], j0 = j[d][i];
+                double v1 = v[d][i] + h / 2 * (a0 + acc[d]) + h * h / 12 * (j0 - jerk[d]);
+                x[d][i] += h / 2 * (v[d][i] + v1) + h * h / 12 * (a0 - acc[d]);
+                v[d][i] = v1;
+                double snap = (-6.0 * (a0 - acc[d]) - h * (4.0 * j0 + 2.0 * jerk[d])) / (h * h);
+                double crackle = (12.0 * (a0 - acc[d]) + 6.0 * h * (j0 + jerk[d])) / (h * h * h);
+                snap += h * crackle;
+                a[d][i] = acc[d];
+                j[d][i] = jerk[d];
+                a1 += acc[d] * acc[d];
+                j1 += jerk[d] * jerk[d];
+                s1 += snap * snap;
+                c1 += crackle * crackle;
+            }
+            time[i] = next;
+            a1 = std::sqrt(a1);
+            j1 = std::sqrt(j1);
+            s1 = std::sqrt(s1);
+            c1 = std::sqrt(c1);
+            double step = std::sqrt(eta * (a1 * s1 + j1 * j1) / (j1 * c1 + s1 * s1));
+            if (std::isfinite(step) && step > 0.0) desired[i] = step;
+            
+            // Shrink freely; grow one level at a time, and only where the
+            // longer step stays on the block grid
+            uint64_t ticks = stepTicks[i];
+            while (ticks > 1 && ticks * tickSeconds > desired[i]) ticks >>= 1;
+            if (ticks == stepTicks[i] && 2 * ticks * tickSeconds <= desired[i] &&
+                next % (2 * ticks) == 0 && 2 * ticks <= total) {
+                ticks <<= 1;
+            }
+            stepTicks[i] = ticks;
+        }
+        evaluations += active.size();
+        for (uint32_t i : active) {
+            deepest = std::max(deepest, HERMITE_MAX_LEVELS - __builtin_ctzll(stepTicks[i]));
+        }
+        now = next;
+    }
+    
+    if (dt > 0.0f) {
+        #pragma omp parallel for
+        for (size_t k = 0; k < n; k++) {
+            Star& star = stars[members[k]];
+            star.position = glm::vec3((float)(origin[0] + x[0][k]), (float)(origin[1] + x[1][k]),
+                                      (float)(origin[2] + x[2][k]));
+            star.velocity = glm::vec3((float)v[0][k], (float)v[1][k], (float)v[2][k]);
+        }
+    }
+    
+    // The global step may be as long as the finest level allows for the
+    // most demanding member
+    double smallest = *std::min_element(desired.begin(), desired.end());
+    stable = std::min(stable, (float)std::min(smallest * (double)total, (double)criteria.maxStep));
+    return std::max(stable, criteria.minStep);
+}
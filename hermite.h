@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "galaxy_core.h"
+
+// Fourth-order Hermite integration for dense regions such as the nuclear
+// star cluster. Stars in the region move under the black hole and each
+// other, with acceleration and jerk summed directly, and each takes its own
+// power-of-two fraction of the global step (block steps) chosen by the
+// Aarseth criterion. Each block step predicts every member to the block
+// time before the active stars are corrected. Stars outside the region
+// take one leapfrog step, so the core does not hold back the global step.
+
+const int HERMITE_MAX_LEVELS = 20; // Finest block step is the global step / 2^20
+
+struct HermiteRegion {
+    float radius = 0.0f;   // Stars this close to the black hole, in light years
+    uint32_t species = 0;  // And stars of these species, as bits 1 << SPECIES_*
+    
+    bool contains(const Star& star, const Star& blackHole) const;
+};
+
+class HermiteIntegrator {
+public:
+    // accuracy is the Aarseth eta; softening smooths star-star encounters
+    explicit HermiteIntegrator(const HermiteRegion& region, double accuracy = 0.02, double softening = 1.0e-3);
+    
+    // Fits StepFunction; the stable step it returns leaves room for the
+    // region's finest block step
+    float step(std::vector<Star>& stars, float dt, const TimestepCriteria& criteria);
+    
+    // About the last step
+    size_t memberCount() const { return members.size(); }
+    uint64_t forceEvaluations() const { return evaluations; }
+    int deepestLevel() const { return deepest; }
+    
+private:
+    void load(const std::vector<Star>& stars);
+    void predict(uint64_t tick, double tickSeconds);
+    void force(size_t i, double acceleration[3], double jerk[3]) const;
+    static int levelFor(double desired, double dt);
+    
+    HermiteRegion region;
+    double eta;
+    double softening2;
+    double mu = 0.0;      // G times the black hole mass
+    double origin[3];     // The black hole, which stays put
+    
+    // Members, structure of arrays, relative to the black hole
+    std::vector<uint32_t> members;
+    std::vector<uint8_t> isMember;
+    std::vector<double> gm;
+    std::vector<double> x[3], v[3], a[3], j[3];
+    std::vector<double> xp[3], vp[3]; // Predicted to the current block time
+    std::vector<uint64_t> time;       // In ticks of dt / 2^HERMITE_MAX_LEVELS
+    std::vector<uint64_t> stepTicks;
+    std::vector<double> desired;      // Aarseth step as of the last correction
+    std::vector<uint32_t> active;
+    
+    uint64_t evaluations = 0;
+    int deepest = 0;
+};
@@ -0,0 +1,290 @@
+#include "ks_regularization.h"
+#include <algorithm>
+#include <cmath>
+#include "composition.h"
+
+enum : uint8_t { ROLE_KICK_DRIFT, ROLE_ENCOUNTER, ROLE_PAIR };
+
+// u, du/ds, the Kepler energy per unit reduced mass, and physical time
+struct KSState {
+    double u[4];
+    double w[4];
+    double h;
+    double t;
+};
+
+// x = L(u) u; the fourth component vanishes
+static glm::dvec3 ksPosition(const double u[4]) {
+    return glm::dvec3(u[0] * u[0] - u[1] * u[1] - u[2] * u[2] + u[3] * u[3],
+                      2.0 * (u[0] * u[1] - u[2] * u[3]),
+                      2.0 * (u[0] * u[2] + u[1] * u[3]));
+}
+
+// L(u)^T (p, 0)
+static void ksTranspose(const double u[4], const glm::dvec3& p, double out[4]) {
+    out[0] = u[0] * p.x + u[1] * p.y + u[2] * p.z;
+    out[1] = -u[1] * p.x + u[0] * p.y + u[3] * p.z;
+    out[2] = -u[2] * p.x - u[3] * p.y + u[0] * p.z;
+    out[3] = u[3] * p.x - u[2] * p.y + u[1] * p.z;
+}
+
+static KSState ksFromCartesian(const glm::dvec3& x, const glm::dvec3& v, double mu) {
+    KSState s;
+    double r = glm::length(x);
+    // Of the circle of u that map to x, the one with u[3] or u[2] zero,
+    // whichever keeps the square root away from zero
+    if (x.x >= 0.0) {
+        s.u[0] = std::sqrt(0.5 * (r + x.x));
+        s.u[1] = x.y / (2.0 * s.u[0]);
+        s.u[2] = x.z / (2.0 * s.u[0]);
+        s.u[3] = 0.0;
+    } else {
+        s.u[1] = std::sqrt(0.5 * (r - x.x));
+        s.u[0] = x.y / (2.0 * s.u[1]);
+        s.u[3] = x.z / (2.0 * s.u[1]);
+        s.u[2] = 0.0;
+    }
+    ksTranspose(s.u, 0.5 * v, s.w);
+    s.h = 0.5 * glm::dot(v, v) - mu / r;
+    s.t = 0.0;
+    return s;
+}
+
+static double ksRadius(const KSState& s) {
+    return s.u[0] * s.u[0] + s.u[1] * s.u[1] + s.u[2] * s.u[2] + s.u[3] * s.u[3];
+}
+
+// d/ds of the state: u'' = h/2 u + r/2 L^T P, h' = 2 u'.L^T P, t' = r
+static KSState ksDerivative(const KSState& s, const KSPerturbation& perturbation) {
+    KSState d;
+    double r = ksRadius(s);
+    double q[4] = {0.0, 0.0, 0.0, 0.0};
+    if (perturbation) ksTranspose(s.u, perturbation(ksPosition(s.u), s.t), q);
+    d.h = 0.0;
+    for (int k = 0; k < 4; k++) {
+        d.u[k] = s.w[k];
+        d.w[k] = 0.5 * s.h * s.u[k] + 0.5 * r * q[k];
+        d.h += 2.0 * s.w[k] * q[k];
+    }
+    d.t = r;
+    return d;
+}
+
+static KSState ksAdd(const KSState& s, const KSState& d, double ds) {
+    KSState out;
+    for (int k = 0; k < 4; k++) {
+        out.u[k] = s.u[k] + ds * d.u[k];
+        out.w[k] = s.w[k] + ds * d.w[k];
+    }
+    out.h = s.h + ds * d.h;
+    out.t = s.t + ds * d.t;
+    return out;
+}
+
+// Classical Runge-Kutta in fictitious time
+static KSState ksStep(const KSState& s, double ds, const KSPerturbation& perturbation) {
+    KSState k1 = ksDerivative(s, perturbation);
+    KSState k2 = ksDerivative(ksAdd(s, k1, ds / 2), perturbation);
+    KSState k3 = ksDerivative(ksAdd(s, k2, ds / 2), perturbation);
+    KSState k4 = ksDerivative(ksAdd(s, k3, ds), perturbation);
+    KSState out = s;
+    for (int k = 0; k < 4; k++) {
+        out.u[k] += ds / 6 * (k1.u[k] + 2.0 * k2.u[k] + 2.0 * k3.u[k] + k4.u[k]);
+        out.w[k] += ds / 6 * (k1.w[k] + 2.0 * k2.w[k] + 2.0 * k3.w[k] + k4.w[k]);
+    }
+    out.h += ds / 6 * (k1.h + 2.0 * k2.h + 2.0 * k3.h + k4.h);
+    out.t += ds / 6 * (k1.t + 2.0 * k2.t + 2.0 * k3.t + k4.t);
+    return out;
+}
+
+// Cells far apart may share a key; candidates are checked by distance.
+// Cells along z have consecutive keys, except where the coordinate wraps.
+static uint64_t cellKey(const glm::ivec3& c) {
+    const int bias = 1 << 20;
+    return ((uint64_t)((c.x + bias) & 0x1FFFFF) << 42) | ((uint64_t)((c.y + bias) & 0x1FFFFF) << 21) |
+           (uint64_t)((c.z + bias) & 0x1FFFFF);
+}
+
+int ksAdvance(glm::dvec3& position, glm::dvec3& velocity, double mu, double dt, int substepsPerOrbit,
+              const KSPerturbation& perturbation) {
+    KSState s = ksFromCartesian(position, velocity, mu);
+    
+    // u oscillates at sqrt(-h/2), and an orbit is half an oscillation.
+    // Unbound, the same role is played by the speed.
+    double omega = s.h < 0.0 ? std::sqrt(-0.5 * s.h) : std::max(std::sqrt(0.5 * s.h), 0.5 * glm::length(velocity));
+    double ds = M_PI / (omega * substepsPerOrbit);
+    
+    int taken = 0;
+    while (dt > 0.0) {
+        KSState next = ksStep(s, ds, perturbation);
+        taken++;
+        if (taken % KS_MAX_SUBSTEPS == 0) ds *= 2.0;
+        if (next.t < dt) {
+            s = next;
+            continue;
+        }
+        
+        // Overshot: land on dt by Newton's method, with dt/ds = r
+        double last = (dt - s.t) / ksRadius(s);
+        for (int iteration = 0; iteration < 4; iteration++) {
+            next = ksStep(s, last, perturbation);
+            taken++;
+            double error = dt - next.t;
+            if (std::abs(error) <= 1e-12 * dt) break;
+            last += error / ksRadius(next);
+        }
+        s = next;
+        break;
+    }
+    
+    double r = ksRadius(s);
+    position = ksPosition(s.u);
+    // v = 2 L(u) u' / r
+    velocity = glm::dvec3(s.u[0] * s.w[0] - s.u[1] * s.w[1] - s.u[2] * s.w[2] + s.u[3] * s.w[3],
+                          s.u[1] * s.w[0] + s.u[0] * s.w[1] - s.u[3] * s.w[2] - s.u[2] * s.w[3],
+                          s.u[2] * s.w[0] + s.u[3] * s.w[1] + s.u[0] * s.w[2] + s.u[1] * s.w[3]) * (2.0 / r);
+    return taken;
+}
+
+static glm::ivec3 cellOf(const glm::vec3& position, float size) {
+    return glm::ivec3(glm::floor(position / size));
+}
+
+KSIntegrator::KSIntegrator(const KSOptions& options) : options(options) {}
+
+void KSIntegrator::findPairs(const std::vector<Star>& stars) {
+    float size = options.pairRadius;
+    cells.clear();
+    for (size_t i = 0; i < stars.size(); i++) {
+        if (role[i] == ROLE_KICK_DRIFT && !stars[i].isBlackHole)
+            cells.push_back({cellKey(cellOf(stars[i].position, size)), (uint32_t)i});
+    }
+    std::sort(cells.begin(), cells.end());
+    
+    // Each star's nearest neighbour that it is bound to, from the 27 cells
+    // around its own
+    partner.resize(stars.size());
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for (size_t c = 0; c < cells.size(); c++) {
+        uint32_t i = cells[c].second;
+        const Star& star = stars[i];
+        glm::ivec3 home = cellOf(star.position, size);
+        float best = size * size;
+        partner[i] = i;
+        auto scan = [&](uint64_t first, uint64_t last) {
+            auto it = std::lower_bound(cells.begin(), cells.end(), std::make_pair(first, (uint32_t)0));
+            for (; it != cells.end() && it->first <= last; ++it) {
+                uint32_t j = it->second;
+                glm::vec3 d = stars[j].position - star.position;
+                float distance2 = glm::dot(d, d);
+                if (j == i || distance2 >= best) continue;
+                glm::vec3 dv = stars[j].velocity - star.velocity;
+                double energy = 0.5 * glm::dot(dv, dv) - G * (star.mass + stars[j].mass) / std::sqrt(distance2);
+                if (energy < 0.0) {
+                    best = distance2;
+                    partner[i] = j;
+                }
+            }
+        };
+        for (int dx = -1; dx <= 1; dx++) {
+            for (int dy = -1; dy <= 1; dy++) {
+                uint64_t low = cellKey(home + glm::ivec3(dx, dy, -1));
+                uint64_t high = cellKey(home + glm::ivec3(dx, dy, 1));
+                if (low < high) {
+                    scan(low, high);
+                } else {
+                    for (int dz = -1; dz <= 1; dz++) {
+                        uint64_t key = cellKey(home + glm::ivec3(dx, dy, dz));
+                        scan(key, key);
+                    }
+                }
+            }
+        }
+    }
+    
+    // Mutual nearest neighbours pair up, so no star is in two pairs
+    pairs.clear();
+    for (size_t c = 0; c < cells.size(); c++) {
+        uint32_t i = cells[c].second;
+        uint32_t j = partner[i];
+        if (i < j && partner[j] == i) {
+            pairs.push_back({i, j});
+            role[i] = ROLE_PAIR;
+            role[j] = ROLE_PAIR;
+        }
+    }
+}
+
+float KSIntegrator::step(std::vector<Star>& stars, float dt, const TimestepCriteria& criteria) {
+    const Star blackHole = stars[0];
+    const double mu = G * blackHole.mass;
+    const glm::dvec3 origin(blackHole.position);
+    
+    // Stars that need a shorter step than this one, or than the shortest
+    // global step allowed, go round the black hole in KS variables
+    float threshold = std::max(dt, options.minGlobalStep);
+    role.assign(stars.size(), ROLE_KICK_DRIFT);
+    #pragma omp parallel for
+    for (size_t i = 0; i < stars.size(); i++) {
+        if (!stars[i].isBlackHole && starTimestep(stars[i], blackHole, criteria) * criteria.accuracy < threshold)
+            role[i] = ROLE_ENCOUNTER;
+    }
+    encounters.clear();
+    for (size_t i = 0; i < stars.size(); i++) {
+        if (role[i] == ROLE_ENCOUNTER) encounters.push_back((uint32_t)i);
+    }
+    pairs.clear();
+    if (options.pairRadius > 0.0f && dt > 0.0f) findPairs(stars);
+    
+    // Everyone else, with the stable step from them alone. Only
+    // ROLE_KICK_DRIFT is zero, so role skips the rest.
+    float stable = integrateCompositionExcept<KickDrift>(stars, dt, criteria, &role[0]);
+    
+    uint64_t taken = 0;
+    #pragma omp parallel for schedule(dynamic, 16) reduction(+:taken)
+    for (size_t k = 0; k < encounters.size(); k++) {
+        Star& star = stars[encounters[k]];
+        glm::dvec3 x = glm::dvec3(star.position) - origin;
+        glm::dvec3 v(star.velocity);
+        taken += ksAdvance(x, v, mu, dt, options.substepsPerOrbit);
+        star.position = glm::vec3(origin + x);
+        star.velocity = glm::vec3(v);
+    }
+    
+    // A pair's centre of mass takes the global step like any star. Its
+    // relative motion is regularized under the black hole's tide, with the
+    // centre of mass moving evenly through the step.
+    float limit = criteria.maxStep / criteria.accuracy;
+    #pragma omp parallel for schedule(dynamic, 16) reduction(+:taken) reduction(min:limit)
+    for (size_t k = 0; k < pairs.size(); k++) {
+        Star& a = stars[pairs[k].first];
+        Star& b = stars[pairs[k].second];
+        double total = (double)a.mass + b.mass;
+        double fa = a.mass / total, fb = b.mass / total;
+        Star centre = a;
+        centre.mass = (float)total;
+        centre.position = glm::vec3(fa * glm::dvec3(a.position) + fb * glm::dvec3(b.position));
+        centre.velocity = glm::vec3(fa * glm::dvec3(a.velocity) + fb * glm::dvec3(b.velocity));
+        glm::dvec3 start = glm::dvec3(centre.position) - origin;
+        advanceStar(centre, blackHole, dt);
+        limit = std::min(limit, starTimestep(centre, blackHole, criteria));
+        glm::dvec3 end = glm::dvec3(centre.position) - origin;
+        
+        KSPerturbation tide = [&](const glm::dvec3& x, double t) {
+            glm::dvec3 c = start + (end - start) * (t / dt);
+            glm::dvec3 pa = c - fb * x, pb = c + fa * x;
+            return -mu * pb / std::pow(glm::dot(pb, pb), 1.5) + mu * pa / std::pow(glm::dot(pa, pa), 1.5);
+        };
+        glm::dvec3 x = glm::dvec3(b.position) - glm::dvec3(a.position);
+        glm::dvec3 v = glm::dvec3(b.velocity) - glm::dvec3(a.velocity);
+        taken += ksAdvance(x, v, G * total, dt, options.substepsPerOrbit, tide);
+        a.position = glm::vec3(origin + end - fb * x);
+        b.position = glm::vec3(origin + end + fa * x);
+        a.velocity = glm::vec3(glm::dvec3(centre.velocity) - fb * v);
+        b.velocity = glm::vec3(glm::dvec3(centre.velocity) + fa * v);
+    }
+    substeps = taken;
+    
+    stable = std::min(stable, limit * criteria.accuracy);
+    return std::max(stable, std::max(options.minGlobalStep, criteria.minStep));
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+#include "galaxy_core.h"
+
+// Kustaanheimo-Stiefel regularization of close pairs. Near a point mass
+// the 1/r^2 pull makes any fixed step too long at pericentre. In KS
+// variables the relative position is the square of a 4-vector u, time runs
+// as dt = r ds, and the unperturbed motion of u is a harmonic oscillator,
+// so a close pass is as smooth as any other part of the orbit. Stars that
+// the global step cannot resolve near the black hole, and close bound
+// pairs of stars, are integrated this way with their own substeps, and the
+// global step only has to resolve everything else.
+
+const int KS_MAX_SUBSTEPS = 1 << 16; // Per pair and step; beyond this the substeps double
+
+// Acceleration on the relative motion from everything other than the
+// pair itself, at relative position x and time t into the step
+using KSPerturbation = std::function<glm::dvec3(const glm::dvec3& x, double t)>;
+
+// Moves a body relative to a mass with gravitational parameter mu for dt,
+// in KS variables, with substepsPerOrbit fictitious-time steps of fourth
+// order per orbit. position is relative to the mass. Returns the substeps
+// taken.
+int ksAdvance(glm::dvec3& position, glm::dvec3& velocity, double mu, double dt, int substepsPerOrbit,
+              const KSPerturbation& perturbation = KSPerturbation());
+
+struct KSOptions {
+    float minGlobalStep = 0.01f;  // Years; stars needing a shorter step are regularized about the black hole
+    float pairRadius = 0.0f;      // Light years; bound star pairs this close move as one, 0 for none
+    int substepsPerOrbit = 32;
+};
+
+class KSIntegrator {
+public:
+    explicit KSIntegrator(const KSOptions& options = KSOptions());
+    
+    // Fits StepFunction. Close encounters and pairs take no part in the
+    // stable step it returns, beyond a pair's centre of mass, and it never
+    // returns less than minGlobalStep.
+    float step(std::vector<Star>& stars, float dt, const TimestepCriteria& criteria);
+    
+    // About the last step
+    size_t encounterCount() const { return encounters.size(); }
+    size_t pairCount() const { return pairs.size(); }
+    uint64_t substepCount() const { return substeps; }
+    
+private:
+    void findPairs(const std::vector<Star>& stars);
+    
+    KSOptions options;
+    std::vector<uint8_t> role;       // Per star: kick-drift, encounter or pair member
+    std::vector<uint32_t> encounters;
+    std::vector<uint32_t> partner;   // Nearest bound neighbour, or itself
+    std::vector<std::pair<uint64_t, uint32_t>> cells; // (cell key, star), sorted
+    std::vector<std::pair<uint32_t, uint32_t>> pairs;
+    uint64_t substeps = 0;
+};
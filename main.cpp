@@ -3,34 +3,90 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include "shader.h"
+#include "gl_state.h"
+#include "hdr_pipeline.h"
+#include "camera_uniforms.h"
+#include "star.h"
+#include "star_vertex.h"
+#include "star_chunks.h"
+#include "poster_renderer.h"
+#include "frame_capture.h"
+#include "video_encoder.h"
+#include "snapshot.h"
+#include "trajectory.h"
+#include "arrow_export.h"
+#include "state_publisher.h"
+#include "stream_server.h"
+#include "replay_player.h"
+#include "gadget_io.h"
+#include "galaxy_core.h"
+#include "ensemble.h"
+#include "out_of_core.h"
+#include "wisdom_holman.h"
+#include "hermite.h"
+#include "composition.h"
+#include "parareal.h"
+#include "ks_regularization.h"
 #include <vector>
-#include <random>
 #include <ctime>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <omp.h>
 
 // Constants
 const int WINDOW_WIDTH = 1366;
 const int WINDOW_HEIGHT = 768;
 const float GALAXY_SIZE = 100000.0f; // Light years
 const int NUM_STARS = 1000000;
-const double G = 6.67430e-11; // Gravitational constant
 const float SIMULATION_SPEED = 1.0f; // Years per second
 const float BLACK_HOLE_MASS = 4.154e6; // Solar masses (Sagittarius A*)
+const float FAR_PLANE = GALAXY_SIZE * 2.0f;
+const PositionFormat POSITION_FORMAT = PositionFormat::Unorm16;
+const size_t FOLLOW_STAR = 1; // Star tracked by the follow-cam
+const float CHUNK_RESORT_GROWTH = 2.0f; // Re-sort once chunk boxes have grown this much since the last sort
+const int POSTER_WIDTH = 16384;
+const int POSTER_HEIGHT = 9216;
+const char* POSTER_PATH = "galaxy_poster.png";
+const int RECORD_FPS = 60;
+const int REPLAY_IO_THREADS = 2;
+const size_t REPLAY_LOOKAHEAD = 4; // Decoded frames held ahead of the playhead
+const float HERMITE_RADIUS = 1000.0f; // Light years around the black hole integrated with Hermite
+const int MAX_STEPS_PER_FRAME = 8; // Beyond this the display slows down instead
+const long HEADLESS_STEPS = 1000;
+const float HEADLESS_DT = 1.0f / 60.0f * SIMULATION_SPEED; // One displayed frame's worth
+const long PARAREAL_STARS = 10000; // Small runs are what Parareal is for
+const uint32_t PARAREAL_COARSE_STEPS = 4; // Leapfrog steps per time slice
+const float PARAREAL_TOLERANCE = 1e-3f; // Light years
 
 // Vertex shader
 const char* vertexShaderSource = R"(
     #version 330 core
-    layout (location = 0) in vec3 aPos;
-    layout (location = 1) in float aSize;
+)" CAMERA_UNIFORM_BLOCK R"(
+    layout (location = 0) in vec3 aPos;   // Normalized within the stream box
+    layout (location = 1) in float aSize; // Fraction of sizeScale
     layout (location = 2) in vec3 aColor;
     
-    uniform mat4 projection;
-    uniform mat4 view;
+    uniform vec3 positionOrigin;
+    uniform vec3 positionScale;
+    uniform float sizeScale;
     
     out vec3 Color;
     
     void main() {
-        gl_Position = projection * view * vec4(aPos, 1.0);
-        gl_PointSize = aSize / gl_Position.w;
+        vec3 worldPos = positionOrigin + aPos * positionScale;
+        gl_Position = viewProjection * vec4(worldPos, 1.0);
+        gl_PointSize = aSize * sizeScale / gl_Position.w;
         Color = aColor;
     }
 )";
@@ -43,24 +99,68 @@ const char* fragmentShaderSource = R"(
     
     void main() {
         vec2 circCoord = 2.0 * gl_PointCoord - 1.0;
-        float circle = 1.0 - step(1.0, dot(circCoord, circCoord));
-        FragColor = vec4(Color, circle);
+        float r2 = dot(circCoord, circCoord);
+        if (r2 > 1.0) discard;
+        
+        // Radiance added into the HDR target; alpha is unused
+        FragColor = vec4(Color * exp(-4.0 * r2), 1.0);
     }
 )";
 
-struct Star {
+// Arrangement of simultaneous views, all drawn from the same uploaded stream
+enum class ViewLayout {
+    Single,      // Free camera only
+    SplitScreen, // Free camera beside a follow-cam
+    CubeMap      // Six 90 degree faces around the free camera, 3x2 grid
+};
+
+struct View {
+    int x, y, width, height; // Viewport in framebuffer pixels
+    glm::mat4 projection;
+    glm::mat4 view;
     glm::vec3 position;
-    glm::vec3 velocity;
-    float mass;
-    float size;
-    bool isBlackHole;
+    
+    // Visible star ranges from per-view chunk culling
+    std::vector<GLint> firsts;
+    std::vector<GLsizei> counts;
 };
 
 class GalaxySimulation {
 private:
     std::vector<Star> stars;
-    GLuint VAO, VBO;
-    GLuint shaderProgram;
+    std::vector<unsigned char> positionStream; // Per-frame upload staging
+    PositionBox positionBox;
+    std::vector<StarChunk> chunks;
+    float sortedChunkExtent = 0.0f; // Just after the last spatial sort
+    GLuint VAO, VBO, attributeVBO;
+    ShaderProgram shaderProgram;
+    HDRPipeline hdr;
+    CameraUniforms camera;
+    int viewportWidth = WINDOW_WIDTH;
+    int viewportHeight = WINDOW_HEIGHT;
+    ViewLayout viewLayout = ViewLayout::Single;
+    std::vector<View> views;
+    bool posterRequested = false;
+    bool posterKeyDown = false;
+    
+    // Stored trajectory played instead of integrating, if any
+    ReplayPlayer* replay;
+    bool pauseKeyDown = false;
+    bool reverseKeyDown = false;
+    bool slowerKeyDown = false;
+    bool fasterKeyDown = false;
+    
+    // Simulation clock and periodic snapshots
+    uint64_t stepCount = 0;
+    double simulationTime = 0.0;
+    TimestepController timestep;
+    double stepSeconds = 0.0; // Wall time spent integrating
+    std::unique_ptr<SnapshotWriter> snapshots;
+    std::unique_ptr<TrajectoryWriter> trajectory; // Destination of snapshots, if any
+    std::unique_ptr<ArrowWriter> arrow; // Or this
+    uint64_t snapshotInterval = 0;
+    StatePublisher publisher; // Shared-memory copy of every frame, if open
+    StreamServer streamServer; // Frames for remote viewers, if open
     
     // Camera parameters
     glm::vec3 cameraPos;
@@ -73,76 +173,114 @@ private:
     float pitch = 0.0f;
     
     void initializeShaders() {
-        // Vertex shader compilation
-        GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
-        glCompileShader(vertexShader);
-        
-        // Fragment shader compilation
-        GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-        glCompileShader(fragmentShader);
-        
-        // Shader program
-        shaderProgram = glCreateProgram();
-        glAttachShader(shaderProgram, vertexShader);
-        glAttachShader(shaderProgram, fragmentShader);
-        glLinkProgram(shaderProgram);
-        
-        glDeleteShader(vertexShader);
-        glDeleteShader(fragmentShader);
+        shaderProgram = ShaderProgram(vertexShaderSource, fragmentShaderSource);
+        shaderProgram.use();
+        glUniform1f(shaderProgram.uniform("sizeScale"), MAX_STAR_SIZE);
+        camera.attach(shaderProgram);
     }
     
-    void generateStars() {
-        std::random_device rd;
-        std::mt19937 gen(rd());
-        std::normal_distribution<float> massDist(1.0f, 0.5f); // Solar masses
-        std::uniform_real_distribution<float> posDist(-GALAXY_SIZE/2, GALAXY_SIZE/2);
-        std::uniform_real_distribution<float> velDist(-100.0f, 100.0f); // km/s
-        
-        // Create central black hole
-        Star blackHole;
-        blackHole.position = glm::vec3(0.0f);
-        blackHole.velocity = glm::vec3(0.0f);
-        blackHole.mass = BLACK_HOLE_MASS;
-        blackHole.size = 20.0f; // Larger visible size for visualization
-        blackHole.isBlackHole = true;
-        stars.push_back(blackHole);
-        
-        // Generate random stars
-        for (int i = 0; i < NUM_STARS; i++) {
-            Star star;
-            star.position = glm::vec3(posDist(gen), posDist(gen), posDist(gen));
-            star.velocity = glm::vec3(velDist(gen), velDist(gen), velDist(gen));
-            star.mass = std::max(0.1f, massDist(gen));
-            star.size = 2.0f + star.mass * 0.5f; // Visual size based on mass
-            star.isBlackHole = false;
-            stars.push_back(star);
+    // Simulated time not yet paid off in steps. Stars are drawn that far
+    // along their velocities, so they move every frame, not once per step.
+    float drawAhead() const {
+        return replay ? 0.0f : (float)timestep.owed();
+    }
+    
+    void encodePositionStream() {
+        // Stars beyond twice the far plane are clamped to the box faces,
+        // which keeps them outside the view frustum
+        float ahead = drawAhead();
+        positionBox = computePositionBox(stars, POSITION_FORMAT, cameraPos, 2.0f * FAR_PLANE, ahead);
+        encodePositions(stars, POSITION_FORMAT, positionBox, &positionStream[0], ahead);
+        computeChunkBounds(stars, chunks, ahead);
+    }
+    
+    View makeView(int x, int y, int width, int height, float fovDegrees,
+                  const glm::vec3& eye, const glm::vec3& front, const glm::vec3& up) const {
+        View v;
+        v.x = x;
+        v.y = y;
+        v.width = width;
+        v.height = height;
+        v.projection = glm::perspective(glm::radians(fovDegrees),
+            (float)width / (float)height, 0.1f, FAR_PLANE);
+        v.view = glm::lookAt(eye, eye + front, up);
+        v.position = eye;
+        return v;
+    }
+    
+    void layoutViews() {
+        views.clear();
+        int w = viewportWidth, h = viewportHeight;
+        switch (viewLayout) {
+            case ViewLayout::Single:
+                views.push_back(makeView(0, 0, w, h, 45.0f, cameraPos, cameraFront, cameraUp));
+                break;
+            case ViewLayout::SplitScreen: {
+                views.push_back(makeView(0, 0, w / 2, h, 45.0f, cameraPos, cameraFront, cameraUp));
+                
+                // Trail the tracked star at a fixed offset, looking at it
+                const Star& followed = stars[FOLLOW_STAR];
+                glm::vec3 target = followed.position + followed.velocity * drawAhead();
+                glm::vec3 eye = target + glm::vec3(0.0f, 0.01f, 0.02f) * GALAXY_SIZE;
+                views.push_back(makeView(w / 2, 0, w - w / 2, h, 45.0f,
+                    eye, glm::normalize(target - eye), cameraUp));
+                break;
+            }
+            case ViewLayout::CubeMap: {
+                // Faces in GL_TEXTURE_CUBE_MAP_POSITIVE_X.. order and orientation
+                static const glm::vec3 fronts[6] = {
+                    glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0),
+                    glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1)
+                };
+                static const glm::vec3 ups[6] = {
+                    glm::vec3(0, -1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1),
+                    glm::vec3(0, 0, -1), glm::vec3(0, -1, 0), glm::vec3(0, -1, 0)
+                };
+                int face = std::min(w / 3, h / 2);
+                for (int i = 0; i < 6; i++) {
+                    views.push_back(makeView((i % 3) * face, (1 - i / 3) * face, face, face,
+                        90.0f, cameraPos, fronts[i], ups[i]));
+                }
+                break;
+            }
         }
     }
     
-    void updateStarPositions(float deltaTime) {
-        #pragma omp parallel for
-        for (size_t i = 0; i < stars.size(); i++) {
-            if (stars[i].isBlackHole) continue;
-            
-            glm::vec3 totalForce(0.0f);
-            
-            // Calculate gravitational force from black hole (index 0)
-            glm::vec3 r = stars[0].position - stars[i].position;
-            float distance = glm::length(r);
-            float forceMagnitude = G * stars[0].mass * stars[i].mass / (distance * distance);
-            totalForce += forceMagnitude * glm::normalize(r);
-            
-            // Update velocity and position
-            stars[i].velocity += totalForce / stars[i].mass * deltaTime;
-            stars[i].position += stars[i].velocity * deltaTime;
+    // Rebuilds view matrices when the camera moved, or every frame while a
+    // follow-cam tracks a moving star
+    void updateViews() {
+        if (!camera.isDirty() && viewLayout != ViewLayout::SplitScreen) return;
+        layoutViews();
+        for (size_t i = 0; i < views.size(); i++) {
+            const View& v = views[i];
+            camera.update((GLuint)i, v.projection, v.view, v.position, v.width, v.height);
         }
+        camera.markClean();
+    }
+    
+    void setViewLayout(ViewLayout layout) {
+        if (layout == viewLayout) return;
+        viewLayout = layout;
+        camera.markDirty();
     }
     
 public:
-    GalaxySimulation() {
-        generateStars();
+    // Replays a trajectory, starts from loaded initial conditions, or
+    // generates a galaxy when both are NULL
+    GalaxySimulation(ReplayPlayer* replay, std::vector<Star>* initialStars)
+        : hdr(WINDOW_WIDTH, WINDOW_HEIGHT), replay(replay) {
+        if (replay) {
+            stars = replay->firstFrame(); // Already spatially sorted when recorded
+        } else if (initialStars) {
+            stars.swap(*initialStars);
+            adoptStars(stars, BLACK_HOLE_MASS);
+        } else {
+            GalaxyParameters parameters;
+            parameters.starCount = NUM_STARS;
+            parameters.size = GALAXY_SIZE;
+            parameters.blackHoleMass = BLACK_HOLE_MASS;
+            generateGalaxy(parameters, stars);
+        }
         initializeShaders();
         
         // Initialize camera
@@ -153,51 +291,260 @@ public:
         // Initialize OpenGL buffers
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
-        glBindVertexArray(VAO);
+        glGenBuffers(1, &attributeVBO);
+        glstate::bindVertexArray(VAO);
         
-        // Buffer layout setup
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, stars.size() * sizeof(Star), &stars[0], GL_DYNAMIC_DRAW);
+        // Position stream, re-uploaded every frame
+        positionStream.resize(stars.size() * positionStride(POSITION_FORMAT));
+        encodePositionStream();
+        sortedChunkExtent = meanChunkExtent(chunks);
+        glstate::bindArrayBuffer(VBO);
+        glBufferData(GL_ARRAY_BUFFER, positionStream.size(), &positionStream[0], GL_DYNAMIC_DRAW);
+        setupPositionAttribute(0, POSITION_FORMAT);
         
-        // Position attribute
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Star), (void*)0);
-        glEnableVertexAttribArray(0);
+        // Static size and colour packed into 4 bytes, uploaded once per sort
+        glstate::bindArrayBuffer(attributeVBO);
+        uploadStarAttributes();
+        setupStarAttributes(1, 2);
+    }
+    
+    // attributeVBO must be bound
+    void uploadStarAttributes() {
+        std::vector<StarAttributes> attributes = buildStarAttributes(stars);
+        glBufferData(GL_ARRAY_BUFFER, attributes.size() * sizeof(StarAttributes), &attributes[0], GL_STATIC_DRAW);
+    }
+    
+    // Stars drift out of Morton order and the chunk boxes grow with them, so
+    // once culling has got markedly worse the stars are sorted again. The
+    // followed star keeps its index. Not while anything outside the viewer
+    // tells stars apart by index: snapshots, trajectories and Arrow files
+    // hold a star in the same row at every step, and shared-memory readers
+    // and stream clients keep per-index state between frames.
+    void resortIfScattered() {
+        if (snapshots || publisher.isOpen() || streamServer.isOpen()) return;
+        if (meanChunkExtent(chunks) <= CHUNK_RESORT_GROWTH * sortedChunkExtent) return;
+        sortStarsSpatially(stars, FOLLOW_STAR + 1);
+        encodePositionStream();
+        sortedChunkExtent = meanChunkExtent(chunks);
+        glstate::bindArrayBuffer(attributeVBO);
+        uploadStarAttributes();
+    }
+    
+    void resize(int width, int height) {
+        if (width <= 0 || height <= 0) return; // Minimized
+        if (width == viewportWidth && height == viewportHeight) return;
+        viewportWidth = width;
+        viewportHeight = height;
+        hdr.resize(width, height);
+        camera.markDirty();
+    }
+    
+    // Draws the stars visible in one view's frustum into the current target
+    void drawStars(const glm::mat4& viewProjection, GLuint cameraSlot,
+                   std::vector<GLint>& firsts, std::vector<GLsizei>& counts) {
+        cullChunks(chunks, stars.size(), Frustum::fromMatrix(viewProjection), firsts, counts);
+        if (firsts.empty()) return;
         
-        // Size attribute
-        glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(Star), (void*)offsetof(Star, size));
-        glEnableVertexAttribArray(1);
+        shaderProgram.use();
+        glstate::bindVertexArray(VAO);
+        camera.bindSlot(cameraSlot);
+        glMultiDrawArrays(GL_POINTS, firsts.data(), counts.data(), (GLsizei)firsts.size());
     }
     
-    void render() {
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glUseProgram(shaderProgram);
+    void renderPoster() {
+        // Keep stars the same apparent size as on screen
+        float pointScale = (float)POSTER_HEIGHT / (float)viewportHeight;
         
-        // Update view/projection matrices
-        glm::mat4 projection = glm::perspective(glm::radians(45.0f), 
-            (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, GALAXY_SIZE * 2.0f);
+        PosterSettings settings;
+        settings.width = POSTER_WIDTH;
+        settings.height = POSTER_HEIGHT;
+        settings.path = POSTER_PATH;
+        settings.fovDegrees = 45.0f;
+        settings.nearPlane = 0.1f;
+        settings.farPlane = FAR_PLANE;
+        // Largest sprite radius plus the reach of the half-resolution bloom blur
+        settings.guardBand = (int)std::ceil(MAX_STAR_SIZE * pointScale * 0.5f) + 32;
+        
+        shaderProgram.use();
+        glUniform1f(shaderProgram.uniform("sizeScale"), MAX_STAR_SIZE * pointScale);
+        
+        std::vector<GLint> firsts;
+        std::vector<GLsizei> counts;
         glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
+        ::renderPoster(settings, view,
+            [&](const glm::mat4& projection, const glm::mat4& tileView, int width, int height) {
+                camera.update(0, projection, tileView, cameraPos, width, height);
+                glstate::viewport(0, 0, width, height);
+                drawStars(projection * tileView, 0, firsts, counts);
+            });
         
+        shaderProgram.use();
+        glUniform1f(shaderProgram.uniform("sizeScale"), MAX_STAR_SIZE);
+        camera.markDirty();
+    }
+    
+    void render() {
         // Set uniforms
-        GLuint projLoc = glGetUniformLocation(shaderProgram, "projection");
-        GLuint viewLoc = glGetUniformLocation(shaderProgram, "view");
-        glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+        shaderProgram.use();
+        glUniform3fv(shaderProgram.uniform("positionOrigin"), 1, glm::value_ptr(positionBox.origin));
+        glUniform3fv(shaderProgram.uniform("positionScale"), 1, glm::value_ptr(positionBox.scale));
+        
+        if (posterRequested) {
+            posterRequested = false;
+            renderPoster();
+        }
         
-        // Draw stars
-        glBindVertexArray(VAO);
-        glDrawArrays(GL_POINTS, 0, stars.size());
+        updateViews();
+        hdr.beginScene();
+        
+        // Draw every view from the same stream, skipping chunks it can't see
+        for (size_t i = 0; i < views.size(); i++) {
+            View& v = views[i];
+            glstate::viewport(v.x, v.y, v.width, v.height);
+            drawStars(v.projection * v.view, (GLuint)i, v.firsts, v.counts);
+        }
+        
+        hdr.endScene();
+    }
+    
+    void enableSnapshots(const std::string& directory, uint64_t interval, const SnapshotOptions& options) {
+        snapshots.reset(new SnapshotWriter(directory, options));
+        snapshotInterval = interval;
+    }
+    
+    // Appends every snapshot to one seekable trajectory file instead
+    bool enableTrajectory(const std::string& path, uint64_t interval) {
+        trajectory.reset(new TrajectoryWriter());
+        if (!trajectory->open(path)) {
+            trajectory.reset();
+            return false;
+        }
+        TrajectoryWriter* target = trajectory.get();
+        snapshots.reset(new SnapshotWriter([target](const std::vector<Star>& frame, uint64_t step, double time) {
+            return target->append(frame, step, time);
+        }));
+        snapshotInterval = interval;
+        return true;
+    }
+    
+    // Appends every snapshot to one Arrow IPC file for analysis
+    bool enableArrowExport(const std::string& path, uint64_t interval) {
+        arrow.reset(new ArrowWriter());
+        if (!arrow->open(path)) {
+            arrow.reset();
+            return false;
+        }
+        ArrowWriter* target = arrow.get();
+        snapshots.reset(new SnapshotWriter([target](const std::vector<Star>& frame, uint64_t step, double time) {
+            return target->append(frame, step, time);
+        }));
+        snapshotInterval = interval;
+        return true;
+    }
+    
+    // Replaces the integration scheme; the stable step is measured afresh
+    void setIntegrator(StepFunction integrate) {
+        timestep = TimestepController(TimestepCriteria(), std::move(integrate));
+    }
+    
+    bool saveStars(const std::string& path) const {
+        return writeGadget(path, stars, simulationTime);
+    }
+    
+    // Publishes every frame to a shared-memory segment for other processes
+    bool enablePublishing(const std::string& name) {
+        if (!publisher.open(name, stars.size())) return false;
+        publisher.publish(stars, stepCount, simulationTime);
+        return true;
+    }
+    
+    void finishPublishing() {
+        if (!publisher.isOpen()) return;
+        std::cout << "Published " << publisher.framesPublished() << " frames at "
+                  << 1000.0 * publisher.publishSeconds() / std::max<uint64_t>(publisher.framesPublished(), 1)
+                  << " ms each" << std::endl;
+        publisher.close();
+    }
+    
+    // Serves every frame to remote viewers connecting over TCP
+    bool enableStreaming(const std::string& address, uint16_t port) {
+        if (!streamServer.open(address, port)) return false;
+        std::cout << "Streaming to viewers on " << address << ":" << port << std::endl;
+        return true;
+    }
+    
+    void finishStreaming() {
+        if (!streamServer.isOpen()) return;
+        std::cout << "Streamed " << streamServer.framesSent() << " frames ("
+                  << streamServer.bytesSent() / (1024.0 * 1024.0) << " MB) to remote viewers" << std::endl;
+        streamServer.close();
+    }
+    
+    void finishSnapshots() {
+        if (!snapshots) return;
+        snapshots->flush();
+        std::cout << "Wrote " << snapshots->snapshotsWritten() << " snapshots; submitting them cost "
+                  << 100.0 * snapshots->submitSeconds() / std::max(stepSeconds, 1e-9)
+                  << "% of integration time" << std::endl;
+        snapshots.reset();
+        if (trajectory) trajectory->close();
+        trajectory.reset();
+        if (arrow) arrow->close();
+        arrow.reset();
     }
     
     void update(float deltaTime) {
-        updateStarPositions(deltaTime * SIMULATION_SPEED);
+        bool advanced;
+        if (replay) {
+            // Re-encode only for a new frame, or when the camera moved the stream box
+            advanced = replay->update(deltaTime * SIMULATION_SPEED, stars);
+            if (!advanced && !camera.isDirty()) return;
+            simulationTime = replay->time();
+        } else {
+            // The frame decides how much time to show, the controller how
+            // to step through it. Frames with no whole step owed still
+            // re-encode, since the stars are drawn ahead by the time owed.
+            timestep.accumulate(deltaTime * SIMULATION_SPEED, MAX_STEPS_PER_FRAME);
+            auto stepStart = std::chrono::steady_clock::now();
+            advanced = false;
+            while (float dt = timestep.step(stars)) {
+                stepCount++;
+                simulationTime += dt;
+                advanced = true;
+                
+                if (snapshots && stepCount % snapshotInterval == 0) {
+                    snapshots->submit(stars, stepCount, simulationTime);
+                }
+            }
+            stepSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - stepStart).count();
+        }
+        
+        // Consumers get the integrated state, not the extrapolated one
+        if (advanced) {
+            if (publisher.isOpen()) publisher.publish(stars, stepCount, simulationTime);
+            if (streamServer.isOpen()) streamServer.publish(stars, stepCount, simulationTime);
+        }
+        
+        encodePositionStream();
+        if (!replay) resortIfScattered();
         
         // Update VBO with new positions
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, stars.size() * sizeof(Star), &stars[0]);
+        glstate::bindArrayBuffer(VBO);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, positionStream.size(), &positionStream[0]);
+    }
+    
+    // True on the frame a key goes down, not while it is held
+    static bool keyPressed(GLFWwindow* window, int key, bool& wasDown) {
+        bool down = glfwGetKey(window, key) == GLFW_PRESS;
+        bool pressed = down && !wasDown;
+        wasDown = down;
+        return pressed;
     }
     
     void processInput(GLFWwindow* window, float deltaTime) {
         const float cameraSpeed = 1000.0f * deltaTime;
+        glm::vec3 previousPos = cameraPos;
+        glm::vec3 previousFront = cameraFront;
         if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
             cameraPos += cameraSpeed * cameraFront;
         if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
@@ -206,10 +553,303 @@ public:
             cameraPos -= glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
         if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
             cameraPos += glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
+        
+        if (glfwGetKey(window, GLFW_KEY_1) == GLFW_PRESS)
+            setViewLayout(ViewLayout::Single);
+        if (glfwGetKey(window, GLFW_KEY_2) == GLFW_PRESS)
+            setViewLayout(ViewLayout::SplitScreen);
+        if (glfwGetKey(window, GLFW_KEY_3) == GLFW_PRESS)
+            setViewLayout(ViewLayout::CubeMap);
+        
+        // Poster on key press, not while held
+        if (keyPressed(window, GLFW_KEY_P, posterKeyDown))
+            posterRequested = true;
+        
+        if (replay) {
+            if (keyPressed(window, GLFW_KEY_SPACE, pauseKeyDown))
+                replay->setPaused(!replay->isPaused());
+            if (keyPressed(window, GLFW_KEY_R, reverseKeyDown))
+                replay->setSpeed(-replay->getSpeed());
+            if (keyPressed(window, GLFW_KEY_LEFT_BRACKET, slowerKeyDown))
+                replay->setSpeed(replay->getSpeed() * 0.5);
+            if (keyPressed(window, GLFW_KEY_RIGHT_BRACKET, fasterKeyDown))
+                replay->setSpeed(replay->getSpeed() * 2.0);
+        }
+        
+        if (cameraPos != previousPos || cameraFront != previousFront)
+            camera.markDirty();
     }
 };
 
-int main() {
+// Integration schemes selectable with --integrator; empty if unknown
+static StepFunction integratorNamed(const std::string& name, const HermiteRegion& hermiteRegion,
+                                    const KSOptions& ksOptions) {
+    if (name == "kick-drift") return TimestepController::defaultIntegrator();
+    if (name == "wisdom-holman") {
+        return [](std::vector<Star>& stars, float dt, const TimestepCriteria& criteria) {
+            return integrateWisdomHolman(stars, dt, criteria);
+        };
+    }
+    if (name == "leapfrog") return integrateComposition<Leapfrog>;
+    if (name == "forest-ruth") return integrateComposition<ForestRuth>;
+    if (name == "yoshida6") return integrateComposition<Yoshida6>;
+    if (name == "hermite") {
+        std::shared_ptr<HermiteIntegrator> hermite = std::make_shared<HermiteIntegrator>(hermiteRegion);
+        return [hermite](std::vector<Star>& stars, float dt, const TimestepCriteria& criteria) {
+            return hermite->step(stars, dt, criteria);
+        };
+    }
+    if (name == "ks") {
+        std::shared_ptr<KSIntegrator> ks = std::make_shared<KSIntegrator>(ksOptions);
+        return [ks](std::vector<Star>& stars, float dt, const TimestepCriteria& criteria) {
+            return ks->step(stars, dt, criteria);
+        };
+    }
+    return StepFunction();
+}
+
+// Headless parameter sweep: every line of the sweep file is one system,
+// "stars size black_hole_mass seed", all stepped together. Each system's
+// final state is written to directory/system_NNNN.gsnap.
+static int runEnsemble(const char* sweepPath, long steps, float dt, const std::string& directory) {
+    std::ifstream sweep(sweepPath);
+    if (!sweep) {
+        std::cerr << "Cannot open sweep " << sweepPath << std::endl;
+        return -1;
+    }
+    
+    Ensemble ensemble;
+    std::string line;
+    for (int lineNumber = 1; std::getline(sweep, line); lineNumber++) {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream fields(line);
+        GalaxyParameters parameters;
+        if (!(fields >> parameters.starCount >> parameters.size >> parameters.blackHoleMass >> parameters.seed)) {
+            std::cerr << sweepPath << ":" << lineNumber << ": expected stars size black_hole_mass seed" << std::endl;
+            return -1;
+        }
+        ensemble.addSystem(parameters);
+    }
+    if (ensemble.systemCount() == 0) {
+        std::cerr << sweepPath << " has no systems" << std::endl;
+        return -1;
+    }
+    std::cout << "Ensemble of " << ensemble.systemCount() << " systems, "
+              << ensemble.starCount() << " stars" << std::endl;
+    
+    auto start = std::chrono::steady_clock::now();
+    ensemble.step(dt, (uint64_t)steps);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << steps << " steps in " << seconds << " s: "
+              << ensemble.systemCount() * 3600.0 / seconds << " systems per hour, "
+              << ensemble.starCount() * (double)steps / seconds << " star steps per second" << std::endl;
+    
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+    for (size_t s = 0; s < ensemble.systemCount(); s++) {
+        std::ostringstream name;
+        name << directory << "/system_" << std::setw(4) << std::setfill('0') << s << ".gsnap";
+        if (!ensemble.checkpoint(s, name.str())) return -1;
+    }
+    return 0;
+}
+
+// Headless run over a particle file too large for memory. With a star
+// count, a new galaxy is generated into the file first; with initial
+// conditions, they are converted into it.
+static int runOutOfCore(const char* path, long stars, const char* initialPath, long steps, float dt) {
+    if (stars > 0) {
+        GalaxyParameters parameters;
+        parameters.starCount = (size_t)stars;
+        parameters.size = GALAXY_SIZE;
+        parameters.blackHoleMass = BLACK_HOLE_MASS;
+        if (!createParticleFile(path, parameters)) return -1;
+    } else if (initialPath) {
+        std::vector<Star> loaded;
+        if (!readGadget(initialPath, loaded)) return -1;
+        adoptStars(loaded, BLACK_HOLE_MASS);
+        if (!writeParticleFile(path, loaded, 0, 0.0)) return -1;
+    }
+    
+    OutOfCoreIntegrator integrator;
+    if (!integrator.open(path)) return -1;
+    OutOfCoreStats stats;
+    if (!integrator.step(dt, (uint64_t)steps, &stats)) return -1;
+    
+    double gigabytes = (stats.bytesRead + stats.bytesWritten) / 1e9;
+    std::cout << integrator.starCount() << " stars, " << steps << " steps in " << stats.seconds << " s: "
+              << gigabytes / stats.seconds << " GB/s of I/O, "
+              << integrator.starCount() * (double)steps / stats.seconds << " star steps per second" << std::endl;
+    std::cout << "Busy: read " << stats.readSeconds << " s, write " << stats.writeSeconds
+              << " s, integrate " << stats.integrateSeconds << " s (waited " << stats.integrateStallSeconds
+              << " s for data) -> " << (stats.diskBound() ? "disk-bound" : "compute-bound") << std::endl;
+    return integrator.close() ? 0 : -1;
+}
+
+// Headless Parareal run over steps * dt: the chosen integrator takes the
+// steps, split across time slices, with big-step leapfrog as the coarse
+// propagator. Stars come from initial conditions or are generated.
+static int runParareal(long slices, const StepFunction& fine, long stars, const char* initialPath,
+                       const char* savePath, long steps, float dt) {
+    // Every slice takes the same number of steps, so the horizon is exactly steps * dt
+    size_t sliceCount = slices > 0 ? (size_t)slices : (size_t)omp_get_max_threads();
+    if (steps <= 0 || steps % (long)sliceCount != 0) {
+        std::cerr << "--steps " << steps << " is not a multiple of the " << sliceCount << " Parareal slices" << std::endl;
+        return -1;
+    }
+    
+    std::vector<Star> galaxy;
+    if (initialPath) {
+        if (!readGadget(initialPath, galaxy)) return -1;
+        adoptStars(galaxy, BLACK_HOLE_MASS);
+    } else {
+        GalaxyParameters parameters;
+        parameters.starCount = (size_t)(stars > 0 ? stars : PARAREAL_STARS);
+        parameters.size = GALAXY_SIZE;
+        parameters.blackHoleMass = BLACK_HOLE_MASS;
+        generateGalaxy(parameters, galaxy);
+    }
+    
+    PararealOptions options;
+    options.slices = sliceCount;
+    options.coarseSteps = PARAREAL_COARSE_STEPS;
+    options.tolerance = PARAREAL_TOLERANCE;
+    options.fineSteps = (uint32_t)(steps / (long)sliceCount);
+    double horizon = (double)dt * steps;
+    TimestepCriteria criteria;
+    PararealReport report;
+    integrateParareal(galaxy, horizon, fine, integrateComposition<Leapfrog>, criteria, options, report);
+    
+    for (size_t k = 0; k < report.iterations.size(); k++) {
+        const PararealIteration& iteration = report.iterations[k];
+        std::cout << "Iteration " << k + 1 << ": change " << iteration.change << " ly, "
+                  << iteration.exactSlices << "/" << sliceCount << " slices exact, "
+                  << iteration.seconds << " s" << std::endl;
+    }
+    std::cout << galaxy.size() << " stars over " << horizon << " years in " << sliceCount << " slices: "
+              << (report.converged ? "converged" : "not converged") << " after " << report.iterations.size()
+              << " iterations in " << report.seconds << " s, " << report.speedup()
+              << "x the serial fine run" << std::endl;
+    
+    if (savePath && !writeGadget(savePath, galaxy, horizon)) {
+        std::cerr << "Failed to save final state to " << savePath << std::endl;
+        return -1;
+    }
+    return report.converged ? 0 : -1;
+}
+
+int main(int argc, char** argv) {
+    const char* recordPath = NULL;
+    const char* snapshotDir = "snapshots";
+    const char* trajectoryPath = NULL;
+    const char* arrowPath = NULL;
+    const char* publishName = NULL;
+    const char* streamAddress = NULL;
+    const char* replayPath = NULL;
+    const char* initialPath = NULL; // GADGET binary or HDF5
+    const char* integratorName = "kick-drift";
+    HermiteRegion hermiteRegion;
+    hermiteRegion.radius = HERMITE_RADIUS;
+    KSOptions ksOptions;
+    const char* sweepPath = NULL;
+    const char* particlePath = NULL;
+    long pararealSlices = -1;
+    long particleStars = 0;
+    long headlessSteps = HEADLESS_STEPS;
+    float headlessDt = HEADLESS_DT;
+    const char* savePath = NULL;
+    long snapshotEvery = 0;
+    SnapshotOptions snapshotOptions;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            recordPath = argv[++i];
+        } else if (strcmp(argv[i], "--snapshot-every") == 0 && i + 1 < argc) {
+            snapshotEvery = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--snapshot-dir") == 0 && i + 1 < argc) {
+            snapshotDir = argv[++i];
+        } else if (strcmp(argv[i], "--ic") == 0 && i + 1 < argc) {
+            initialPath = argv[++i];
+        } else if (strcmp(argv[i], "--save-ic") == 0 && i + 1 < argc) {
+            savePath = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayPath = argv[++i];
+        } else if (strcmp(argv[i], "--trajectory") == 0 && i + 1 < argc) {
+            trajectoryPath = argv[++i];
+        } else if (strcmp(argv[i], "--arrow") == 0 && i + 1 < argc) {
+            arrowPath = argv[++i];
+        } else if (strcmp(argv[i], "--publish") == 0 && i + 1 < argc) {
+            publishName = argv[++i];
+        } else if (strcmp(argv[i], "--stream") == 0 && i + 1 < argc) {
+            streamAddress = argv[++i];
+        } else if (strcmp(argv[i], "--integrator") == 0 && i + 1 < argc) {
+            integratorName = argv[++i];
+        } else if (strcmp(argv[i], "--hermite-radius") == 0 && i + 1 < argc) {
+            hermiteRegion.radius = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--hermite-species") == 0 && i + 1 < argc) {
+            // Comma-separated GADGET types, e.g. 3,5
+            for (const char* p = argv[++i]; *p; p++) {
+                if (*p >= '0' && *p < '0' + SPECIES_COUNT) hermiteRegion.species |= 1u << (*p - '0');
+            }
+        } else if (strcmp(argv[i], "--ks-pair-radius") == 0 && i + 1 < argc) {
+            ksOptions.pairRadius = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--ensemble") == 0 && i + 1 < argc) {
+            sweepPath = argv[++i];
+        } else if (strcmp(argv[i], "--out-of-core") == 0 && i + 1 < argc) {
+            particlePath = argv[++i];
+        } else if (strcmp(argv[i], "--parareal") == 0 && i + 1 < argc) {
+            pararealSlices = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--stars") == 0 && i + 1 < argc) {
+            particleStars = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc) {
+            headlessSteps = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--dt") == 0 && i + 1 < argc) {
+            headlessDt = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--snapshot-position-tolerance") == 0 && i + 1 < argc) {
+            snapshotOptions.positionTolerance = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--snapshot-velocity-tolerance") == 0 && i + 1 < argc) {
+            snapshotOptions.velocityTolerance = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--snapshot-threads") == 0 && i + 1 < argc) {
+            snapshotOptions.threads = std::max(1, atoi(argv[++i]));
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--record output.mp4] [--replay FILE]"
+                      << " [--ic FILE] [--save-ic FILE]"
+                      << " [--snapshot-every STEPS] [--snapshot-dir DIR | --trajectory FILE | --arrow FILE]"
+                      << " [--snapshot-position-tolerance X] [--snapshot-velocity-tolerance V]"
+                      << " [--snapshot-threads N]"
+                      << " [--publish /NAME] [--stream [ADDRESS:]PORT]"
+                      << " [--integrator kick-drift|leapfrog|forest-ruth|yoshida6|wisdom-holman|hermite|ks]"
+                      << " [--hermite-radius LY] [--hermite-species TYPES] [--ks-pair-radius LY]"
+                      << " [--ensemble SWEEP [--steps N] [--dt YEARS]]"
+                      << " [--out-of-core FILE [--stars N] [--steps N] [--dt YEARS]]"
+                      << " [--parareal SLICES [--stars N] [--steps N] [--dt YEARS]]" << std::endl;
+            return -1;
+        }
+    }
+    
+    StepFunction integrator = integratorNamed(integratorName, hermiteRegion, ksOptions);
+    if (!integrator) {
+        std::cerr << "Unknown integrator " << integratorName << std::endl;
+        return -1;
+    }
+    
+    // Sweeps, out-of-core and Parareal runs go without a window
+    if (sweepPath) {
+        return runEnsemble(sweepPath, headlessSteps, headlessDt, snapshotDir);
+    }
+    if (particlePath) {
+        return runOutOfCore(particlePath, particleStars, initialPath, headlessSteps, headlessDt);
+    }
+    if (pararealSlices >= 0) {
+        // Slices run concurrently, and the Hermite and KS integrators keep
+        // their state between calls
+        if (strcmp(integratorName, "hermite") == 0 || strcmp(integratorName, "ks") == 0) {
+            std::cerr << "Parareal cannot use the " << integratorName << " integrator" << std::endl;
+            return -1;
+        }
+        return runParareal(pararealSlices, integrator, particleStars, initialPath, savePath,
+                           headlessSteps, headlessDt);
+    }
+    
     // Initialize GLFW and OpenGL
     if (!glfwInit()) {
         return -1;
@@ -231,29 +871,121 @@ int main() {
         return -1;
     }
     
-    // Enable depth testing and point sprites
-    glEnable(GL_DEPTH_TEST);
+    // Enable point sprites; blend and depth state is owned by the HDR pipeline
     glEnable(GL_PROGRAM_POINT_SIZE);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     
-    // Create and initialize simulation
-    GalaxySimulation simulation;
-    
-    float lastFrame = 0.0f;
-    
-    // Main render loop
-    while (!glfwWindowShouldClose(window)) {
-        float currentFrame = glfwGetTime();
-        float deltaTime = currentFrame - lastFrame;
-        lastFrame = currentFrame;
+    // Create and initialize simulation; scoped so its GL objects are
+    // released while the context is still alive
+    {
+        // Replay reads the trajectory on its own threads from the start
+        std::unique_ptr<ReplayPlayer> replay;
+        if (replayPath) {
+            replay.reset(new ReplayPlayer(replayPath, REPLAY_IO_THREADS, REPLAY_LOOKAHEAD));
+            if (!replay->isOpen()) {
+                std::cerr << "Cannot replay " << replayPath << std::endl;
+                return -1;
+            }
+        }
         
-        simulation.processInput(window, deltaTime);
-        simulation.update(deltaTime);
-        simulation.render();
+        std::vector<Star> initialStars;
+        if (initialPath && !replay) {
+            if (!readGadget(initialPath, initialStars)) return -1;
+            std::cout << "Loaded " << initialStars.size() << " particles from " << initialPath << std::endl;
+        }
         
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        GalaxySimulation simulation(replay.get(), initialPath && !replay ? &initialStars : NULL);
+        simulation.setIntegrator(integrator);
+        if (replay) {
+            snapshotEvery = 0; // Replayed frames are already on disk
+        }
+        if (snapshotEvery > 0 && trajectoryPath) {
+            if (!simulation.enableTrajectory(trajectoryPath, (uint64_t)snapshotEvery)) return -1;
+        } else if (snapshotEvery > 0 && arrowPath) {
+            if (!simulation.enableArrowExport(arrowPath, (uint64_t)snapshotEvery)) return -1;
+        } else if (snapshotEvery > 0) {
+            simulation.enableSnapshots(snapshotDir, (uint64_t)snapshotEvery, snapshotOptions);
+        }
+        if (publishName && !simulation.enablePublishing(publishName)) return -1;
+        if (streamAddress) {
+            // A bare port listens on localhost only
+            std::string address = streamAddress;
+            size_t colon = address.rfind(':');
+            std::string host = colon == std::string::npos ? "127.0.0.1" : address.substr(0, colon);
+            int port = atoi(address.c_str() + (colon == std::string::npos ? 0 : colon + 1));
+            if (port <= 0 || port > 65535 || !simulation.enableStreaming(host, (uint16_t)port)) return -1;
+        }
+        
+        // Recording captures the window asynchronously and hands frames to
+        // an ffmpeg worker; when it falls behind, the loop blocks on it
+        std::unique_ptr<FrameCapture> capture;
+        std::unique_ptr<VideoEncoder> encoder;
+        if (recordPath) {
+            int fbWidth, fbHeight;
+            glfwGetFramebufferSize(window, &fbWidth, &fbHeight);
+            capture.reset(new FrameCapture(fbWidth, fbHeight));
+            encoder.reset(new VideoEncoder(recordPath, fbWidth, fbHeight, RECORD_FPS));
+            if (!encoder->isOpen()) {
+                return -1;
+            }
+        }
+        
+        float lastFrame = 0.0f;
+        
+        // Main render loop
+        while (!glfwWindowShouldClose(window)) {
+            float currentFrame = glfwGetTime();
+            float deltaTime = currentFrame - lastFrame;
+            lastFrame = currentFrame;
+            
+            // Recorded video plays back at a fixed rate, so step by it
+            if (encoder) {
+                deltaTime = 1.0f / RECORD_FPS;
+            }
+            
+            int fbWidth, fbHeight;
+            glfwGetFramebufferSize(window, &fbWidth, &fbHeight);
+            simulation.resize(fbWidth, fbHeight);
+            
+            simulation.processInput(window, deltaTime);
+            simulation.update(deltaTime);
+            simulation.render();
+            
+            if (encoder) {
+                unsigned char* frame = encoder->acquireFrame();
+                if (!frame) {
+                    break; // Encoder died, already reported
+                }
+                if (capture->capture(frame, fbWidth, fbHeight))
+                    encoder->submitFrame(frame);
+                else
+                    encoder->releaseFrame(frame);
+            }
+            
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+        }
+        
+        if (encoder) {
+            unsigned char* frame = encoder->acquireFrame();
+            if (frame) {
+                if (capture->flush(frame))
+                    encoder->submitFrame(frame);
+                else
+                    encoder->releaseFrame(frame);
+            }
+            encoder->close();
+            std::cout << "Recorded " << encoder->framesWritten() << " frames to " << recordPath
+                      << " (simulation waited on the encoder " << encoder->stallCount() << " times)" << std::endl;
+        }
+        simulation.finishSnapshots();
+        simulation.finishPublishing();
+        simulation.finishStreaming();
+        if (savePath && !simulation.saveStars(savePath)) {
+            std::cerr << "Failed to save final state to " << savePath << std::endl;
+        }
+        if (replay) {
+            std::cout << "Replay waited on I/O for " << replay->stallCount() << " frames" << std::endl;
+        }
     }
     
     glfwTerminate();
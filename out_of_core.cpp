@@ -0,0 +1,312 @@
+#include "out_of_core.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "snapshot_columns.h"
+
+static const uint32_t PARTICLE_FILE_VERSION = 1;
+static const size_t BLOCK_BYTES = 4096;
+static const size_t GENERATE_BLOCK = 4096; // Stars per random stream when generating
+
+static_assert(OUT_OF_CORE_CHUNK * sizeof(Star) % BLOCK_BYTES == 0, "Chunks must be whole blocks");
+
+typedef std::chrono::steady_clock Clock;
+
+static double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static size_t roundUpToBlock(size_t bytes) {
+    return (bytes + BLOCK_BYTES - 1) / BLOCK_BYTES * BLOCK_BYTES;
+}
+
+// pread/pwrite of whole blocks; drops O_DIRECT if the filesystem refuses
+// it. Reads may stop short at the end of the file.
+static ssize_t transfer(int fd, void* data, size_t bytes, uint64_t offset, bool write) {
+    char* p = static_cast<char*>(data);
+    size_t done = 0;
+    while (done < bytes) {
+        ssize_t n = write ? pwrite(fd, p + done, bytes - done, (off_t)(offset + done))
+                          : pread(fd, p + done, bytes - done, (off_t)(offset + done));
+        if (n < 0 && errno == EINVAL) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        done += (size_t)n;
+    }
+    return (ssize_t)done;
+}
+
+static ParticleFileHeader makeHeader(uint64_t count, uint64_t step, double time) {
+    ParticleFileHeader header;
+    header.magic = PARTICLE_FILE_MAGIC;
+    header.version = PARTICLE_FILE_VERSION;
+    header.starBytes = sizeof(Star);
+    header.count = count;
+    header.step = step;
+    header.time = time;
+    return header;
+}
+
+static bool appendHeader(SequentialFile& file, const ParticleFileHeader& header) {
+    std::vector<unsigned char> block(PARTICLE_FILE_HEADER_BYTES, 0);
+    std::memcpy(block.data(), &header, sizeof(header));
+    return file.append(block.data(), block.size());
+}
+
+bool createParticleFile(const std::string& path, const GalaxyParameters& parameters) {
+    SequentialFile file;
+    uint64_t count = parameters.starCount + 1;
+    if (!file.open(path) || !appendHeader(file, makeHeader(count, 0, 0.0))) {
+        std::cerr << "Failed to create " << path << std::endl;
+        return false;
+    }
+    
+    Star blackHole = centralBlackHole(parameters.blackHoleMass);
+    if (!file.append(&blackHole, sizeof(blackHole))) return false;
+    
+    // Each block of stars has its own random stream, so the galaxy depends
+    // only on the seed, however many threads generate it
+    uint32_t seed = parameters.seed ? parameters.seed : std::random_device()();
+    std::vector<Star> chunk(OUT_OF_CORE_CHUNK);
+    for (uint64_t first = 0; first < parameters.starCount; first += OUT_OF_CORE_CHUNK) {
+        size_t n = (size_t)std::min<uint64_t>(OUT_OF_CORE_CHUNK, parameters.starCount - first);
+        #pragma omp parallel for schedule(dynamic)
+        for (size_t block = 0; block < n; block += GENERATE_BLOCK) {
+            std::seed_seq sequence = {seed, (uint32_t)((first + block) / GENERATE_BLOCK),
+                                      (uint32_t)((first + block) / GENERATE_BLOCK >> 32)};
+            std::mt19937 gen(sequence);
+            std::normal_distribution<float> massDist(1.0f, 0.5f); // Solar masses
+            std::uniform_real_distribution<float> posDist(-parameters.size/2, parameters.size/2);
+            std::uniform_real_distribution<float> velDist(-100.0f, 100.0f); // km/s
+            for (size_t i = block; i < std::min(block + GENERATE_BLOCK, n); i++) {
+                Star& star = chunk[i];
+                star.position = glm::vec3(posDist(gen), posDist(gen), posDist(gen));
+                star.velocity = glm::vec3(velDist(gen), velDist(gen), velDist(gen));
+                star.mass = std::max(0.1f, massDist(gen));
+                star.size = starDisplaySize(star.mass);
+                star.isBlackHole = false;
+                star.species = SPECIES_DISK;
+            }
+        }
+        if (!file.append(chunk.data(), n * sizeof(Star))) {
+            std::cerr << "Failed to write " << path << std::endl;
+            return false;
+        }
+    }
+    return file.close();
+}
+
+bool writeParticleFile(const std::string& path, const std::vector<Star>& stars, uint64_t step, double time) {
+    SequentialFile file;
+    if (!file.open(path) || !appendHeader(file, makeHeader(stars.size(), step, time)) ||
+        !file.append(stars.data(), stars.size() * sizeof(Star)) || !file.close()) {
+        std::cerr << "Failed to write " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool readParticleFile(const std::string& path, std::vector<Star>& stars, uint64_t& step, double& time) {
+    std::ifstream in(path, std::ios::binary);
+    ParticleFileHeader header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != PARTICLE_FILE_MAGIC ||
+        header.version != PARTICLE_FILE_VERSION || header.starBytes != sizeof(Star)) {
+        std::cerr << path << " is not a particle file" << std::endl;
+        return false;
+    }
+    stars.resize(header.count);
+    in.seekg(PARTICLE_FILE_HEADER_BYTES);
+    if (!in.read(reinterpret_cast<char*>(stars.data()), header.count * sizeof(Star))) {
+        std::cerr << path << " is truncated" << std::endl;
+        return false;
+    }
+    step = header.step;
+    time = header.time;
+    return true;
+}
+
+OutOfCoreIntegrator::~OutOfCoreIntegrator() {
+    close();
+}
+
+bool OutOfCoreIntegrator::open(const std::string& path) {
+    fd = ::open(path.c_str(), O_RDWR | O_DIRECT);
+    if (fd < 0) {
+        // tmpfs and some network filesystems reject O_DIRECT
+        fd = ::open(path.c_str(), O_RDWR);
+    }
+    if (fd < 0) {
+        std::cerr << "Cannot open " << path << std::endl;
+        return false;
+    }
+    
+    for (Buffer& buffer : buffers) {
+        if (posix_memalign(reinterpret_cast<void**>(&buffer.stars), BLOCK_BYTES, OUT_OF_CORE_CHUNK * sizeof(Star)) != 0) {
+            buffer.stars = NULL;
+            close();
+            return false;
+        }
+    }
+    
+    // The header and the black hole, which leads the first chunk
+    unsigned char* first = reinterpret_cast<unsigned char*>(buffers[0].stars);
+    struct stat info;
+    bool ok = transfer(fd, first, PARTICLE_FILE_HEADER_BYTES + BLOCK_BYTES, 0, false) >=
+              (ssize_t)(PARTICLE_FILE_HEADER_BYTES + sizeof(Star));
+    if (ok) {
+        std::memcpy(&header, first, sizeof(header));
+        std::memcpy(&blackHole, first + PARTICLE_FILE_HEADER_BYTES, sizeof(Star));
+    }
+    if (!ok || header.magic != PARTICLE_FILE_MAGIC || header.version != PARTICLE_FILE_VERSION ||
+        header.starBytes != sizeof(Star) || header.count == 0 || fstat(fd, &info) != 0 ||
+        (uint64_t)info.st_size < PARTICLE_FILE_HEADER_BYTES + header.count * sizeof(Star)) {
+        std::cerr << path << " is not a complete particle file" << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool OutOfCoreIntegrator::close() {
+    for (Buffer& buffer : buffers) {
+        std::free(buffer.stars);
+        buffer.stars = NULL;
+    }
+    if (fd < 0) return true;
+    bool ok = ::close(fd) == 0;
+    fd = -1;
+    return ok;
+}
+
+size_t OutOfCoreIntegrator::chunkStars(size_t chunk) const {
+    return (size_t)std::min<uint64_t>(OUT_OF_CORE_CHUNK, header.count - (uint64_t)chunk * OUT_OF_CORE_CHUNK);
+}
+
+uint64_t OutOfCoreIntegrator::chunkOffset(size_t chunk) const {
+    return PARTICLE_FILE_HEADER_BYTES + (uint64_t)chunk * OUT_OF_CORE_CHUNK * sizeof(Star);
+}
+
+bool OutOfCoreIntegrator::step(float dt, uint64_t count, OutOfCoreStats* stats) {
+    if (fd < 0) return false;
+    OutOfCoreStats pass;
+    Clock::time_point start = Clock::now();
+    size_t chunks = (size_t)((header.count + OUT_OF_CORE_CHUNK - 1) / OUT_OF_CORE_CHUNK);
+    for (Buffer& buffer : buffers) buffer.state = BufferState::Free;
+    failed = false;
+    
+    // Chunk c always goes through buffer c % OUT_OF_CORE_BUFFERS, so each
+    // stage just waits for its next buffer to reach the state it needs
+    std::thread reader(&OutOfCoreIntegrator::readChunks, this, chunks, std::ref(pass));
+    std::thread writer(&OutOfCoreIntegrator::writeChunks, this, chunks, std::ref(pass));
+    for (size_t c = 0; c < chunks; c++) {
+        Buffer& buffer = buffers[c % OUT_OF_CORE_BUFFERS];
+        {
+            Clock::time_point wait = Clock::now();
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&] { return failed || buffer.state == BufferState::Loaded; });
+            pass.integrateStallSeconds += secondsSince(wait);
+            if (failed) break;
+        }
+        
+        Clock::time_point busy = Clock::now();
+        Star* stars = buffer.stars;
+        #pragma omp parallel for
+        for (size_t i = 0; i < buffer.count; i++) {
+            if (stars[i].isBlackHole) continue;
+            for (uint64_t n = 0; n < count; n++) {
+                advanceStar(stars[i], blackHole, dt);
+            }
+        }
+        pass.integrateSeconds += secondsSince(busy);
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            buffer.state = BufferState::Integrated;
+        }
+        changed.notify_all();
+    }
+    reader.join();
+    writer.join();
+    
+    bool ok = !failed;
+    if (ok) {
+        // The last chunk was written out to a whole block
+        header.step += count;
+        for (uint64_t n = 0; n < count; n++) header.time += dt;
+        unsigned char* block = reinterpret_cast<unsigned char*>(buffers[0].stars);
+        std::memset(block, 0, PARTICLE_FILE_HEADER_BYTES);
+        std::memcpy(block, &header, sizeof(header));
+        ok = transfer(fd, block, PARTICLE_FILE_HEADER_BYTES, 0, true) == (ssize_t)PARTICLE_FILE_HEADER_BYTES &&
+             ftruncate(fd, (off_t)(PARTICLE_FILE_HEADER_BYTES + header.count * sizeof(Star))) == 0;
+    }
+    if (!ok) std::cerr << "Out-of-core pass failed; the particle file is partly advanced" << std::endl;
+    
+    pass.seconds = secondsSince(start);
+    if (stats) *stats = pass;
+    return ok;
+}
+
+void OutOfCoreIntegrator::readChunks(size_t chunks, OutOfCoreStats& stats) {
+    for (size_t c = 0; c < chunks; c++) {
+        Buffer& buffer = buffers[c % OUT_OF_CORE_BUFFERS];
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&] { return failed || buffer.state == BufferState::Free; });
+            if (failed) return;
+        }
+        
+        Clock::time_point busy = Clock::now();
+        size_t bytes = chunkStars(c) * sizeof(Star);
+        bool ok = transfer(fd, buffer.stars, roundUpToBlock(bytes), chunkOffset(c), false) >= (ssize_t)bytes;
+        stats.readSeconds += secondsSince(busy);
+        stats.bytesRead += bytes;
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            buffer.count = chunkStars(c);
+            buffer.state = BufferState::Loaded;
+            if (!ok) failed = true;
+        }
+        changed.notify_all();
+        if (!ok) return;
+    }
+}
+
+void OutOfCoreIntegrator::writeChunks(size_t chunks, OutOfCoreStats& stats) {
+    for (size_t c = 0; c < chunks; c++) {
+        Buffer& buffer = buffers[c % OUT_OF_CORE_BUFFERS];
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&] { return failed || buffer.state == BufferState::Integrated; });
+            if (failed) return;
+        }
+        
+        Clock::time_point busy = Clock::now();
+        size_t bytes = roundUpToBlock(buffer.count * sizeof(Star));
+        bool ok = transfer(fd, buffer.stars, bytes, chunkOffset(c), true) == (ssize_t)bytes;
+        stats.writeSeconds += secondsSince(busy);
+        stats.bytesWritten += buffer.count * sizeof(Star);
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            buffer.state = BufferState::Free;
+            if (!ok) failed = true;
+        }
+        changed.notify_all();
+        if (!ok) return;
+    }
+}
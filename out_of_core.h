@@ -0,0 +1,99 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "galaxy_core.h"
+
+// Integration of particle sets larger than memory. Under the black-hole-
+// only force every star moves independently, so the stars can stay in a
+// particle file on disk and pass through memory a chunk at a time: one
+// thread reads ahead, the OpenMP team integrates, and another thread writes
+// finished chunks back, all three at once.
+//
+// Particle file: a PARTICLE_FILE_HEADER_BYTES header, then the Star records
+// exactly as in memory, black hole first. Chunks are whole 4 KB blocks, so
+// reads and writes bypass the page cache where the filesystem allows.
+
+const uint64_t PARTICLE_FILE_MAGIC = 0x3153524154534753; // "GSSTARS1"
+const size_t PARTICLE_FILE_HEADER_BYTES = 4096;
+const size_t OUT_OF_CORE_CHUNK = 1 << 20; // Stars; a multiple of 1024 keeps chunks block-aligned
+const int OUT_OF_CORE_BUFFERS = 4;
+
+struct ParticleFileHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t starBytes;
+    uint64_t count;
+    uint64_t step;
+    double time;
+};
+
+// Generates a galaxy straight into a particle file, a chunk at a time, so
+// the star count is limited by disk rather than memory. The stars are not
+// spatially sorted.
+bool createParticleFile(const std::string& path, const GalaxyParameters& parameters);
+bool writeParticleFile(const std::string& path, const std::vector<Star>& stars, uint64_t step, double time);
+bool readParticleFile(const std::string& path, std::vector<Star>& stars, uint64_t& step, double& time);
+
+// Where one pass spent its time, each stage timed while busy
+struct OutOfCoreStats {
+    double seconds = 0.0;
+    double readSeconds = 0.0;
+    double integrateSeconds = 0.0;
+    double writeSeconds = 0.0;
+    double integrateStallSeconds = 0.0; // Integration waiting for a chunk to arrive
+    uint64_t bytesRead = 0;
+    uint64_t bytesWritten = 0;
+    
+    // Reads and writes share the disk, so their busy times add up
+    bool diskBound() const { return readSeconds + writeSeconds > integrateSeconds; }
+};
+
+class OutOfCoreIntegrator {
+public:
+    OutOfCoreIntegrator() = default;
+    ~OutOfCoreIntegrator();
+    
+    OutOfCoreIntegrator(const OutOfCoreIntegrator&) = delete;
+    OutOfCoreIntegrator& operator=(const OutOfCoreIntegrator&) = delete;
+    
+    bool open(const std::string& path);
+    bool close();
+    bool isOpen() const { return fd >= 0; }
+    
+    uint64_t starCount() const { return header.count; }
+    uint64_t stepCount() const { return header.step; }
+    double time() const { return header.time; }
+    
+    // Advances every star count steps of dt in a single pass over the file.
+    // The black hole does not move, so each chunk takes all its steps while
+    // it is in memory and the file is read and written once.
+    bool step(float dt, uint64_t count, OutOfCoreStats* stats = NULL);
+    
+private:
+    enum class BufferState { Free, Loaded, Integrated };
+    
+    struct Buffer {
+        Star* stars = NULL;
+        size_t count = 0;
+        BufferState state = BufferState::Free;
+    };
+    
+    void readChunks(size_t chunks, OutOfCoreStats& stats);
+    void writeChunks(size_t chunks, OutOfCoreStats& stats);
+    size_t chunkStars(size_t chunk) const;
+    uint64_t chunkOffset(size_t chunk) const;
+    
+    int fd = -1;
+    ParticleFileHeader header = {};
+    Star blackHole;
+    Buffer buffers[OUT_OF_CORE_BUFFERS];
+    
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool failed = false;
+};
@@ -0,0 +1,90 @@
+#include "parareal.h"
+#include <algorithm>
+#include <chrono>
+#include <omp.h>
+
+typedef std::chrono::steady_clock Clock;
+
+static double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void propagate(std::vector<Star>& stars, const StepFunction& step, double span, uint32_t steps,
+                      const TimestepCriteria& criteria) {
+    float dt = (float)(span / steps);
+    for (uint32_t n = 0; n < steps; n++) step(stars, dt, criteria);
+}
+
+bool integrateParareal(std::vector<Star>& stars, double horizon, const StepFunction& fine, const StepFunction& coarse,
+                       const TimestepCriteria& criteria, const PararealOptions& options, PararealReport& report) {
+    Clock::time_point start = Clock::now();
+    size_t slices = options.slices ? options.slices : (size_t)omp_get_max_threads();
+    int maxIterations = options.maxIterations ? options.maxIterations : (int)slices;
+    double span = horizon / slices;
+    report = PararealReport();
+    
+    // boundary[n] is the state at the start of slice n; coarse[n] and
+    // fine[n] are the two propagators' results from it
+    std::vector<std::vector<Star>> boundary(slices + 1, stars);
+    std::vector<std::vector<Star>> coarseEnd(slices), fineEnd(slices);
+    std::vector<double> fineSeconds(slices, 0.0);
+    for (size_t n = 0; n < slices; n++) {
+        coarseEnd[n] = boundary[n];
+        propagate(coarseEnd[n], coarse, span, options.coarseSteps, criteria);
+        boundary[n + 1] = coarseEnd[n];
+    }
+    
+    size_t exact = 0; // boundary[0..exact] match the fine solution
+    for (int iteration = 0; iteration < maxIterations && exact < slices; iteration++) {
+        Clock::time_point iterationStart = Clock::now();
+        
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (size_t n = exact; n < slices; n++) {
+            Clock::time_point sliceStart = Clock::now();
+            fineEnd[n] = boundary[n];
+            propagate(fineEnd[n], fine, span, options.fineSteps, criteria);
+            fineSeconds[n] = secondsSince(sliceStart);
+        }
+        
+        // Serial correction sweep: new coarse + (fine - old coarse) from
+        // the boundary just corrected. The first slice not yet exact started
+        // from an exact boundary, so its fine result is taken as it is.
+        float change = 0.0f;
+        #pragma omp parallel for reduction(max:change)
+        for (size_t i = 0; i < stars.size(); i++) {
+            change = std::max(change, glm::length(fineEnd[exact][i].position - boundary[exact + 1][i].position));
+        }
+        boundary[exact + 1] = fineEnd[exact];
+        std::vector<Star> predicted;
+        for (size_t n = exact + 1; n < slices; n++) {
+            predicted = boundary[n];
+            propagate(predicted, coarse, span, options.coarseSteps, criteria);
+            std::vector<Star>& next = boundary[n + 1];
+            #pragma omp parallel for reduction(max:change)
+            for (size_t i = 0; i < next.size(); i++) {
+                if (next[i].isBlackHole) continue;
+                glm::vec3 position = predicted[i].position + (fineEnd[n][i].position - coarseEnd[n][i].position);
+                glm::vec3 velocity = predicted[i].velocity + (fineEnd[n][i].velocity - coarseEnd[n][i].velocity);
+                change = std::max(change, glm::length(position - next[i].position));
+                next[i].position = position;
+                next[i].velocity = velocity;
+            }
+            coarseEnd[n].swap(predicted);
+        }
+        
+        exact++;
+        report.iterations.push_back({change, exact, secondsSince(iterationStart)});
+        if (change <= options.tolerance) {
+            report.converged = true;
+            break;
+        }
+    }
+    if (exact == slices) report.converged = true;
+    
+    // Slices that went exact before the last iteration kept the time from
+    // when they last ran
+    for (double seconds : fineSeconds) report.fineSeconds += seconds;
+    stars.swap(boundary[slices]);
+    report.seconds = secondsSince(start);
+    return report.converged;
+}
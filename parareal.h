@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "galaxy_core.h"
+
+// Parareal: parallel in time rather than over stars, for runs with too few
+// stars to keep every core busy. The horizon is cut into slices. A cheap
+// coarse propagator sweeps them serially, the accurate fine propagator runs
+// on every slice at once, and each iteration corrects the slice boundaries
+// with new - old coarse + fine, until they stop changing. After k
+// iterations the first k slices are exact, so it converges in at most as
+// many iterations as there are slices, usually far fewer.
+
+struct PararealOptions {
+    size_t slices = 0;          // 0 for one per OpenMP thread
+    uint32_t coarseSteps = 1;   // Per slice
+    uint32_t fineSteps = 100;   // Per slice
+    float tolerance = 1e-3f;    // Light years; largest change of a star between iterations
+    int maxIterations = 0;      // 0 for as many as slices
+};
+
+struct PararealIteration {
+    float change;        // Largest change of any star position at any slice boundary
+    size_t exactSlices;  // Slices known to match the fine solution
+    double seconds;
+};
+
+struct PararealReport {
+    std::vector<PararealIteration> iterations;
+    bool converged = false;
+    double seconds = 0.0;
+    double fineSeconds = 0.0; // A serial fine run over the horizon, as measured slice by slice
+    
+    double speedup() const { return seconds > 0.0 ? fineSeconds / seconds : 0.0; }
+};
+
+// Advances stars by horizon; returns whether the iterations converged, the
+// stars holding the last iterate either way. The fine propagator runs on
+// several slices concurrently, so it must not share scratch state between
+// calls; its own OpenMP loops run single-threaded inside a slice.
+bool integrateParareal(std::vector<Star>& stars, double horizon, const StepFunction& fine, const StepFunction& coarse,
+                       const TimestepCriteria& criteria, const PararealOptions& options, PararealReport& report);
@@ -0,0 +1,131 @@
+#include "poster_renderer.h"
+#include "hdr_pipeline.h"
+#include "gl_state.h"
+#include <png.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+static const int POSTER_TILE_SIZE = 4096;
+
+// Thin wrapper so the libpng setjmp error path never skips C++ destructors
+struct PngStream {
+    FILE* file = NULL;
+    png_structp png = NULL;
+    png_infop info = NULL;
+    
+    ~PngStream() {
+        if (png) png_destroy_write_struct(&png, info ? &info : NULL);
+        if (file) fclose(file);
+    }
+    
+    bool open(const std::string& path, int width, int height) {
+        file = fopen(path.c_str(), "wb");
+        if (!file) return false;
+        png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+        if (!png) return false;
+        info = png_create_info_struct(png);
+        if (!info) return false;
+        if (setjmp(png_jmpbuf(png))) return false;
+        
+        png_init_io(png, file);
+        png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+                     PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+        png_write_info(png, info);
+        return true;
+    }
+    
+    bool writeRows(unsigned char* rows, int count, size_t stride) {
+        if (setjmp(png_jmpbuf(png))) return false;
+        for (int i = 0; i < count; i++) {
+            png_write_row(png, rows + i * stride);
+        }
+        return true;
+    }
+    
+    bool finish() {
+        if (setjmp(png_jmpbuf(png))) return false;
+        png_write_end(png, NULL);
+        return true;
+    }
+};
+
+bool renderPoster(const PosterSettings& settings, const glm::mat4& view, const PosterDrawFn& draw) {
+    GLint maxViewport[2], maxTexture;
+    glGetIntegerv(GL_MAX_VIEWPORT_DIMS, maxViewport);
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTexture);
+    
+    const int guard = settings.guardBand;
+    const int targetSize = std::min({POSTER_TILE_SIZE, (int)maxViewport[0], (int)maxViewport[1], (int)maxTexture});
+    const int tile = targetSize - 2 * guard;
+    if (tile <= 0) {
+        std::cerr << "Poster guard band exceeds the maximum tile size" << std::endl;
+        return false;
+    }
+    
+    PngStream out;
+    if (!out.open(settings.path, settings.width, settings.height)) {
+        std::cerr << "Failed to open poster file " << settings.path << std::endl;
+        return false;
+    }
+    
+    // Offscreen HDR accumulation plus an 8-bit target for the tone-mapped tile
+    HDRPipeline hdr(targetSize, targetSize);
+    GLuint ldrFBO, ldrTexture;
+    glGenTextures(1, &ldrTexture);
+    glstate::bindTexture2D(0, ldrTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, targetSize, targetSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glGenFramebuffers(1, &ldrFBO);
+    glstate::bindFramebuffer(ldrFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, ldrTexture, 0);
+    
+    // Symmetric frustum of the whole poster; tiles take sub-rectangles of it
+    const float top = settings.nearPlane * std::tan(glm::radians(settings.fovDegrees) * 0.5f);
+    const float right = top * (float)settings.width / (float)settings.height;
+    
+    const size_t stripStride = (size_t)settings.width * 3;
+    std::vector<unsigned char> strip(stripStride * tile);
+    std::vector<unsigned char> pixels((size_t)tile * tile * 3);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    
+    bool ok = true;
+    // PNG rows run top-down, GL rows bottom-up: walk tile rows from the top
+    for (int stripTop = settings.height; stripTop > 0 && ok; stripTop -= tile) {
+        int rows = std::min(tile, stripTop);
+        int y0 = stripTop - rows;
+        
+        for (int x0 = 0; x0 < settings.width; x0 += tile) {
+            int cols = std::min(tile, settings.width - x0);
+            
+            // Subfrustum covering the tile plus its guard band
+            float l = -right + 2.0f * right * (float)(x0 - guard) / settings.width;
+            float r = -right + 2.0f * right * (float)(x0 - guard + targetSize) / settings.width;
+            float b = -top + 2.0f * top * (float)(y0 - guard) / settings.height;
+            float t = -top + 2.0f * top * (float)(y0 - guard + targetSize) / settings.height;
+            glm::mat4 projection = glm::frustum(l, r, b, t, settings.nearPlane, settings.farPlane);
+            
+            hdr.beginScene();
+            draw(projection, view, targetSize, targetSize);
+            hdr.endScene(ldrFBO);
+            
+            glReadPixels(guard, guard, cols, rows, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+            for (int j = 0; j < rows; j++) {
+                std::memcpy(&strip[(size_t)(rows - 1 - j) * stripStride + (size_t)x0 * 3],
+                            &pixels[(size_t)j * cols * 3], (size_t)cols * 3);
+            }
+        }
+        ok = out.writeRows(strip.data(), rows, stripStride);
+    }
+    ok = ok && out.finish();
+    
+    glstate::forgetFramebuffer(ldrFBO);
+    glstate::forgetTexture(ldrTexture);
+    glDeleteFramebuffers(1, &ldrFBO);
+    glDeleteTextures(1, &ldrTexture);
+    
+    if (!ok) std::cerr << "Failed to write poster " << settings.path << std::endl;
+    return ok;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <functional>
+#include <string>
+
+struct PosterSettings {
+    int width;
+    int height;
+    std::string path; // PNG output
+    float fovDegrees;
+    float nearPlane;
+    float farPlane;
+    int guardBand;    // Extra pixels rendered around every tile, then discarded
+};
+
+// Draws the scene into the currently bound target for the given camera,
+// culling to the projection's frustum
+using PosterDrawFn = std::function<void(const glm::mat4& projection, const glm::mat4& view,
+                                        int width, int height)>;
+
+// Renders an image larger than GL_MAX_VIEWPORT_DIMS by splitting the
+// projection into per-tile subfrustums. Each tile is rendered offscreen
+// through its own HDR pipeline, with a guard band wide enough for the
+// largest point sprite and the bloom kernel, so nothing is cut at the seams.
+// Finished rows of tiles are streamed to the PNG encoder, so only one strip
+// of the poster is ever in memory. Returns false if the file can't be
+// written.
+bool renderPoster(const PosterSettings& settings, const glm::mat4& view, const PosterDrawFn& draw);
@@ -0,0 +1,172 @@
+// Python bindings for the simulation core:
+//
+//   import galaxysim
+//   sim = galaxysim.Simulation(stars=100000, seed=1)
+//   sim.step(1.0, count=100)       # Releases the GIL while integrating
+//   sim.positions                  # (N, 3) float32 view of the C++ stars
+//   sim.checkpoint("run.gsnap")
+//
+// Field arrays are NumPy views straight into the Star records: strided by
+// sizeof(Star), no copies, writable, and they keep the simulation alive.
+// The star array never moves after construction, so views stay valid, but
+// they show a step in progress if read from another thread during step().
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include "galaxy_core.h"
+#include "ensemble.h"
+#include "gadget_io.h"
+
+namespace py = pybind11;
+
+// One field of every star; rows are sizeof(Star) apart
+template <class T>
+static py::array fieldView(py::object owner, std::vector<Star>& stars, size_t offset, size_t components) {
+    char* first = reinterpret_cast<char*>(stars.data()) + offset;
+    std::vector<py::ssize_t> shape = {(py::ssize_t)stars.size()};
+    std::vector<py::ssize_t> strides = {(py::ssize_t)sizeof(Star)};
+    if (components > 1) {
+        shape.push_back((py::ssize_t)components);
+        strides.push_back((py::ssize_t)sizeof(T));
+    }
+    return py::array(py::dtype::of<T>(), shape, strides, first, owner);
+}
+
+PYBIND11_MODULE(galaxysim, m) {
+    m.doc() = "Galaxy simulation core with zero-copy NumPy access to the stars";
+
+    py::class_<GalaxyCore>(m, "Simulation")
+        .def(py::init([](size_t stars, float size, float blackHoleMass, uint32_t seed) {
+                 GalaxyParameters parameters;
+                 parameters.starCount = stars;
+                 parameters.size = size;
+                 parameters.blackHoleMass = blackHoleMass;
+                 parameters.seed = seed;
+                 py::gil_scoped_release release;
+                 return std::unique_ptr<GalaxyCore>(new GalaxyCore(parameters));
+             }),
+             py::arg("stars") = GalaxyParameters().starCount, py::arg("size") = GalaxyParameters().size,
+             py::arg("black_hole_mass") = GalaxyParameters().blackHoleMass, py::arg("seed") = 0,
+             "Generates a galaxy: a central black hole in a cube of stars")
+        .def_static("from_file", [](const std::string& path, float blackHoleMass) {
+                 std::vector<Star> loaded;
+                 bool ok;
+                 {
+                     py::gil_scoped_release release;
+                     ok = readGadget(path, loaded);
+                 }
+                 if (!ok) throw std::runtime_error("cannot read initial conditions from " + path);
+                 return std::unique_ptr<GalaxyCore>(new GalaxyCore(std::move(loaded), blackHoleMass));
+             },
+             py::arg("path"), py::arg("black_hole_mass") = GalaxyParameters().blackHoleMass,
+             "Starts from GADGET-2 binary or HDF5 initial conditions")
+
+        .def("step", &GalaxyCore::step, py::arg("dt"), py::arg("count") = 1,
+             py::call_guard<py::gil_scoped_release>(),
+             "Advances count steps of dt; other Python threads run meanwhile")
+        .def("checkpoint", [](const GalaxyCore& core, const std::string& path) {
+                 bool ok;
+                 {
+                     py::gil_scoped_release release;
+                     ok = core.checkpoint(path);
+                 }
+                 if (!ok) throw std::runtime_error("cannot write checkpoint " + path);
+             },
+             py::arg("path"), "Writes a lossless snapshot of the stars and the clock")
+        .def("restore", [](GalaxyCore& core, const std::string& path) {
+                 bool ok;
+                 {
+                     py::gil_scoped_release release;
+                     ok = core.restore(path);
+                 }
+                 if (!ok) throw std::runtime_error("cannot restore " + path + " into this simulation");
+             },
+             py::arg("path"), "Loads a checkpoint with the same star count, in place")
+        .def("query_radius", [](const GalaxyCore& core, std::array<float, 3> center, float radius) {
+                 std::vector<uint32_t> found;
+                 {
+                     py::gil_scoped_release release;
+                     found = core.queryRadius(glm::vec3(center[0], center[1], center[2]), radius);
+                 }
+                 return py::array_t<uint32_t>((py::ssize_t)found.size(), found.data());
+             },
+             py::arg("center"), py::arg("radius"), "Indices of the stars within radius of center")
+
+        .def_property_readonly("positions", [](py::object self) {
+            return fieldView<float>(self, self.cast<GalaxyCore&>().stars(), offsetof(Star, position), 3);
+        }, "(N, 3) float32 view, light years")
+        .def_property_readonly("velocities", [](py::object self) {
+            return fieldView<float>(self, self.cast<GalaxyCore&>().stars(), offsetof(Star, velocity), 3);
+        }, "(N, 3) float32 view")
+        .def_property_readonly("masses", [](py::object self) {
+            return fieldView<float>(self, self.cast<GalaxyCore&>().stars(), offsetof(Star, mass), 1);
+        }, "(N,) float32 view, solar masses")
+        .def_property_readonly("sizes", [](py::object self) {
+            return fieldView<float>(self, self.cast<GalaxyCore&>().stars(), offsetof(Star, size), 1);
+        }, "(N,) float32 view of display sizes")
+        .def_property_readonly("black_holes", [](py::object self) {
+            return fieldView<bool>(self, self.cast<GalaxyCore&>().stars(), offsetof(Star, isBlackHole), 1);
+        }, "(N,) bool view")
+        .def_property_readonly("species", [](py::object self) {
+            return fieldView<uint8_t>(self, self.cast<GalaxyCore&>().stars(), offsetof(Star, species), 1);
+        }, "(N,) uint8 view: 0 gas, 1 halo, 2 disk, 3 bulge, 4 star, 5 black hole")
+
+        .def_property_readonly("step_count", &GalaxyCore::stepCount)
+        .def_property_readonly("time", &GalaxyCore::time)
+        .def("__len__", [](const GalaxyCore& core) { return core.stars().size(); });
+    
+    // Systems are all given up front, so the packed star array never moves
+    py::class_<Ensemble>(m, "Ensemble")
+        .def(py::init([](const std::vector<std::array<double, 4>>& systems) {
+                 std::unique_ptr<Ensemble> ensemble(new Ensemble());
+                 py::gil_scoped_release release;
+                 for (const auto& system : systems) {
+                     GalaxyParameters parameters;
+                     parameters.starCount = (size_t)system[0];
+                     parameters.size = (float)system[1];
+                     parameters.blackHoleMass = (float)system[2];
+                     parameters.seed = (uint32_t)system[3];
+                     ensemble->addSystem(parameters);
+                 }
+                 return ensemble;
+             }),
+             py::arg("systems"),
+             "One galaxy per (stars, size, black_hole_mass, seed), stepped together")
+        .def("step", &Ensemble::step, py::arg("dt"), py::arg("count") = 1,
+             py::call_guard<py::gil_scoped_release>(),
+             "Advances every system count steps of dt in one parallel loop")
+        .def("checkpoint", [](const Ensemble& ensemble, size_t system, const std::string& path) {
+                 if (system >= ensemble.systemCount()) throw py::index_error("no such system");
+                 bool ok;
+                 {
+                     py::gil_scoped_release release;
+                     ok = ensemble.checkpoint(system, path);
+                 }
+                 if (!ok) throw std::runtime_error("cannot write checkpoint " + path);
+             },
+             py::arg("system"), py::arg("path"), "Writes a lossless snapshot of one system")
+        .def_property_readonly("offsets", [](const Ensemble& ensemble) {
+            std::vector<uint64_t> offsets;
+            for (size_t s = 0; s <= ensemble.systemCount(); s++) {
+                offsets.push_back(ensemble.systemOffset(s));
+            }
+            return py::array_t<uint64_t>((py::ssize_t)offsets.size(), offsets.data());
+        }, "System s is rows offsets[s]:offsets[s + 1] of the field views, black hole first")
+        .def_property_readonly("positions", [](py::object self) {
+            return fieldView<float>(self, self.cast<Ensemble&>().stars(), offsetof(Star, position), 3);
+        }, "(N, 3) float32 view of all systems' stars")
+        .def_property_readonly("velocities", [](py::object self) {
+            return fieldView<float>(self, self.cast<Ensemble&>().stars(), offsetof(Star, velocity), 3);
+        }, "(N, 3) float32 view")
+        .def_property_readonly("masses", [](py::object self) {
+            return fieldView<float>(self, self.cast<Ensemble&>().stars(), offsetof(Star, mass), 1);
+        }, "(N,) float32 view, solar masses")
+        
+        .def_property_readonly("step_count", &Ensemble::stepCount)
+        .def_property_readonly("time", &Ensemble::time)
+        .def("__len__", &Ensemble::systemCount);
+}
@@ -0,0 +1,153 @@
+#include "replay_player.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+ReplayPlayer::ReplayPlayer(const std::string& path, int ioThreads, size_t lookahead)
+    : lookahead(std::max<size_t>(lookahead, 1)) {
+    if (!reader.open(path) || reader.frameCount() == 0) return;
+    
+    initial.resize(reader.starCount());
+    if (!reader.read(0, 0, initial.size(), initial.data())) {
+        initial.clear();
+        return;
+    }
+    playhead = reader.frame(0).time;
+    size_t last = reader.frameCount() - 1;
+    if (last > 0) frameInterval = (reader.frame(last).time - playhead) / last;
+    
+    // Every buffer starts as the first frame, so fields that are never
+    // decoded again are valid whichever buffer is on screen
+    slots.resize(this->lookahead);
+    for (Slot& slot : slots) slot.stars = initial;
+    for (int i = 0; i < std::max(ioThreads, 1); i++) {
+        workers.push_back(std::thread(&ReplayPlayer::run, this));
+    }
+}
+
+ReplayPlayer::~ReplayPlayer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work.notify_all();
+    for (std::thread& worker : workers) worker.join();
+}
+
+// Points the slots at the frames target, target + stride, ... in the
+// direction of play, reusing slots that already hold or are loading them.
+// The frame on screen is never wanted: it lives in the caller's buffer.
+void ReplayPlayer::schedule(size_t target, int direction, size_t stride) {
+    if (broken) return;
+    
+    std::vector<size_t> wanted;
+    for (size_t k = 0; k < slots.size(); k++) {
+        long long frame = (long long)target + direction * (long long)(k * stride);
+        if (frame < 0 || frame >= (long long)reader.frameCount()) break;
+        if ((size_t)frame != shownFrame) wanted.push_back((size_t)frame);
+    }
+    
+    auto rank = [&](size_t frame) {
+        return (size_t)(std::find(wanted.begin(), wanted.end(), frame) - wanted.begin());
+    };
+    for (Slot& slot : slots) {
+        if (slot.state != SlotState::Empty) slot.priority = rank(slot.frame);
+    }
+    
+    bool queued = false;
+    for (size_t k = 0; k < wanted.size(); k++) {
+        bool present = std::any_of(slots.begin(), slots.end(), [&](const Slot& slot) {
+            return slot.state != SlotState::Empty && slot.frame == wanted[k];
+        });
+        if (present) continue;
+        
+        // Evict the least wanted buffer that no worker is writing to
+        Slot* victim = NULL;
+        for (Slot& slot : slots) {
+            if (slot.state == SlotState::Loading) continue;
+            if (slot.state == SlotState::Empty) {
+                victim = &slot;
+                break;
+            }
+            if (slot.priority > k && (!victim || slot.priority > victim->priority)) victim = &slot;
+        }
+        if (!victim) break;
+        victim->frame = wanted[k];
+        victim->priority = k;
+        victim->state = SlotState::Queued;
+        queued = true;
+    }
+    if (queued) work.notify_all();
+}
+
+bool ReplayPlayer::update(double simulationYears, std::vector<Star>& stars) {
+    if (!isOpen()) return false;
+    
+    double advance = paused ? 0.0 : simulationYears * speed;
+    double first = reader.frame(0).time;
+    double last = reader.frame(reader.frameCount() - 1).time;
+    playhead = std::min(std::max(playhead + advance, first), last);
+    
+    size_t target = reader.findFrame(playhead);
+    int direction = speed < 0.0 ? -1 : 1;
+    size_t stride = 1;
+    if (frameInterval > 0.0) {
+        // At high speed whole frames are skipped; don't decode them
+        stride = std::max<size_t>(1, (size_t)std::llround(std::fabs(advance) / frameInterval));
+    }
+    
+    std::lock_guard<std::mutex> lock(mutex);
+    schedule(target, direction, stride);
+    if (target == shownFrame) return false;
+    
+    // Show the target, or failing that the ready frame closest to it on the
+    // way there from the one on screen, so a slow disk drops frames rather
+    // than freezing the picture
+    Slot* best = NULL;
+    for (Slot& slot : slots) {
+        if (slot.state != SlotState::Ready) continue;
+        bool between = target > shownFrame ? slot.frame > shownFrame && slot.frame <= target
+                                           : slot.frame < shownFrame && slot.frame >= target;
+        if (between && (!best || std::labs((long)target - (long)slot.frame) < std::labs((long)target - (long)best->frame)))
+            best = &slot;
+    }
+    if (!best || best->frame != target) stalls++;
+    if (!best) return false;
+    
+    stars.swap(best->stars);
+    best->state = SlotState::Empty;
+    shownFrame = best->frame;
+    schedule(target, direction, stride);
+    return true;
+}
+
+void ReplayPlayer::run() {
+    for (;;) {
+        Slot* slot = NULL;
+        size_t frame;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work.wait(lock, [&] {
+                if (stopping) return true;
+                slot = NULL;
+                for (Slot& s : slots) {
+                    if (s.state == SlotState::Queued && (!slot || s.priority < slot->priority)) slot = &s;
+                }
+                return slot != NULL;
+            });
+            if (stopping) return;
+            slot->state = SlotState::Loading;
+            frame = slot->frame;
+        }
+        
+        // Slots being loaded are never evicted, so the buffer is ours
+        bool ok = reader.read(frame, 0, slot->stars.size(), slot->stars.data(), TRAJECTORY_POSITIONS);
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            slot->state = ok ? SlotState::Ready : SlotState::Empty;
+            if (!ok) broken = true;
+        }
+        if (!ok) std::cerr << "Replay stopped: frame " << frame << " could not be decoded" << std::endl;
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "star.h"
+#include "trajectory.h"
+
+// Plays a recorded trajectory back in place of the integrator. I/O threads
+// decode the frames just ahead of the playhead, in the direction of play,
+// into spare star buffers; update() swaps a ready buffer with the caller's
+// stars, so a new frame costs no copy on the render thread. Only positions
+// are decoded after the first frame; the other fields keep the first frame's
+// values, which is all the renderer needs.
+class ReplayPlayer {
+public:
+    ReplayPlayer(const std::string& path, int ioThreads = 2, size_t lookahead = 4);
+    ~ReplayPlayer();
+    
+    ReplayPlayer(const ReplayPlayer&) = delete;
+    ReplayPlayer& operator=(const ReplayPlayer&) = delete;
+    
+    bool isOpen() const { return !initial.empty(); }
+    
+    // Fully decoded first frame, to initialise buffers from
+    const std::vector<Star>& firstFrame() const { return initial; }
+    
+    // Multiplier on the recorded rate; negative plays backwards
+    void setSpeed(double multiplier) { speed = multiplier; }
+    double getSpeed() const { return speed; }
+    void setPaused(bool pause) { paused = pause; }
+    bool isPaused() const { return paused; }
+    
+    double time() const { return playhead; }
+    size_t frameIndex() const { return shownFrame; }
+    size_t frameCount() const { return reader.frameCount(); }
+    
+    // Advances the playhead by simulationYears times the speed, in the
+    // years of the trajectory's frame times, and swaps the frame under it
+    // into stars if it is decoded. Returns true if stars changed. A frame
+    // that is not ready yet counts as a stall: the nearest decoded frame on
+    // the way to it, if any, is shown instead and the playhead keeps moving.
+    bool update(double simulationYears, std::vector<Star>& stars);
+    
+    size_t stallCount() const { return stalls; }
+    
+private:
+    enum class SlotState { Empty, Queued, Loading, Ready };
+    
+    struct Slot {
+        std::vector<Star> stars;
+        size_t frame = 0;
+        size_t priority = 0; // Position in the prefetch window, lower first
+        SlotState state = SlotState::Empty;
+    };
+    
+    void schedule(size_t target, int direction, size_t stride);
+    void run();
+    
+    TrajectoryReader reader;
+    std::vector<Star> initial;
+    
+    double speed = 1.0;
+    bool paused = false;
+    double playhead = 0.0;
+    double frameInterval = 0.0; // Average simulation time between frames
+    size_t shownFrame = 0;
+    size_t lookahead;
+    size_t stalls = 0;
+    
+    std::mutex mutex;
+    std::condition_variable work;
+    std::vector<Slot> slots;
+    bool stopping = false;
+    bool broken = false; // A frame failed to decode; stop scheduling
+    std::vector<std::thread> workers;
+};
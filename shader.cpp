@@ -0,0 +1,188 @@
+#include "shader.h"
+#include "gl_state.h"
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static uint64_t fnv1a(uint64_t hash, const char* data) {
+    for (; data && *data; data++) {
+        hash ^= (unsigned char)*data;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static fs::path binaryCacheDirectory() {
+    if (const char* xdg = std::getenv("XDG_CACHE_HOME"))
+        return fs::path(xdg) / "galaxy_sim";
+    if (const char* home = std::getenv("HOME"))
+        return fs::path(home) / ".cache" / "galaxy_sim";
+    return fs::path("shader_cache");
+}
+
+// Binaries are only valid for the exact driver that produced them
+static fs::path binaryCachePath(const char* vertexSource, const char* fragmentSource) {
+    uint64_t hash = 14695981039346656037ULL;
+    hash = fnv1a(hash, (const char*)glGetString(GL_VENDOR));
+    hash = fnv1a(hash, (const char*)glGetString(GL_RENDERER));
+    hash = fnv1a(hash, (const char*)glGetString(GL_VERSION));
+    hash = fnv1a(hash, vertexSource);
+    hash = fnv1a(hash, fragmentSource);
+    
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)hash);
+    return binaryCacheDirectory() / name;
+}
+
+static bool binaryCacheSupported() {
+    if (!GLEW_ARB_get_program_binary) return false;
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+static bool programLinked(GLuint program) {
+    GLint status = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    return status == GL_TRUE;
+}
+
+static bool loadProgramBinary(GLuint program, const fs::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    
+    GLenum format;
+    if (!in.read(reinterpret_cast<char*>(&format), sizeof(format))) return false;
+    std::vector<char> binary((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (binary.empty()) return false;
+    
+    glProgramBinary(program, format, binary.data(), (GLsizei)binary.size());
+    return programLinked(program);
+}
+
+static void saveProgramBinary(GLuint program, const fs::path& path) {
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) return;
+    
+    std::vector<char> binary(length);
+    GLenum format;
+    glGetProgramBinary(program, length, NULL, &format, binary.data());
+    
+    std::error_code ec;
+    fs::create_directories(path.parent_path(), ec);
+    
+    // Write then rename so a concurrent launch never reads a partial file
+    fs::path tmp = path;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) return;
+        out.write(reinterpret_cast<const char*>(&format), sizeof(format));
+        out.write(binary.data(), binary.size());
+        if (!out) return;
+    }
+    fs::rename(tmp, path, ec);
+}
+
+static GLuint compileShader(GLenum type, const char* source) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    
+    GLint status = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (status != GL_TRUE) {
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        std::cerr << (type == GL_VERTEX_SHADER ? "Vertex" : "Fragment")
+                  << " shader compilation failed:\n" << log << std::endl;
+    }
+    return shader;
+}
+
+ShaderProgram::ShaderProgram(const char* vertexSource, const char* fragmentSource) {
+    program = glCreateProgram();
+    
+    bool cacheable = binaryCacheSupported();
+    fs::path cachePath;
+    if (cacheable) {
+        cachePath = binaryCachePath(vertexSource, fragmentSource);
+        if (loadProgramBinary(program, cachePath)) return;
+        // Stale or missing binary: fall back to a full compile
+    }
+    
+    GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexSource);
+    GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
+    
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+    if (cacheable) {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    glLinkProgram(program);
+    
+    glDetachShader(program, vertexShader);
+    glDetachShader(program, fragmentShader);
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+    
+    if (!programLinked(program)) {
+        char log[1024];
+        glGetProgramInfoLog(program, sizeof(log), NULL, log);
+        std::cerr << "Shader program link failed:\n" << log << std::endl;
+        glDeleteProgram(program);
+        program = 0;
+        return;
+    }
+    
+    if (cacheable) {
+        saveProgramBinary(program, cachePath);
+    }
+}
+
+ShaderProgram::~ShaderProgram() {
+    if (program) {
+        glstate::forgetProgram(program);
+        glDeleteProgram(program);
+    }
+}
+
+ShaderProgram::ShaderProgram(ShaderProgram&& other) noexcept
+    : program(other.program), uniformLocations(std::move(other.uniformLocations)) {
+    other.program = 0;
+}
+
+ShaderProgram& ShaderProgram::operator=(ShaderProgram&& other) noexcept {
+    if (this != &other) {
+        if (program) {
+            glstate::forgetProgram(program);
+            glDeleteProgram(program);
+        }
+        program = other.program;
+        uniformLocations = std::move(other.uniformLocations);
+        other.program = 0;
+    }
+    return *this;
+}
+
+void ShaderProgram::use() const {
+    glstate::useProgram(program);
+}
+
+GLint ShaderProgram::uniform(const char* name) {
+    auto it = uniformLocations.find(name);
+    if (it != uniformLocations.end()) return it->second;
+    
+    GLint location = glGetUniformLocation(program, name);
+    if (location < 0 && program) {
+        std::cerr << "Uniform '" << name << "' not found or inactive" << std::endl;
+    }
+    uniformLocations.emplace(name, location);
+    return location;
+}
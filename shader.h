@@ -0,0 +1,33 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <string>
+#include <unordered_map>
+
+// A linked vertex/fragment program. When the driver supports program
+// binaries, the linked result is cached on disk keyed by the sources and the
+// driver identity, so later launches skip compilation entirely. Compile and
+// link errors are logged to stderr; a failed program has id() == 0.
+class ShaderProgram {
+public:
+    ShaderProgram() = default;
+    ShaderProgram(const char* vertexSource, const char* fragmentSource);
+    ~ShaderProgram();
+    
+    ShaderProgram(const ShaderProgram&) = delete;
+    ShaderProgram& operator=(const ShaderProgram&) = delete;
+    ShaderProgram(ShaderProgram&& other) noexcept;
+    ShaderProgram& operator=(ShaderProgram&& other) noexcept;
+    
+    GLuint id() const { return program; }
+    
+    // Binds the program through the GL state cache
+    void use() const;
+    
+    // Uniform location, looked up once per name
+    GLint uniform(const char* name);
+    
+private:
+    GLuint program = 0;
+    std::unordered_map<std::string, GLint> uniformLocations;
+};
@@ -0,0 +1,623 @@
+#include "snapshot.h"
+#include "snapshot_columns.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static const char SNAPSHOT_MAGIC[8] = {'G', 'A', 'L', 'S', 'N', 'A', 'P', '\0'};
+static const char SNAPSHOT_END_MAGIC[8] = {'G', 'A', 'L', 'S', 'N', 'A', 'P', 'E'};
+static const uint32_t SNAPSHOT_VERSION = 2;
+static const size_t HEADER_BYTES = 8 + 4 + 4 + 8 + 8 + 8;
+static const size_t TRAILER_BYTES = 8 + 8;
+static const size_t QUANTIZED_HEADER_BYTES = 8 + 8 + 8;
+
+static const char* ORDER_COLUMN = "order";
+
+static float columnTolerance(size_t column, const SnapshotOptions& options) {
+    if (column < 3) return options.positionTolerance;
+    if (column < 6) return options.velocityTolerance;
+    return 0.0f;
+}
+
+SnapshotCodec defaultSnapshotCodec() {
+#ifdef GALAXY_HAVE_ZSTD
+    return SnapshotCodec::Zstd;
+#else
+    return SnapshotCodec::Zlib;
+#endif
+}
+
+struct BlockEntry {
+    uint64_t offset;
+    uint32_t rawBytes;
+    uint32_t storedBytes;
+    SnapshotCodec codec;
+};
+
+// Quantized integer streams
+//
+// Payload: u8 entropyCodec, u8 reserved[7], f64 origin, f64 step, then the
+// entropy-coded, byte-shuffled zigzag deltas of the quantized values as u32.
+// value[k] = origin + q[k] * step.
+
+static const int64_t MAX_QUANTIZED_RANGE = ((int64_t)1 << 31) - 2;
+
+static void encodeIntegers(const int64_t* q, size_t count, double origin, double step,
+                           SnapshotCodec entropy, std::vector<unsigned char>& scratch,
+                           std::vector<unsigned char>& out) {
+    // Deltas are small along a space-filling curve; zigzag keeps them unsigned
+    std::vector<unsigned char> deltas(count * 4);
+    int64_t previous = 0;
+    for (size_t k = 0; k < count; k++) {
+        int64_t d = q[k] - previous;
+        previous = q[k];
+        uint32_t zigzag = (uint32_t)((d << 1) ^ (d >> 63));
+        std::memcpy(&deltas[k * 4], &zigzag, 4);
+    }
+    scratch.resize(deltas.size());
+    shuffleBytes(deltas.data(), scratch.data(), count, 4);
+    
+    out.clear();
+    put(out, (uint8_t)entropy);
+    for (int i = 0; i < 7; i++) put(out, (uint8_t)0);
+    put(out, origin);
+    put(out, step);
+    out.resize(QUANTIZED_HEADER_BYTES + maxCompressedSize(entropy, scratch.size()));
+    size_t stored = compressBlock(entropy, scratch.data(), scratch.size(),
+                                  &out[QUANTIZED_HEADER_BYTES], out.size() - QUANTIZED_HEADER_BYTES);
+    if (stored) {
+        out.resize(QUANTIZED_HEADER_BYTES + stored);
+    } else {
+        out.resize(QUANTIZED_HEADER_BYTES);
+        out.insert(out.end(), scratch.begin(), scratch.end());
+    }
+}
+
+static bool decodeIntegers(const unsigned char* in, size_t storedBytes, size_t count,
+                           std::vector<unsigned char>& scratch, std::vector<int64_t>& q,
+                           double& origin, double& step) {
+    size_t cursor = 0;
+    uint8_t entropy;
+    if (!get(in, storedBytes, cursor, entropy)) return false;
+    cursor += 7;
+    if (!get(in, storedBytes, cursor, origin) || !get(in, storedBytes, cursor, step)) return false;
+    
+    std::vector<unsigned char> deltas(count * 4);
+    scratch.resize(count * 4);
+    if (!decompressBlock((SnapshotCodec)entropy, in + cursor, storedBytes - cursor, scratch.data(), scratch.size()))
+        return false;
+    unshuffleBytes(scratch.data(), deltas.data(), count, 4);
+    
+    q.resize(count);
+    int64_t value = 0;
+    for (size_t k = 0; k < count; k++) {
+        uint32_t zigzag;
+        std::memcpy(&zigzag, &deltas[k * 4], 4);
+        value += (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+        q[k] = value;
+    }
+    return true;
+}
+
+// Quantize to a step of just under 2 * tolerance, so every value decodes
+// within tolerance.
+// Fails for non-finite values or ranges too wide for 32-bit deltas.
+static bool encodeQuantizedFloats(const float* values, size_t count, double tolerance, SnapshotCodec entropy,
+                                  std::vector<int64_t>& q, std::vector<unsigned char>& scratch,
+                                  std::vector<unsigned char>& out) {
+    double lo = INFINITY, hi = -INFINITY;
+    for (size_t k = 0; k < count; k++) {
+        if (!std::isfinite(values[k])) return false;
+        lo = std::min(lo, (double)values[k]);
+        hi = std::max(hi, (double)values[k]);
+    }
+    // Leave room for rounding the reconstructed value back to float
+    double rounding = std::max(std::fabs(lo), std::fabs(hi)) * std::ldexp(1.0, -24);
+    double step = 2.0 * (tolerance - rounding);
+    if (count == 0 || step <= 0.0 || (hi - lo) / step >= (double)MAX_QUANTIZED_RANGE) return false;
+    
+    q.resize(count);
+    for (size_t k = 0; k < count; k++) {
+        q[k] = std::llround((values[k] - lo) / step);
+    }
+    encodeIntegers(q.data(), count, lo, step, entropy, scratch, out);
+    return true;
+}
+
+// Spread the low 21 bits of v so there are two zero bits between each
+static uint64_t expandBits21(uint64_t v) {
+    v &= 0x1FFFFF;
+    v = (v | (v << 32)) & 0x1F00000000FFFFULL;
+    v = (v | (v << 16)) & 0x1F0000FF0000FFULL;
+    v = (v | (v << 8)) & 0x100F00F00F00F00FULL;
+    v = (v | (v << 4)) & 0x10C30C30C30C30C3ULL;
+    v = (v | (v << 2)) & 0x1249249249249249ULL;
+    return v;
+}
+
+// Visiting order of a block along a Morton curve over its bounding box
+static void mortonOrder(const Star* stars, size_t count, std::vector<std::pair<uint64_t, uint32_t>>& keys,
+                        std::vector<uint32_t>& order) {
+    glm::vec3 lo(INFINITY), hi(-INFINITY);
+    for (size_t i = 0; i < count; i++) {
+        if (!std::isfinite(glm::dot(stars[i].position, stars[i].position))) continue;
+        lo = glm::min(lo, stars[i].position);
+        hi = glm::max(hi, stars[i].position);
+    }
+    glm::vec3 scale = 2097151.0f / glm::max(hi - lo, glm::vec3(1e-6f));
+    
+    keys.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        glm::vec3 p = glm::clamp((stars[i].position - lo) * scale, glm::vec3(0.0f), glm::vec3(2097151.0f));
+        uint64_t code = 0;
+        if (std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z)) {
+            code = (expandBits21((uint64_t)p.x) << 2) | (expandBits21((uint64_t)p.y) << 1) | expandBits21((uint64_t)p.z);
+        }
+        keys[i] = std::make_pair(code, (uint32_t)i);
+    }
+    std::sort(keys.begin(), keys.end());
+    
+    order.resize(count);
+    for (size_t k = 0; k < count; k++) order[k] = keys[k].second;
+}
+
+// Writing
+
+struct EncodedBlock {
+    std::vector<unsigned char> bytes;
+    uint32_t rawBytes;
+    SnapshotCodec codec;
+};
+
+// Everything one thread needs to encode all columns of one block
+struct BlockSlot {
+    std::vector<EncodedBlock> columns; // COLUMN_COUNT, plus the order column when lossy
+    std::vector<uint32_t> order;
+    std::vector<std::pair<uint64_t, uint32_t>> keys;
+    std::vector<float> values;
+    std::vector<int64_t> q;
+    std::vector<unsigned char> raw, shuffled, scratch;
+};
+
+static void encodeLossless(const ColumnDesc& column, const Star* stars, size_t count,
+                           SnapshotCodec codec, BlockSlot& slot, EncodedBlock& out) {
+    out.rawBytes = (uint32_t)(count * column.elementSize);
+    out.codec = codec;
+    slot.raw.resize(out.rawBytes);
+    gatherColumn(column, stars, count, slot.raw.data());
+    
+    const unsigned char* source = slot.raw.data();
+    if (column.type == COLUMN_FLOAT32) {
+        slot.shuffled.resize(out.rawBytes);
+        shuffleBytes(slot.raw.data(), slot.shuffled.data(), count, column.elementSize);
+        source = slot.shuffled.data();
+    }
+    
+    out.bytes.resize(maxCompressedSize(codec, out.rawBytes));
+    size_t stored = compressBlock(codec, source, out.rawBytes, out.bytes.data(), out.bytes.size());
+    if (stored) {
+        out.bytes.resize(stored);
+    } else {
+        out.bytes.assign(source, source + out.rawBytes);
+    }
+}
+
+static void encodeBlock(const Star* stars, size_t count, const SnapshotOptions& options, bool lossy, BlockSlot& slot) {
+    slot.columns.resize(COLUMN_COUNT + (lossy ? 1 : 0));
+    if (lossy) {
+        mortonOrder(stars, count, slot.keys, slot.order);
+        
+        std::vector<int64_t>& order = slot.q;
+        order.assign(slot.order.begin(), slot.order.end());
+        EncodedBlock& out = slot.columns[COLUMN_COUNT];
+        out.rawBytes = (uint32_t)(count * 4);
+        out.codec = SnapshotCodec::Quantized;
+        encodeIntegers(order.data(), count, 0.0, 1.0, options.codec, slot.scratch, out.bytes);
+    }
+    
+    for (size_t c = 0; c < COLUMN_COUNT; c++) {
+        const ColumnDesc& column = COLUMNS[c];
+        EncodedBlock& out = slot.columns[c];
+        float tolerance = columnTolerance(c, options);
+        
+        if (lossy && tolerance > 0.0f) {
+            slot.values.resize(count);
+            for (size_t k = 0; k < count; k++) {
+                std::memcpy(&slot.values[k],
+                            reinterpret_cast<const unsigned char*>(&stars[slot.order[k]]) + column.offset, 4);
+            }
+            if (encodeQuantizedFloats(slot.values.data(), count, tolerance, options.codec,
+                                      slot.q, slot.scratch, out.bytes)) {
+                out.rawBytes = (uint32_t)(count * column.elementSize);
+                out.codec = SnapshotCodec::Quantized;
+                continue;
+            }
+            // Not representable within tolerance; keep this block lossless
+        }
+        encodeLossless(column, stars, count, options.codec, slot, out);
+    }
+}
+
+bool writeSnapshot(const std::string& path, const std::vector<Star>& stars,
+                   uint64_t step, double time, const SnapshotOptions& requested) {
+    // Quantized is chosen per block; the option names the lossless stage
+    SnapshotOptions options = requested;
+    if (options.codec == SnapshotCodec::Quantized) options.codec = defaultSnapshotCodec();
+    
+    std::string tmpPath = path + ".tmp";
+    SequentialFile file;
+    if (!file.open(tmpPath)) {
+        std::cerr << "Failed to create snapshot " << tmpPath << std::endl;
+        return false;
+    }
+    
+    std::vector<unsigned char> header;
+    header.insert(header.end(), SNAPSHOT_MAGIC, SNAPSHOT_MAGIC + 8);
+    put(header, SNAPSHOT_VERSION);
+    put(header, (uint32_t)0);
+    put(header, (uint64_t)stars.size());
+    put(header, step);
+    put(header, time);
+    bool ok = file.append(header.data(), header.size());
+    
+    const bool lossy = options.positionTolerance > 0.0f || options.velocityTolerance > 0.0f;
+    const size_t columnCount = COLUMN_COUNT + (lossy ? 1 : 0);
+    const size_t blockCount = (stars.size() + SNAPSHOT_BLOCK_ELEMENTS - 1) / SNAPSHOT_BLOCK_ELEMENTS;
+    std::vector<BlockSlot> slots(std::max(options.threads, 1));
+    std::vector<std::vector<BlockEntry>> blocks(columnCount);
+    
+    // Encode blocks in batches of one per thread, then append each batch in
+    // order so the file is still written strictly sequentially
+    for (size_t batch = 0; batch < blockCount && ok; batch += slots.size()) {
+        size_t batchSize = std::min(slots.size(), blockCount - batch);
+        
+        #pragma omp parallel for num_threads(slots.size()) schedule(static, 1)
+        for (size_t k = 0; k < batchSize; k++) {
+            size_t begin = (batch + k) * SNAPSHOT_BLOCK_ELEMENTS;
+            size_t count = std::min(SNAPSHOT_BLOCK_ELEMENTS, stars.size() - begin);
+            encodeBlock(&stars[begin], count, options, lossy, slots[k]);
+        }
+        
+        for (size_t k = 0; k < batchSize && ok; k++) {
+            for (size_t c = 0; c < columnCount && ok; c++) {
+                const EncodedBlock& encoded = slots[k].columns[c];
+                BlockEntry entry = {file.offset(), encoded.rawBytes, (uint32_t)encoded.bytes.size(), encoded.codec};
+                blocks[c].push_back(entry);
+                ok = file.append(encoded.bytes.data(), encoded.bytes.size());
+            }
+        }
+    }
+    
+    std::vector<unsigned char> directory;
+    uint64_t directoryOffset = file.offset();
+    put(directory, (uint32_t)columnCount);
+    for (size_t c = 0; c < columnCount; c++) {
+        bool order = c == COLUMN_COUNT;
+        char name[16] = {0};
+        std::strncpy(name, order ? ORDER_COLUMN : COLUMNS[c].name, sizeof(name) - 1);
+        directory.insert(directory.end(), name, name + sizeof(name));
+        put(directory, (uint8_t)(order ? COLUMN_UINT32 : COLUMNS[c].type));
+        put(directory, (uint8_t)(order ? 4 : COLUMNS[c].elementSize));
+        put(directory, (uint8_t)options.codec);
+        put(directory, (uint8_t)(!order && COLUMNS[c].type == COLUMN_FLOAT32));
+        put(directory, (uint32_t)blocks[c].size());
+        for (const BlockEntry& b : blocks[c]) {
+            put(directory, b.offset);
+            put(directory, b.rawBytes);
+            put(directory, b.storedBytes);
+            put(directory, (uint8_t)b.codec);
+            for (int i = 0; i < 3; i++) put(directory, (uint8_t)0);
+        }
+    }
+    put(directory, directoryOffset);
+    directory.insert(directory.end(), SNAPSHOT_END_MAGIC, SNAPSHOT_END_MAGIC + 8);
+    ok = ok && file.append(directory.data(), directory.size());
+    ok = file.close() && ok;
+    
+    std::error_code ec;
+    if (ok) fs::rename(tmpPath, path, ec);
+    if (!ok || ec) {
+        std::cerr << "Failed to write snapshot " << path << std::endl;
+        fs::remove(tmpPath, ec);
+        return false;
+    }
+    return true;
+}
+
+// Reading
+
+SnapshotReader::~SnapshotReader() {
+    close();
+}
+
+void SnapshotReader::close() {
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+    columns.clear();
+    orderColumn = -1;
+    hasSpecies = false;
+}
+
+bool SnapshotReader::open(const std::string& filePath) {
+    close();
+    path = filePath;
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Failed to open snapshot " << path << std::endl;
+        return false;
+    }
+    
+    off_t fileSize = lseek(fd, 0, SEEK_END);
+    std::vector<unsigned char> header(HEADER_BYTES), trailer(TRAILER_BYTES);
+    if (fileSize < (off_t)(HEADER_BYTES + TRAILER_BYTES) ||
+        !readExact(fd, header.data(), HEADER_BYTES, 0) ||
+        !readExact(fd, trailer.data(), TRAILER_BYTES, fileSize - TRAILER_BYTES) ||
+        std::memcmp(header.data(), SNAPSHOT_MAGIC, 8) != 0 ||
+        std::memcmp(&trailer[8], SNAPSHOT_END_MAGIC, 8) != 0) {
+        std::cerr << path << " is not a complete snapshot" << std::endl;
+        close();
+        return false;
+    }
+    
+    size_t cursor = 8;
+    uint32_t version, reserved;
+    get(header, cursor, version);
+    get(header, cursor, reserved);
+    get(header, cursor, fileInfo.count);
+    get(header, cursor, fileInfo.step);
+    get(header, cursor, fileInfo.time);
+    if (version < 1 || version > SNAPSHOT_VERSION) {
+        std::cerr << path << ": unsupported snapshot version " << version << std::endl;
+        close();
+        return false;
+    }
+    
+    uint64_t directoryOffset;
+    cursor = 0;
+    get(trailer, cursor, directoryOffset);
+    if (directoryOffset < HEADER_BYTES || directoryOffset > (uint64_t)(fileSize - TRAILER_BYTES)) {
+        close();
+        return false;
+    }
+    std::vector<unsigned char> directory(fileSize - TRAILER_BYTES - directoryOffset);
+    if (!readExact(fd, directory.data(), directory.size(), directoryOffset)) {
+        close();
+        return false;
+    }
+    
+    bool ok = true;
+    cursor = 0;
+    uint32_t columnCount = 0;
+    ok = get(directory, cursor, columnCount);
+    columns.resize(ok ? columnCount : 0);
+    for (size_t c = 0; c < columns.size() && ok; c++) {
+        Column& column = columns[c];
+        char name[16];
+        uint8_t type, codec, shuffled;
+        uint32_t blockCount;
+        ok = cursor + sizeof(name) <= directory.size();
+        if (!ok) break;
+        std::memcpy(name, &directory[cursor], sizeof(name));
+        name[15] = '\0';
+        cursor += sizeof(name);
+        ok = get(directory, cursor, type) && get(directory, cursor, column.elementSize) &&
+             get(directory, cursor, codec) && get(directory, cursor, shuffled) &&
+             get(directory, cursor, blockCount);
+        if (!ok) break;
+        column.shuffled = shuffled != 0;
+        
+        column.field = findColumn(name, type, column.elementSize);
+        if (column.field >= 0 && std::strcmp(COLUMNS[column.field].name, "species") == 0) hasSpecies = true;
+        if (std::strcmp(name, ORDER_COLUMN) == 0) orderColumn = (int)c;
+        
+        column.blocks.resize(blockCount);
+        for (Block& b : column.blocks) {
+            uint8_t blockCodec = codec, pad;
+            ok = ok && get(directory, cursor, b.offset) && get(directory, cursor, b.rawBytes) &&
+                 get(directory, cursor, b.storedBytes);
+            if (ok && version >= 2) {
+                ok = get(directory, cursor, blockCodec);
+                for (int i = 0; i < 3 && ok; i++) ok = get(directory, cursor, pad);
+            }
+            b.codec = (SnapshotCodec)blockCodec;
+        }
+    }
+    if (!ok) {
+        std::cerr << "Corrupt snapshot directory in " << path << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool SnapshotReader::decodeBlock(size_t block, uint64_t first, uint64_t last, Star* out) const {
+    const uint64_t blockFirst = block * SNAPSHOT_BLOCK_ELEMENTS;
+    const size_t count = (size_t)std::min<uint64_t>(SNAPSHOT_BLOCK_ELEMENTS, fileInfo.count - blockFirst);
+    
+    // Decode in place when the whole block is wanted, else via a temporary
+    std::vector<Star> partial;
+    Star* target = out + (blockFirst - first);
+    bool whole = blockFirst >= first && blockFirst + count <= last;
+    if (!whole) {
+        partial.assign(count, Star());
+        target = partial.data();
+    }
+    
+    std::vector<unsigned char> stored, raw, unshuffled, scratch;
+    std::vector<int64_t> q;
+    std::vector<uint32_t> order;
+    double origin, step;
+    
+    if (orderColumn >= 0 && block < columns[orderColumn].blocks.size()) {
+        const Block& b = columns[orderColumn].blocks[block];
+        stored.resize(b.storedBytes);
+        if (!readExact(fd, stored.data(), stored.size(), b.offset) ||
+            !decodeIntegers(stored.data(), stored.size(), count, scratch, q, origin, step))
+            return false;
+        order.resize(count);
+        for (size_t k = 0; k < count; k++) {
+            if (q[k] < 0 || (size_t)q[k] >= count) return false;
+            order[k] = (uint32_t)q[k];
+        }
+    }
+    
+    for (const Column& column : columns) {
+        if (column.field < 0 || block >= column.blocks.size()) continue;
+        const ColumnDesc& desc = COLUMNS[column.field];
+        const Block& b = column.blocks[block];
+        if (b.rawBytes != count * column.elementSize) return false;
+        
+        stored.resize(b.storedBytes);
+        if (!readExact(fd, stored.data(), stored.size(), b.offset)) return false;
+        
+        if (b.codec == SnapshotCodec::Quantized) {
+            if (order.size() != count || desc.type != COLUMN_FLOAT32 ||
+                !decodeIntegers(stored.data(), stored.size(), count, scratch, q, origin, step))
+                return false;
+            for (size_t k = 0; k < count; k++) {
+                float value = (float)(origin + (double)q[k] * step);
+                std::memcpy(reinterpret_cast<unsigned char*>(&target[order[k]]) + desc.offset, &value, 4);
+            }
+            continue;
+        }
+        
+        raw.resize(b.rawBytes);
+        if (!decompressBlock(b.codec, stored.data(), stored.size(), raw.data(), raw.size())) return false;
+        const unsigned char* source = raw.data();
+        if (column.shuffled) {
+            unshuffled.resize(raw.size());
+            unshuffleBytes(raw.data(), unshuffled.data(), count, column.elementSize);
+            source = unshuffled.data();
+        }
+        scatterColumn(desc, source, count, target);
+    }
+    if (!hasSpecies) assignDefaultSpecies(target, count);
+    
+    if (!whole) {
+        uint64_t from = std::max(first, blockFirst);
+        uint64_t to = std::min(last, blockFirst + count);
+        std::copy(partial.begin() + (from - blockFirst), partial.begin() + (to - blockFirst), out + (from - first));
+    }
+    return true;
+}
+
+bool SnapshotReader::read(uint64_t first, uint64_t count, Star* out) const {
+    if (fd < 0 || first + count > fileInfo.count) return false;
+    if (count == 0) return true;
+    
+    const uint64_t last = first + count;
+    const size_t firstBlock = first / SNAPSHOT_BLOCK_ELEMENTS;
+    const size_t lastBlock = (last - 1) / SNAPSHOT_BLOCK_ELEMENTS;
+    
+    std::atomic<bool> ok(true);
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t block = firstBlock; block <= lastBlock; block++) {
+        if (!decodeBlock(block, first, last, out)) ok = false;
+    }
+    if (!ok) std::cerr << "Corrupt or truncated snapshot " << path << std::endl;
+    return ok;
+}
+
+bool readSnapshot(const std::string& path, std::vector<Star>& stars, SnapshotInfo* info) {
+    SnapshotReader reader;
+    if (!reader.open(path)) return false;
+    
+    stars.assign(reader.info().count, Star());
+    if (!reader.read(0, reader.info().count, stars.data())) return false;
+    if (info) *info = reader.info();
+    return true;
+}
+
+// Background writer
+
+SnapshotWriter::SnapshotWriter(const std::string& directory, const SnapshotOptions& options) {
+    std::error_code ec;
+    fs::create_directories(directory, ec);
+    sink = [directory, options](const std::vector<Star>& stars, uint64_t step, double time) {
+        char name[64];
+        snprintf(name, sizeof(name), "snapshot_%010llu.gsnap", (unsigned long long)step);
+        return writeSnapshot((fs::path(directory) / name).string(), stars, step, time, options);
+    };
+    worker = std::thread(&SnapshotWriter::run, this);
+}
+
+SnapshotWriter::SnapshotWriter(SnapshotSink sink) : sink(sink) {
+    worker = std::thread(&SnapshotWriter::run, this);
+}
+
+SnapshotWriter::~SnapshotWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    bufferQueued.notify_all();
+    worker.join();
+}
+
+void SnapshotWriter::submit(const std::vector<Star>& stars, uint64_t step, double time) {
+    auto start = std::chrono::steady_clock::now();
+    Buffer& buffer = buffers[nextBuffer];
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        bufferWritten.wait(lock, [&] { return !buffer.queued; });
+    }
+    
+    // The worker never touches an unqueued buffer, so copy without the lock
+    buffer.stars.resize(stars.size());
+    #pragma omp parallel for
+    for (size_t i = 0; i < stars.size(); i++) {
+        buffer.stars[i] = stars[i];
+    }
+    buffer.step = step;
+    buffer.time = time;
+    
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        buffer.queued = true;
+    }
+    bufferQueued.notify_one();
+    nextBuffer = 1 - nextBuffer;
+    
+    submitTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void SnapshotWriter::flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    bufferWritten.wait(lock, [this] { return !buffers[0].queued && !buffers[1].queued; });
+}
+
+size_t SnapshotWriter::snapshotsWritten() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return written;
+}
+
+void SnapshotWriter::run() {
+    // Buffers are submitted alternately, so writing them alternately keeps order
+    int current = 0;
+    for (;;) {
+        Buffer& buffer = buffers[current];
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            bufferQueued.wait(lock, [&] { return buffer.queued || stopping; });
+            if (!buffer.queued) return;
+        }
+        
+        bool ok = sink(buffer.stars, buffer.step, buffer.time);
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            buffer.queued = false;
+            if (ok) written++;
+        }
+        bufferWritten.notify_all();
+        current = 1 - current;
+    }
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "star.h"
+
+// Snapshot file layout, all little-endian:
+//
+//   Header     "GALSNAP\0", u32 version, u32 reserved, u64 count, u64 step, f64 time
+//   Blocks     compressed column data, each block independently decodable
+//   Directory  u32 columnCount, then per column:
+//                char name[16], u8 type, u8 elementSize, u8 codec, u8 shuffled,
+//                u32 blockCount, then per block:
+//                  u64 offset, u32 rawBytes, u32 storedBytes, u8 codec, u8 reserved[3]
+//   Trailer    u64 directoryOffset, "GALSNAPE"
+//
+// Columns are the Star fields split per component (pos_x, pos_y, ...), so
+// each compresses as a homogeneous array. Block b of every column covers the
+// same range of stars, [b * SNAPSHOT_BLOCK_ELEMENTS, ...), so any range can
+// be decoded without touching the rest of the file. Float columns are
+// byte-shuffled before lossless compression, and a losslessly coded block
+// whose storedBytes equals rawBytes is stored uncompressed.
+//
+// With a tolerance set, position and velocity blocks use the Quantized
+// codec: within each block, stars are visited in Morton order of their
+// positions, each value is quantized to a step just under 2 * tolerance, and the
+// deltas between consecutive quantized values are entropy coded. The
+// visiting order is stored losslessly in an extra "order" column, so
+// decoding restores the original star order exactly.
+//
+// Version 1 files have no per-block codec byte; the column codec applies.
+
+enum class SnapshotCodec : uint8_t {
+    None = 0,
+    Zlib = 1,
+    Zstd = 2,
+    Quantized = 3 // Lossy, error-bounded; entropy stage uses the lossless codec
+};
+
+const size_t SNAPSHOT_BLOCK_ELEMENTS = 1 << 20;
+
+// Best lossless codec this build supports
+SnapshotCodec defaultSnapshotCodec();
+
+struct SnapshotOptions {
+    SnapshotCodec codec = defaultSnapshotCodec(); // Lossless codec
+    
+    // Maximum absolute error per component; 0 keeps the field lossless
+    float positionTolerance = 0.0f;
+    float velocityTolerance = 0.0f;
+    
+    int threads = 2; // Blocks encoded concurrently
+};
+
+struct SnapshotInfo {
+    uint64_t count = 0;
+    uint64_t step = 0;
+    double time = 0.0;
+};
+
+// Synchronous write, also used by the background writer. The file appears
+// atomically under path once complete.
+bool writeSnapshot(const std::string& path, const std::vector<Star>& stars,
+                   uint64_t step, double time, const SnapshotOptions& options);
+
+// Random access into a snapshot: only the blocks overlapping a requested
+// range are read and decoded
+class SnapshotReader {
+public:
+    SnapshotReader() = default;
+    ~SnapshotReader();
+    
+    SnapshotReader(const SnapshotReader&) = delete;
+    SnapshotReader& operator=(const SnapshotReader&) = delete;
+    
+    bool open(const std::string& path);
+    void close();
+    
+    const SnapshotInfo& info() const { return fileInfo; }
+    
+    // Decodes stars [first, first + count) into out, in parallel per block
+    bool read(uint64_t first, uint64_t count, Star* out) const;
+    
+private:
+    struct Block {
+        uint64_t offset;
+        uint32_t rawBytes;
+        uint32_t storedBytes;
+        SnapshotCodec codec;
+    };
+    
+    struct Column {
+        int field; // Index into the known Star fields, -1 if unknown
+        bool shuffled;
+        uint8_t elementSize;
+        std::vector<Block> blocks;
+    };
+    
+    bool decodeBlock(size_t block, uint64_t first, uint64_t last, Star* out) const;
+    
+    std::string path;
+    int fd = -1;
+    SnapshotInfo fileInfo;
+    std::vector<Column> columns;
+    int orderColumn = -1;
+    bool hasSpecies = false; // Older files have no species column
+};
+
+bool readSnapshot(const std::string& path, std::vector<Star>& stars, SnapshotInfo* info = NULL);
+
+// Called on the writer thread with each submitted state; false on failure
+using SnapshotSink = std::function<bool(const std::vector<Star>& stars, uint64_t step, double time)>;
+
+// Writes snapshots without pausing the integrator. submit() copies the
+// current state into one of two back buffers and returns; a background
+// thread splits it into columns, compresses and writes it sequentially.
+// submit() only blocks if both buffers are still being written. Keep
+// options.threads small: they compete with the integrator for cores.
+class SnapshotWriter {
+public:
+    // One snapshot_<step>.gsnap file per submitted state
+    SnapshotWriter(const std::string& directory, const SnapshotOptions& options);
+    // Any other destination, such as a TrajectoryWriter
+    explicit SnapshotWriter(SnapshotSink sink);
+    ~SnapshotWriter();
+    
+    SnapshotWriter(const SnapshotWriter&) = delete;
+    SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+    
+    void submit(const std::vector<Star>& stars, uint64_t step, double time);
+    
+    // Blocks until every submitted snapshot is on disk
+    void flush();
+    
+    // Time submit() spent copying or waiting, for overhead reporting
+    double submitSeconds() const { return submitTime; }
+    size_t snapshotsWritten() const;
+    
+private:
+    struct Buffer {
+        std::vector<Star> stars;
+        uint64_t step = 0;
+        double time = 0.0;
+        bool queued = false;
+    };
+    
+    void run();
+    
+    SnapshotSink sink;
+    Buffer buffers[2];
+    int nextBuffer = 0;
+    
+    mutable std::mutex mutex;
+    std::condition_variable bufferQueued;
+    std::condition_variable bufferWritten;
+    bool stopping = false;
+    size_t written = 0;
+    double submitTime = 0.0;
+    
+    std::thread worker;
+};
@@ -0,0 +1,200 @@
+#include "snapshot_columns.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef GALAXY_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+const ColumnDesc COLUMNS[] = {
+    {"pos_x", COLUMN_FLOAT32, 4, offsetof(Star, position) + 0},
+    {"pos_y", COLUMN_FLOAT32, 4, offsetof(Star, position) + 4},
+    {"pos_z", COLUMN_FLOAT32, 4, offsetof(Star, position) + 8},
+    {"vel_x", COLUMN_FLOAT32, 4, offsetof(Star, velocity) + 0},
+    {"vel_y", COLUMN_FLOAT32, 4, offsetof(Star, velocity) + 4},
+    {"vel_z", COLUMN_FLOAT32, 4, offsetof(Star, velocity) + 8},
+    {"mass", COLUMN_FLOAT32, 4, offsetof(Star, mass)},
+    {"size", COLUMN_FLOAT32, 4, offsetof(Star, size)},
+    {"black_hole", COLUMN_UINT8, 1, offsetof(Star, isBlackHole)},
+    {"species", COLUMN_UINT8, 1, offsetof(Star, species)},
+};
+const size_t COLUMN_COUNT = sizeof(COLUMNS) / sizeof(COLUMNS[0]);
+
+int findColumn(const char* name, uint8_t type, uint8_t elementSize) {
+    for (size_t f = 0; f < COLUMN_COUNT; f++) {
+        if (std::strcmp(COLUMNS[f].name, name) == 0 && COLUMNS[f].type == type &&
+            COLUMNS[f].elementSize == elementSize) return (int)f;
+    }
+    return -1;
+}
+
+void assignDefaultSpecies(Star* stars, size_t count) {
+    for (size_t i = 0; i < count; i++) stars[i].species = stars[i].isBlackHole ? SPECIES_BLACK_HOLE : SPECIES_DISK;
+}
+
+// Column <-> Star record conversion
+
+void gatherColumn(const ColumnDesc& column, const Star* stars, size_t count, unsigned char* out) {
+    for (size_t i = 0; i < count; i++) {
+        std::memcpy(out + i * column.elementSize,
+                    reinterpret_cast<const unsigned char*>(&stars[i]) + column.offset, column.elementSize);
+    }
+}
+
+void scatterColumn(const ColumnDesc& column, const unsigned char* in, size_t count, Star* stars) {
+    for (size_t i = 0; i < count; i++) {
+        std::memcpy(reinterpret_cast<unsigned char*>(&stars[i]) + column.offset,
+                    in + i * column.elementSize, column.elementSize);
+    }
+}
+
+void shuffleBytes(const unsigned char* in, unsigned char* out, size_t count, size_t typeSize) {
+    for (size_t i = 0; i < count; i++) {
+        for (size_t b = 0; b < typeSize; b++) {
+            out[b * count + i] = in[i * typeSize + b];
+        }
+    }
+}
+
+void unshuffleBytes(const unsigned char* in, unsigned char* out, size_t count, size_t typeSize) {
+    for (size_t i = 0; i < count; i++) {
+        for (size_t b = 0; b < typeSize; b++) {
+            out[i * typeSize + b] = in[b * count + i];
+        }
+    }
+}
+
+// Block codecs
+
+size_t maxCompressedSize(SnapshotCodec codec, size_t rawBytes) {
+    switch (codec) {
+        case SnapshotCodec::Zlib: return compressBound((uLong)rawBytes);
+#ifdef GALAXY_HAVE_ZSTD
+        case SnapshotCodec::Zstd: return ZSTD_compressBound(rawBytes);
+#endif
+        default: return rawBytes;
+    }
+}
+
+size_t compressBlock(SnapshotCodec codec, const unsigned char* in, size_t rawBytes,
+                     unsigned char* out, size_t capacity) {
+    size_t stored = 0;
+    switch (codec) {
+        case SnapshotCodec::Zlib: {
+            uLongf length = (uLongf)capacity;
+            if (compress2(out, &length, in, (uLong)rawBytes, 1) == Z_OK) stored = length;
+            break;
+        }
+#ifdef GALAXY_HAVE_ZSTD
+        case SnapshotCodec::Zstd: {
+            size_t length = ZSTD_compress(out, capacity, in, rawBytes, 1);
+            if (!ZSTD_isError(length)) stored = length;
+            break;
+        }
+#endif
+        default:
+            break;
+    }
+    return stored < rawBytes ? stored : 0;
+}
+
+bool decompressBlock(SnapshotCodec codec, const unsigned char* in, size_t storedBytes,
+                     unsigned char* out, size_t rawBytes) {
+    if (storedBytes == rawBytes) {
+        std::memcpy(out, in, rawBytes);
+        return true;
+    }
+    switch (codec) {
+        case SnapshotCodec::Zlib: {
+            uLongf length = (uLongf)rawBytes;
+            return uncompress(out, &length, in, (uLong)storedBytes) == Z_OK && length == rawBytes;
+        }
+#ifdef GALAXY_HAVE_ZSTD
+        case SnapshotCodec::Zstd:
+            return ZSTD_decompress(out, rawBytes, in, storedBytes) == rawBytes;
+#endif
+        default:
+            return false;
+    }
+}
+
+bool readExact(int fd, void* out, size_t bytes, uint64_t offset) {
+    unsigned char* dst = static_cast<unsigned char*>(out);
+    while (bytes > 0) {
+        ssize_t n = pread(fd, dst, bytes, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        dst += n;
+        bytes -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return true;
+}
+
+// SequentialFile
+
+SequentialFile::~SequentialFile() {
+    if (fd >= 0) ::close(fd);
+    std::free(buffer);
+}
+
+bool SequentialFile::open(const std::string& path) {
+    if (posix_memalign(reinterpret_cast<void**>(&buffer), ALIGNMENT, BUFFER_BYTES) != 0) {
+        buffer = NULL;
+        return false;
+    }
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (fd < 0) {
+        // tmpfs and some network filesystems reject O_DIRECT
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    return fd >= 0;
+}
+
+bool SequentialFile::append(const void* data, size_t bytes) {
+    const unsigned char* src = static_cast<const unsigned char*>(data);
+    while (bytes > 0) {
+        size_t n = std::min(bytes, BUFFER_BYTES - used);
+        std::memcpy(buffer + used, src, n);
+        used += n;
+        src += n;
+        bytes -= n;
+        if (used == BUFFER_BYTES && !writeBuffer(BUFFER_BYTES)) return false;
+    }
+    return true;
+}
+
+bool SequentialFile::close() {
+    uint64_t size = offset();
+    bool ok = true;
+    if (used > 0) {
+        // O_DIRECT needs whole aligned blocks; pad, then trim the file
+        size_t padded = (used + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        std::memset(buffer + used, 0, padded - used);
+        ok = writeBuffer(padded) && ftruncate(fd, (off_t)size) == 0;
+    }
+    ok = ::close(fd) == 0 && ok;
+    fd = -1;
+    return ok;
+}
+
+bool SequentialFile::writeBuffer(size_t bytes) {
+    size_t done = 0;
+    while (done < bytes) {
+        ssize_t n = ::write(fd, buffer + done, bytes - done);
+        if (n < 0 && errno == EINVAL) {
+            // Alignment rules not met on this filesystem; drop O_DIRECT
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += (size_t)n;
+    }
+    flushed += std::min(bytes, used);
+    used = 0;
+    return true;
+}
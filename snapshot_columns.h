@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "snapshot.h"
+
+// Column encoding shared by snapshot and trajectory files
+
+enum ColumnType : uint8_t {
+    COLUMN_FLOAT32 = 0,
+    COLUMN_UINT8 = 1,
+    COLUMN_UINT32 = 2
+};
+
+struct ColumnDesc {
+    const char* name;
+    ColumnType type;
+    uint8_t elementSize;
+    size_t offset; // Byte offset of the field within Star
+};
+
+// Star fields in file order: positions, velocities, then the attributes
+extern const ColumnDesc COLUMNS[];
+extern const size_t COLUMN_COUNT;
+
+// Location of one encoded block of a column
+struct BlockRange {
+    uint64_t offset;
+    uint32_t rawBytes;
+    uint32_t storedBytes;
+};
+
+// Index into COLUMNS of a field by name, element type and size; -1 if
+// unknown or stored as something this build would not write
+int findColumn(const char* name, uint8_t type, uint8_t elementSize);
+
+// Files written before stars had a species have no species column. Their
+// black holes get SPECIES_BLACK_HOLE and all other stars SPECIES_DISK, as
+// generateGalaxy makes them.
+void assignDefaultSpecies(Star* stars, size_t count);
+
+// Column <-> Star record conversion
+void gatherColumn(const ColumnDesc& column, const Star* stars, size_t count, unsigned char* out);
+void scatterColumn(const ColumnDesc& column, const unsigned char* in, size_t count, Star* stars);
+
+// Group byte k of every element together; exponents and high mantissa bytes
+// of neighbouring floats are similar, so the planes compress much better
+void shuffleBytes(const unsigned char* in, unsigned char* out, size_t count, size_t typeSize);
+void unshuffleBytes(const unsigned char* in, unsigned char* out, size_t count, size_t typeSize);
+
+// Lossless block codecs
+size_t maxCompressedSize(SnapshotCodec codec, size_t rawBytes);
+// Returns the compressed size, or 0 if the block should be stored raw
+size_t compressBlock(SnapshotCodec codec, const unsigned char* in, size_t rawBytes,
+                     unsigned char* out, size_t capacity);
+// A block whose storedBytes equals rawBytes is taken as raw
+bool decompressBlock(SnapshotCodec codec, const unsigned char* in, size_t storedBytes,
+                     unsigned char* out, size_t rawBytes);
+
+// pread() exactly bytes, retrying short reads
+bool readExact(int fd, void* out, size_t bytes, uint64_t offset);
+
+template <class T>
+void put(std::vector<unsigned char>& out, const T& value) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(&value);
+    out.insert(out.end(), p, p + sizeof(T));
+}
+
+template <class T>
+bool get(const unsigned char* in, size_t size, size_t& cursor, T& value) {
+    if (cursor + sizeof(T) > size) return false;
+    std::memcpy(&value, in + cursor, sizeof(T));
+    cursor += sizeof(T);
+    return true;
+}
+
+template <class T>
+bool get(const std::vector<unsigned char>& in, size_t& cursor, T& value) {
+    return get(in.data(), in.size(), cursor, value);
+}
+
+// Sequential writer that bypasses the page cache with O_DIRECT where the
+// filesystem allows it, so multi-GB files don't evict the working set.
+// Data is staged in an aligned buffer and written in large aligned chunks.
+class SequentialFile {
+public:
+    static const size_t ALIGNMENT = 4096;
+    static const size_t BUFFER_BYTES = 8 << 20;
+    
+    SequentialFile() = default;
+    ~SequentialFile();
+    
+    SequentialFile(const SequentialFile&) = delete;
+    SequentialFile& operator=(const SequentialFile&) = delete;
+    
+    bool open(const std::string& path);
+    bool isOpen() const { return fd >= 0; }
+    uint64_t offset() const { return flushed + used; }
+    bool append(const void* data, size_t bytes);
+    bool close();
+    
+private:
+    bool writeBuffer(size_t bytes);
+    
+    int fd = -1;
+    unsigned char* buffer = NULL;
+    size_t used = 0;
+    uint64_t flushed = 0;
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// Particle species, numbered like GADGET particle types
+enum StarSpecies : uint8_t {
+    SPECIES_GAS = 0,
+    SPECIES_HALO = 1,
+    SPECIES_DISK = 2,
+    SPECIES_BULGE = 3,
+    SPECIES_STAR = 4,
+    SPECIES_BLACK_HOLE = 5,
+    SPECIES_COUNT = 6
+};
+
+struct Star {
+    glm::vec3 position;
+    glm::vec3 velocity;
+    float mass;
+    float size;
+    bool isBlackHole;
+    uint8_t species;
+};
+
+const float BLACK_HOLE_DISPLAY_SIZE = 20.0f;
+
+// Visual size for a particle of the given mass in solar masses
+inline float starDisplaySize(float mass) {
+    return 2.0f + mass * 0.5f;
+}
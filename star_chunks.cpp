@@ -0,0 +1,77 @@
+#include "star_chunks.h"
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <utility>
+
+Frustum Frustum::fromMatrix(const glm::mat4& m) {
+    // Gribb/Hartmann plane extraction; glm is column-major so row i is m[*][i]
+    glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+    
+    Frustum f;
+    f.planes[0] = row3 + row0; // Left
+    f.planes[1] = row3 - row0; // Right
+    f.planes[2] = row3 + row1; // Bottom
+    f.planes[3] = row3 - row1; // Top
+    f.planes[4] = row3 + row2; // Near
+    f.planes[5] = row3 - row2; // Far
+    return f;
+}
+
+bool Frustum::intersects(const glm::vec3& min, const glm::vec3& max) const {
+    for (const glm::vec4& p : planes) {
+        // Corner of the box furthest along the plane normal
+        glm::vec3 v(p.x >= 0.0f ? max.x : min.x,
+                    p.y >= 0.0f ? max.y : min.y,
+                    p.z >= 0.0f ? max.z : min.z);
+        if (p.x * v.x + p.y * v.y + p.z * v.z + p.w < 0.0f) return false;
+    }
+    return true;
+}
+
+void computeChunkBounds(const std::vector<Star>& stars, std::vector<StarChunk>& chunks, float ahead) {
+    size_t chunkCount = (stars.size() + STAR_CHUNK_SIZE - 1) / STAR_CHUNK_SIZE;
+    chunks.resize(chunkCount);
+    
+    #pragma omp parallel for
+    for (size_t c = 0; c < chunkCount; c++) {
+        size_t begin = c * STAR_CHUNK_SIZE;
+        size_t end = std::min(begin + STAR_CHUNK_SIZE, stars.size());
+        glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+        for (size_t i = begin; i < end; i++) {
+            glm::vec3 p = stars[i].position + stars[i].velocity * ahead;
+            lo = glm::min(lo, p);
+            hi = glm::max(hi, p);
+        }
+        chunks[c].min = lo;
+        chunks[c].max = hi;
+    }
+}
+
+float meanChunkExtent(const std::vector<StarChunk>& chunks) {
+    if (chunks.empty()) return 0.0f;
+    double total = 0.0;
+    for (const StarChunk& chunk : chunks) total += glm::length(chunk.max - chunk.min);
+    return (float)(total / chunks.size());
+}
+
+void cullChunks(const std::vector<StarChunk>& chunks, size_t starCount, const Frustum& frustum,
+                std::vector<GLint>& firsts, std::vector<GLsizei>& counts) {
+    firsts.clear();
+    counts.clear();
+    for (size_t c = 0; c < chunks.size(); c++) {
+        if (!frustum.intersects(chunks[c].min, chunks[c].max)) continue;
+        
+        GLint begin = (GLint)(c * STAR_CHUNK_SIZE);
+        GLsizei count = (GLsizei)(std::min((c + 1) * STAR_CHUNK_SIZE, starCount) - begin);
+        if (!firsts.empty() && firsts.back() + counts.back() == begin) {
+            counts.back() += count;
+        } else {
+            firsts.push_back(begin);
+            counts.push_back(count);
+        }
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include "star.h"
+
+// Stars are drawn in fixed-size chunks of consecutive indices. After a
+// spatial sort, each chunk covers a compact region, so whole chunks can be
+// rejected per view without touching the vertex stream.
+const size_t STAR_CHUNK_SIZE = 4096;
+
+struct StarChunk {
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+struct Frustum {
+    glm::vec4 planes[6]; // Inward-facing, (normal, distance)
+    
+    static Frustum fromMatrix(const glm::mat4& viewProjection);
+    bool intersects(const glm::vec3& min, const glm::vec3& max) const;
+};
+
+// Bounds of the stars as drawn, ahead years along their velocities
+void computeChunkBounds(const std::vector<Star>& stars, std::vector<StarChunk>& chunks, float ahead = 0.0f);
+
+// Mean diagonal of the chunk boxes. It grows as stars drift out of the
+// order they were sorted in, and culling gets worse with it.
+float meanChunkExtent(const std::vector<StarChunk>& chunks);
+
+// Visible index ranges for glMultiDrawArrays; adjacent chunks are merged
+void cullChunks(const std::vector<StarChunk>& chunks, size_t starCount, const Frustum& frustum,
+                std::vector<GLint>& firsts, std::vector<GLsizei>& counts);
@@ -0,0 +1,147 @@
+#include "star_vertex.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cfloat>
+
+static const float SUN_TEMPERATURE = 5772.0f; // Kelvin
+
+size_t positionStride(PositionFormat format) {
+    switch (format) {
+        case PositionFormat::Float32: return 3 * sizeof(float);
+        case PositionFormat::Unorm16: return 3 * sizeof(uint16_t);
+        case PositionFormat::Unorm10: return sizeof(uint32_t);
+    }
+    return 0;
+}
+
+float starTemperature(float mass) {
+    return SUN_TEMPERATURE * std::pow(mass, 0.475f);
+}
+
+// Tanner Helland's fit, valid for 1000K - 40000K
+glm::vec3 blackbodyColor(float kelvin) {
+    float t = std::clamp(kelvin, 1000.0f, 40000.0f) / 100.0f;
+    float r, g, b;
+    if (t <= 66.0f) {
+        r = 255.0f;
+        g = 99.4708025861f * std::log(t) - 161.1195681661f;
+    } else {
+        r = 329.698727446f * std::pow(t - 60.0f, -0.1332047592f);
+        g = 288.1221695283f * std::pow(t - 60.0f, -0.0755148492f);
+    }
+    if (t >= 66.0f)
+        b = 255.0f;
+    else if (t <= 19.0f)
+        b = 0.0f;
+    else
+        b = 138.5177312231f * std::log(t - 10.0f) - 305.0447927307f;
+    return glm::clamp(glm::vec3(r, g, b) / 255.0f, 0.0f, 1.0f);
+}
+
+static GLubyte toUnorm8(float v) {
+    return (GLubyte)std::lround(std::clamp(v, 0.0f, 1.0f) * 255.0f);
+}
+
+std::vector<StarAttributes> buildStarAttributes(const std::vector<Star>& stars) {
+    std::vector<StarAttributes> attributes(stars.size());
+    #pragma omp parallel for
+    for (size_t i = 0; i < stars.size(); i++) {
+        // The black hole has no photosphere; draw it as a dim red glow
+        glm::vec3 color = stars[i].isBlackHole
+            ? glm::vec3(0.4f, 0.1f, 0.05f)
+            : blackbodyColor(starTemperature(stars[i].mass));
+        attributes[i].color[0] = toUnorm8(color.r);
+        attributes[i].color[1] = toUnorm8(color.g);
+        attributes[i].color[2] = toUnorm8(color.b);
+        attributes[i].size = toUnorm8(stars[i].size / MAX_STAR_SIZE);
+    }
+    return attributes;
+}
+
+PositionBox computePositionBox(const std::vector<Star>& stars, PositionFormat format,
+                               const glm::vec3& viewCenter, float viewRadius, float ahead) {
+    PositionBox box;
+    if (format == PositionFormat::Float32) return box;
+    
+    float minX = FLT_MAX, minY = FLT_MAX, minZ = FLT_MAX;
+    float maxX = -FLT_MAX, maxY = -FLT_MAX, maxZ = -FLT_MAX;
+    #pragma omp parallel for reduction(min:minX,minY,minZ) reduction(max:maxX,maxY,maxZ)
+    for (size_t i = 0; i < stars.size(); i++) {
+        glm::vec3 p = stars[i].position + stars[i].velocity * ahead;
+        minX = std::min(minX, p.x); maxX = std::max(maxX, p.x);
+        minY = std::min(minY, p.y); maxY = std::max(maxY, p.y);
+        minZ = std::min(minZ, p.z); maxZ = std::max(maxZ, p.z);
+    }
+    
+    // Spend precision only where stars can actually be seen
+    glm::vec3 lo = glm::max(glm::vec3(minX, minY, minZ), viewCenter - glm::vec3(viewRadius));
+    glm::vec3 hi = glm::min(glm::vec3(maxX, maxY, maxZ), viewCenter + glm::vec3(viewRadius));
+    box.origin = lo;
+    box.scale = glm::max(hi - lo, glm::vec3(1e-3f));
+    return box;
+}
+
+void encodePositions(const std::vector<Star>& stars, PositionFormat format,
+                     const PositionBox& box, void* out, float ahead) {
+    const glm::vec3 invScale = 1.0f / box.scale;
+    switch (format) {
+        case PositionFormat::Float32: {
+            glm::vec3* dst = static_cast<glm::vec3*>(out);
+            #pragma omp parallel for
+            for (size_t i = 0; i < stars.size(); i++) {
+                dst[i] = stars[i].position + stars[i].velocity * ahead;
+            }
+            break;
+        }
+        case PositionFormat::Unorm16: {
+            uint16_t* dst = static_cast<uint16_t*>(out);
+            #pragma omp parallel for
+            for (size_t i = 0; i < stars.size(); i++) {
+                glm::vec3 n = glm::clamp((stars[i].position + stars[i].velocity * ahead - box.origin) * invScale, 0.0f, 1.0f);
+                dst[3 * i + 0] = (uint16_t)(n.x * 65535.0f + 0.5f);
+                dst[3 * i + 1] = (uint16_t)(n.y * 65535.0f + 0.5f);
+                dst[3 * i + 2] = (uint16_t)(n.z * 65535.0f + 0.5f);
+            }
+            break;
+        }
+        case PositionFormat::Unorm10: {
+            uint32_t* dst = static_cast<uint32_t*>(out);
+            #pragma omp parallel for
+            for (size_t i = 0; i < stars.size(); i++) {
+                glm::vec3 n = glm::clamp((stars[i].position + stars[i].velocity * ahead - box.origin) * invScale, 0.0f, 1.0f);
+                uint32_t x = (uint32_t)(n.x * 1023.0f + 0.5f);
+                uint32_t y = (uint32_t)(n.y * 1023.0f + 0.5f);
+                uint32_t z = (uint32_t)(n.z * 1023.0f + 0.5f);
+                dst[i] = x | (y << 10) | (z << 20); // _REV: x in the low bits
+            }
+            break;
+        }
+    }
+}
+
+void setupPositionAttribute(GLuint index, PositionFormat format) {
+    GLsizei stride = (GLsizei)positionStride(format);
+    switch (format) {
+        case PositionFormat::Float32:
+            glVertexAttribPointer(index, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+            break;
+        case PositionFormat::Unorm16:
+            glVertexAttribPointer(index, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)0);
+            break;
+        case PositionFormat::Unorm10:
+            glVertexAttribPointer(index, 4, GL_UNSIGNED_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)0);
+            break;
+    }
+    glEnableVertexAttribArray(index);
+}
+
+void setupStarAttributes(GLuint sizeIndex, GLuint colorIndex) {
+    glVertexAttribPointer(sizeIndex, 1, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(StarAttributes),
+                          (void*)offsetof(StarAttributes, size));
+    glEnableVertexAttribArray(sizeIndex);
+    
+    glVertexAttribPointer(colorIndex, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(StarAttributes),
+                          (void*)offsetof(StarAttributes, color));
+    glEnableVertexAttribArray(colorIndex);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstddef>
+#include "star.h"
+
+// Largest point size representable in the packed static attributes
+const float MAX_STAR_SIZE = 32.0f;
+
+// Static per-star vertex attributes, uploaded once. Positions are streamed
+// separately every frame so these never add to the per-frame upload.
+struct StarAttributes {
+    GLubyte color[3]; // RGB8, normalized in the vertex fetch
+    GLubyte size;     // Fraction of MAX_STAR_SIZE
+};
+static_assert(sizeof(StarAttributes) == 4, "StarAttributes must pack into 4 bytes");
+
+// Encodings of the per-frame position stream
+enum class PositionFormat {
+    Float32, // 12 bytes/star, exact
+    Unorm16, // 6 bytes/star, 16-bit normalized within the stream box
+    Unorm10  // 4 bytes/star, 10:10:10:2 normalized within the stream box
+};
+
+// Quantization box: world = origin + decoded * scale, decoded in [0, 1]
+struct PositionBox {
+    glm::vec3 origin = glm::vec3(0.0f);
+    glm::vec3 scale = glm::vec3(1.0f);
+};
+
+size_t positionStride(PositionFormat format);
+
+// Main-sequence effective temperature from mass (L ~ M^3.5, R ~ M^0.8)
+float starTemperature(float mass);
+
+// Approximate sRGB colour of a blackbody at the given temperature
+glm::vec3 blackbodyColor(float kelvin);
+
+std::vector<StarAttributes> buildStarAttributes(const std::vector<Star>& stars);
+
+// Bounds of the stars clipped to a cube of half-extent viewRadius around
+// viewCenter. Stars outside that cube are clamped onto its faces, so
+// viewRadius must put them beyond the far plane.
+PositionBox computePositionBox(const std::vector<Star>& stars, PositionFormat format,
+                               const glm::vec3& viewCenter, float viewRadius, float ahead = 0.0f);
+
+// Writes stars.size() * positionStride(format) bytes to out. Each star is
+// drawn where its velocity takes it after ahead years, which keeps motion
+// smooth between steps.
+void encodePositions(const std::vector<Star>& stars, PositionFormat format,
+                     const PositionBox& box, void* out, float ahead = 0.0f);
+
+// Vertex attribute setup for the currently bound GL_ARRAY_BUFFER
+void setupPositionAttribute(GLuint index, PositionFormat format);
+void setupStarAttributes(GLuint sizeIndex, GLuint colorIndex);
@@ -0,0 +1,100 @@
+#include "state_publisher.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+
+// Frames are copied as raw Star records, so the C layout must match
+static_assert(sizeof(galaxy_shm_star) == sizeof(Star), "galaxy_shm_star must mirror Star");
+static_assert(offsetof(galaxy_shm_star, velocity) == offsetof(Star, velocity), "galaxy_shm_star must mirror Star");
+static_assert(offsetof(galaxy_shm_star, mass) == offsetof(Star, mass), "galaxy_shm_star must mirror Star");
+static_assert(offsetof(galaxy_shm_star, size) == offsetof(Star, size), "galaxy_shm_star must mirror Star");
+static_assert(offsetof(galaxy_shm_star, black_hole) == offsetof(Star, isBlackHole), "galaxy_shm_star must mirror Star");
+static_assert(offsetof(galaxy_shm_star, species) == offsetof(Star, species), "galaxy_shm_star must mirror Star");
+
+static const size_t COPY_CHUNK_BYTES = 1 << 20;
+
+StatePublisher::~StatePublisher() {
+    close();
+}
+
+bool StatePublisher::open(const std::string& segmentName, uint64_t capacity) {
+    close();
+    name = segmentName;
+    bytes = (size_t)galaxy_shm_segment_bytes(capacity);
+    
+    // A crashed run may have left a segment behind; readers still holding
+    // it keep their mapping
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        std::cerr << "Failed to create shared memory " << name << std::endl;
+        return false;
+    }
+    void* map = MAP_FAILED;
+    if (ftruncate(fd, (off_t)bytes) == 0) {
+        map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        std::cerr << "Failed to map shared memory " << name << " (" << bytes << " bytes)" << std::endl;
+        shm_unlink(name.c_str());
+        return false;
+    }
+    
+    // The new segment is zero-filled: no frames, both sequences even
+    header = static_cast<galaxy_shm_header*>(map);
+    header->version = GALAXY_SHM_VERSION;
+    header->star_bytes = sizeof(galaxy_shm_star);
+    header->capacity = capacity;
+    header->writer_pid = (uint32_t)getpid();
+    for (int i = 0; i < 2; i++) {
+        header->slots[i].offset = sizeof(galaxy_shm_header) + i * capacity * sizeof(galaxy_shm_star);
+    }
+    // Readers check the magic last
+    __atomic_store_n(&header->magic, GALAXY_SHM_MAGIC, __ATOMIC_RELEASE);
+    frames = 0;
+    seconds = 0.0;
+    return true;
+}
+
+bool StatePublisher::publish(const std::vector<Star>& stars, uint64_t step, double time) {
+    if (!header || stars.size() > header->capacity) return false;
+    auto start = std::chrono::steady_clock::now();
+    
+    // Write the slot that is not the latest; readers go to the other one
+    uint64_t index = (header->latest + 1) & 1;
+    galaxy_shm_slot& slot = header->slots[index];
+    uint64_t sequence = slot.sequence;
+    __atomic_store_n(&slot.sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    
+    slot.count = stars.size();
+    slot.step = step;
+    slot.time = time;
+    const unsigned char* source = reinterpret_cast<const unsigned char*>(stars.data());
+    unsigned char* target = reinterpret_cast<unsigned char*>(header) + slot.offset;
+    size_t total = stars.size() * sizeof(Star);
+    long long chunks = (long long)((total + COPY_CHUNK_BYTES - 1) / COPY_CHUNK_BYTES);
+    #pragma omp parallel for schedule(static)
+    for (long long c = 0; c < chunks; c++) {
+        size_t first = (size_t)c * COPY_CHUNK_BYTES;
+        std::memcpy(target + first, source + first, std::min(COPY_CHUNK_BYTES, total - first));
+    }
+    
+    __atomic_store_n(&slot.sequence, sequence + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&header->latest, index, __ATOMIC_RELEASE);
+    __atomic_store_n(&header->frames, ++frames, __ATOMIC_RELEASE);
+    
+    seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+void StatePublisher::close() {
+    if (!header) return;
+    __atomic_fetch_or(&header->flags, GALAXY_SHM_CLOSED, __ATOMIC_RELEASE);
+    munmap(header, bytes);
+    shm_unlink(name.c_str());
+    header = NULL;
+}
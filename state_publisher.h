@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "galaxy_shm.h"
+#include "star.h"
+
+// Publishes the star state into a POSIX shared-memory segment that other
+// processes map read-only (layout and reader helpers in galaxy_shm.h).
+// publish() is a parallel copy into the slot readers are not being
+// pointed at; readers never block it, however many there are.
+class StatePublisher {
+public:
+    StatePublisher() = default;
+    ~StatePublisher();
+    
+    StatePublisher(const StatePublisher&) = delete;
+    StatePublisher& operator=(const StatePublisher&) = delete;
+    
+    // Creates the segment, replacing any stale one of the same name.
+    // Frames can hold at most capacity stars.
+    bool open(const std::string& name, uint64_t capacity);
+    bool isOpen() const { return header != NULL; }
+    
+    bool publish(const std::vector<Star>& stars, uint64_t step, double time);
+    
+    // Marks the segment closed and unlinks it; mapped readers keep the last frame
+    void close();
+    
+    uint64_t framesPublished() const { return frames; }
+    double publishSeconds() const { return seconds; }
+    
+private:
+    std::string name;
+    galaxy_shm_header* header = NULL;
+    size_t bytes = 0;
+    uint64_t frames = 0;
+    double seconds = 0.0; // Spent copying, for the cost report
+};
@@ -0,0 +1,99 @@
+#include "stream_protocol.h"
+
+void StreamPoints::clear() {
+    ids.clear();
+    quantized.clear();
+    attributes.clear();
+    weights.clear();
+}
+
+void encodeStreamFrame(const StreamPoints& previous, const StreamPoints& next, bool key,
+                       uint64_t step, double time, uint32_t visible,
+                       StreamFrameHeader& header, std::vector<unsigned char>& payload) {
+    payload.clear();
+    bool same = !key && previous.ids == next.ids;
+    if (!same) {
+        uint32_t last = 0;
+        for (uint32_t id : next.ids) {
+            putVarint(payload, id - last);
+            last = id;
+        }
+    }
+    
+    // Walk both selections in index order; stars the client already holds
+    // are sent as a change of position, which is small between frames
+    size_t p = 0;
+    for (size_t i = 0; i < next.ids.size(); i++) {
+        while (!key && p < previous.ids.size() && previous.ids[p] < next.ids[i]) p++;
+        bool held = !key && p < previous.ids.size() && previous.ids[p] == next.ids[i];
+        glm::ivec3 base = held ? previous.quantized[p] : glm::ivec3(0);
+        for (int k = 0; k < 3; k++) {
+            putVarint(payload, zigzag((int64_t)next.quantized[i][k] - base[k]));
+        }
+        if (!held) payload.push_back(next.attributes[i]);
+    }
+    for (uint32_t weight : next.weights) putVarint(payload, weight);
+    
+    header.magic = STREAM_FRAME_MAGIC;
+    header.flags = (key ? STREAM_FRAME_KEY : 0) | (same ? STREAM_FRAME_SAME_SELECTION : 0);
+    header.step = step;
+    header.time = time;
+    header.count = (uint32_t)next.ids.size();
+    header.payloadBytes = (uint32_t)payload.size();
+    header.quantum = next.quantum;
+    header.visible = visible;
+}
+
+bool decodeStreamFrame(const StreamFrameHeader& header, const unsigned char* payload, StreamPoints& points) {
+    if (header.magic != STREAM_FRAME_MAGIC) return false;
+    size_t size = header.payloadBytes;
+    size_t cursor = 0;
+    uint64_t value;
+    
+    StreamPoints previous;
+    previous.ids.swap(points.ids);
+    previous.quantized.swap(points.quantized);
+    previous.attributes.swap(points.attributes);
+    bool key = (header.flags & STREAM_FRAME_KEY) != 0;
+    if (key) previous.clear();
+    
+    points.clear();
+    points.quantum = header.quantum;
+    if (header.flags & STREAM_FRAME_SAME_SELECTION) {
+        if (header.count != previous.ids.size()) return false;
+        points.ids = previous.ids;
+    } else {
+        uint64_t last = 0;
+        for (uint32_t i = 0; i < header.count; i++) {
+            if (!getVarint(payload, size, cursor, value)) return false;
+            last += value;
+            points.ids.push_back((uint32_t)last);
+        }
+    }
+    
+    size_t p = 0;
+    points.quantized.resize(header.count);
+    points.attributes.resize(header.count);
+    for (uint32_t i = 0; i < header.count; i++) {
+        while (p < previous.ids.size() && previous.ids[p] < points.ids[i]) p++;
+        bool held = p < previous.ids.size() && previous.ids[p] == points.ids[i];
+        glm::ivec3 base = held ? previous.quantized[p] : glm::ivec3(0);
+        for (int k = 0; k < 3; k++) {
+            if (!getVarint(payload, size, cursor, value)) return false;
+            points.quantized[i][k] = (int32_t)(base[k] + unzigzag(value));
+        }
+        if (held) {
+            points.attributes[i] = previous.attributes[p];
+        } else {
+            if (cursor >= size) return false;
+            points.attributes[i] = payload[cursor++];
+        }
+    }
+    
+    points.weights.resize(header.count);
+    for (uint32_t i = 0; i < header.count; i++) {
+        if (!getVarint(payload, size, cursor, value)) return false;
+        points.weights[i] = (uint32_t)value;
+    }
+    return cursor == size;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Wire format between StreamServer and remote viewers, all little-endian.
+//
+// The client opens a TCP connection and sends a StreamRequest, and sends a
+// new one whenever its camera or budget changes. The server answers with
+// frames for as long as the connection is open, each a StreamFrameHeader
+// followed by payloadBytes of payload:
+//
+//   ids      unless STREAM_FRAME_SAME_SELECTION: per point, the gap to the
+//            previous star index as a varint (the first is the index)
+//   points   per point in index order, three zigzag varints: the change of
+//            the quantized position since the previous frame if the star
+//            was in it, else the quantized position and then one byte of
+//            attributes (species, 0x80 for black holes)
+//   weights  per point, a varint: how many stars the point stands for
+//
+// Quantized positions are position / quantum, rounded. A frame with
+// STREAM_FRAME_KEY does not refer to the previous one.
+
+const uint32_t STREAM_REQUEST_MAGIC = 0x51525347; // "GSRQ"
+const uint32_t STREAM_FRAME_MAGIC = 0x52465347;   // "GSFR"
+
+const uint32_t STREAM_FRAME_KEY = 1;
+const uint32_t STREAM_FRAME_SAME_SELECTION = 2;
+
+const uint8_t STREAM_ATTRIBUTE_BLACK_HOLE = 0x80;
+
+struct StreamRequest {
+    uint32_t magic = STREAM_REQUEST_MAGIC;
+    uint32_t budget = 100000;         // Most points per frame
+    float maxFps = 30.0f;             // 0 for as fast as the link allows
+    uint32_t maxBytesPerSecond = 0;   // 0 for unlimited
+    float eye[3] = {0.0f, 0.0f, 0.0f};
+    float quantum = 1.0f;             // Position resolution in light years
+    float viewProjection[16] = {0.0f}; // Column-major, OpenGL clip space
+};
+
+struct StreamFrameHeader {
+    uint32_t magic;
+    uint32_t flags;
+    uint64_t step;
+    double time;
+    uint32_t count;        // Points in this frame
+    uint32_t payloadBytes;
+    float quantum;
+    uint32_t visible;      // Stars in view before decimation
+};
+
+static_assert(sizeof(StreamRequest) == 96, "StreamRequest is a wire format");
+static_assert(sizeof(StreamFrameHeader) == 40, "StreamFrameHeader is a wire format");
+
+// Varints: 7 bits per byte, least significant first
+inline void putVarint(std::vector<unsigned char>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((unsigned char)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((unsigned char)value);
+}
+
+inline bool getVarint(const unsigned char* in, size_t size, size_t& cursor, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && cursor < size; shift += 7) {
+        unsigned char byte = in[cursor++];
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+inline uint64_t zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// The points a client currently holds, as both ends track them
+struct StreamPoints {
+    std::vector<uint32_t> ids;          // Star indices, ascending
+    std::vector<glm::ivec3> quantized;
+    std::vector<uint8_t> attributes;
+    std::vector<uint32_t> weights;
+    float quantum = 0.0f;
+    
+    void clear();
+};
+
+// Encodes next as a frame relative to previous (ignored for key frames).
+// next.attributes must be filled for every point.
+void encodeStreamFrame(const StreamPoints& previous, const StreamPoints& next, bool key,
+                       uint64_t step, double time, uint32_t visible,
+                       StreamFrameHeader& header, std::vector<unsigned char>& payload);
+
+// Client side: applies a frame to the points held, in place
+bool decodeStreamFrame(const StreamFrameHeader& header, const unsigned char* payload, StreamPoints& points);
@@ -0,0 +1,299 @@
+#include "stream_server.h"
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const int POLL_MILLISECONDS = 100;
+static const float FRUSTUM_MARGIN = 1.05f; // Keeps stars at the edge from flickering in and out
+static const float QUANTIZED_LIMIT = 1.0e9f;
+
+static bool sendAll(int fd, const void* data, size_t bytes) {
+    const char* p = static_cast<const char*>(data);
+    while (bytes > 0) {
+        ssize_t n = send(fd, p, bytes, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        bytes -= (size_t)n;
+    }
+    return true;
+}
+
+static bool receiveAll(int fd, void* data, size_t bytes) {
+    char* p = static_cast<char*>(data);
+    while (bytes > 0) {
+        ssize_t n = recv(fd, p, bytes, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        bytes -= (size_t)n;
+    }
+    return true;
+}
+
+// Fixed pseudo-random number in [0, 1) per star index
+static float starHash(uint32_t index) {
+    uint32_t x = index * 0x9E3779B1u;
+    x ^= x >> 16;
+    x *= 0x85EBCA6Bu;
+    x ^= x >> 13;
+    x *= 0xC2B2AE35u;
+    x ^= x >> 16;
+    return (float)(x >> 8) * (1.0f / 16777216.0f);
+}
+
+struct Candidate {
+    float key;
+    float distance;
+    uint32_t id;
+};
+
+// Picks the stars inside the client's frustum, thinned to its budget. A
+// star at distance d is kept with probability min(1, (R/d)^2), decided by
+// a fixed hash of its index, so point density falls off with distance the
+// way apparent density does and the same stars stay picked from frame to
+// frame. R is chosen so the budget is met exactly; each kept star then
+// stands for (d/R)^2 stars. Black holes are always kept.
+static uint32_t selectPoints(const std::vector<glm::vec3>& positions, const std::vector<uint8_t>& attributes,
+                             const StreamRequest& request, std::vector<Candidate>& candidates, StreamPoints& out) {
+    glm::mat4 viewProjection;
+    std::memcpy(&viewProjection[0][0], request.viewProjection, sizeof(request.viewProjection));
+    // No camera given: everything is in view
+    bool cull = std::any_of(request.viewProjection, request.viewProjection + 16, [](float v) { return v != 0.0f; });
+    glm::vec3 eye(request.eye[0], request.eye[1], request.eye[2]);
+    
+    candidates.clear();
+    for (size_t i = 0; i < positions.size(); i++) {
+        if (cull) {
+            glm::vec4 clip = viewProjection * glm::vec4(positions[i], 1.0f);
+            float w = clip.w * FRUSTUM_MARGIN;
+            if (clip.w <= 0.0f || std::fabs(clip.x) > w || std::fabs(clip.y) > w || std::fabs(clip.z) > w) continue;
+        }
+        float distance = glm::length(positions[i] - eye);
+        bool blackHole = (attributes[i] & STREAM_ATTRIBUTE_BLACK_HOLE) != 0;
+        float key = blackHole ? -1.0f : distance * std::sqrt(starHash((uint32_t)i));
+        candidates.push_back({key, distance, (uint32_t)i});
+    }
+    uint32_t visible = (uint32_t)candidates.size();
+    
+    float radius = 0.0f;
+    if (candidates.size() > request.budget) {
+        std::nth_element(candidates.begin(), candidates.begin() + request.budget, candidates.end(),
+                         [](const Candidate& a, const Candidate& b) { return a.key < b.key; });
+        radius = std::max(candidates[request.budget].key, 1e-6f);
+        candidates.resize(request.budget);
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.id < b.id; });
+    
+    out.clear();
+    out.quantum = request.quantum;
+    for (const Candidate& c : candidates) {
+        glm::vec3 p = positions[c.id] / request.quantum;
+        glm::vec3 q = glm::clamp(glm::vec3(std::round(p.x), std::round(p.y), std::round(p.z)),
+                                 -QUANTIZED_LIMIT, QUANTIZED_LIMIT);
+        float share = radius > 0.0f ? (c.distance / radius) * (c.distance / radius) : 1.0f;
+        out.ids.push_back(c.id);
+        out.quantized.push_back(glm::ivec3(q));
+        out.attributes.push_back(attributes[c.id]);
+        out.weights.push_back((uint32_t)std::max(1.0f, std::min(std::round(share), 4.0e9f)));
+    }
+    return visible;
+}
+
+StreamServer::~StreamServer() {
+    close();
+}
+
+bool StreamServer::open(const std::string& address, uint16_t port) {
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+        std::cerr << "Invalid stream address " << address << std::endl;
+        return false;
+    }
+    
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    int yes = 1;
+    if (listenFd < 0 || setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) != 0 ||
+        bind(listenFd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listenFd, 16) != 0) {
+        std::cerr << "Failed to listen on " << address << ":" << port << std::endl;
+        if (listenFd >= 0) ::close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+    
+    stopping = false;
+    acceptor = std::thread(&StreamServer::acceptClients, this);
+    return true;
+}
+
+void StreamServer::close() {
+    if (listenFd < 0) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    frameReady.notify_all();
+    acceptor.join();
+    ::close(listenFd);
+    listenFd = -1;
+    
+    // Unblock clients stuck in send() on a stalled connection
+    for (auto& client : clients) shutdown(client->fd, SHUT_RDWR);
+    reapClients(true);
+}
+
+void StreamServer::publish(const std::vector<Star>& stars, uint64_t step, double time) {
+    if (connected.load() == 0) return;
+    
+    // A pooled frame no client is reading; there is always one, since each
+    // client holds at most one frame besides the latest
+    std::shared_ptr<Frame> frame;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& f : frames) {
+            if (f.use_count() == 1) {
+                frame = f;
+                break;
+            }
+        }
+        if (!frame) {
+            frame = std::make_shared<Frame>();
+            frames.push_back(frame);
+        }
+    }
+    
+    frame->positions.resize(stars.size());
+    frame->attributes.resize(stars.size());
+    #pragma omp parallel for
+    for (size_t i = 0; i < stars.size(); i++) {
+        frame->positions[i] = stars[i].position;
+        frame->attributes[i] = (uint8_t)(stars[i].species | (stars[i].isBlackHole ? STREAM_ATTRIBUTE_BLACK_HOLE : 0));
+    }
+    frame->step = step;
+    frame->time = time;
+    
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        latest = frame;
+        generation++;
+    }
+    frameReady.notify_all();
+}
+
+void StreamServer::acceptClients() {
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping) return;
+        }
+        reapClients(false);
+        
+        pollfd pfd = {listenFd, POLLIN, 0};
+        if (poll(&pfd, 1, POLL_MILLISECONDS) <= 0) continue;
+        int fd = accept(listenFd, NULL, NULL);
+        if (fd < 0) continue;
+        
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        clients.push_back(std::unique_ptr<Client>(new Client()));
+        Client* client = clients.back().get();
+        client->fd = fd;
+        connected++;
+        client->thread = std::thread(&StreamServer::serve, this, client);
+    }
+}
+
+// Joins finished client threads, or all of them
+void StreamServer::reapClients(bool all) {
+    for (size_t i = 0; i < clients.size();) {
+        Client& client = *clients[i];
+        if (!all && !client.finished.load()) {
+            i++;
+            continue;
+        }
+        client.thread.join();
+        ::close(client.fd);
+        clients.erase(clients.begin() + i);
+    }
+}
+
+void StreamServer::serve(Client* client) {
+    typedef std::chrono::steady_clock Clock;
+    StreamRequest request;
+    bool haveRequest = false;
+    StreamPoints held;  // What the client has, as of our last frame
+    StreamPoints next;
+    std::vector<Candidate> candidates;
+    std::vector<unsigned char> payload;
+    uint64_t seen = 0;
+    Clock::time_point nextSend = Clock::now();
+    
+    for (;;) {
+        // Take any new requests; wait for the first one
+        pollfd pfd = {client->fd, POLLIN, 0};
+        bool closed = false;
+        while (poll(&pfd, 1, haveRequest ? 0 : POLL_MILLISECONDS) > 0) {
+            StreamRequest update;
+            if (!(pfd.revents & POLLIN) || !receiveAll(client->fd, &update, sizeof(update)) ||
+                update.magic != STREAM_REQUEST_MAGIC) {
+                closed = true;
+                break;
+            }
+            if (!(update.quantum > 0.0f)) update.quantum = 1.0f;
+            if (update.quantum != request.quantum) held.clear(); // Start over with a key frame
+            request = update;
+            haveRequest = true;
+        }
+        if (closed) break;
+        
+        std::shared_ptr<const Frame> frame;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (stopping) break;
+            if (!haveRequest) continue;
+            
+            // This client's own rate limits; others are unaffected
+            if (frameReady.wait_until(lock, nextSend, [&] { return stopping; })) break;
+            frameReady.wait_for(lock, std::chrono::milliseconds(POLL_MILLISECONDS),
+                                [&] { return stopping || generation != seen; });
+            if (stopping) break;
+            if (generation == seen) continue;
+            frame = latest;
+            seen = generation;
+        }
+        
+        uint32_t visible = selectPoints(frame->positions, frame->attributes, request, candidates, next);
+        StreamFrameHeader header;
+        bool key = held.ids.empty();
+        encodeStreamFrame(held, next, key, frame->step, frame->time, visible, header, payload);
+        frame.reset();
+        
+        Clock::time_point start = Clock::now();
+        if (!sendAll(client->fd, &header, sizeof(header)) || !sendAll(client->fd, payload.data(), payload.size())) break;
+        std::swap(held, next);
+        sent++;
+        sentBytes += sizeof(header) + payload.size();
+        
+        double wait = 0.0;
+        if (request.maxFps > 0.0f) wait = 1.0 / request.maxFps;
+        if (request.maxBytesPerSecond > 0) {
+            wait = std::max(wait, (double)(sizeof(header) + payload.size()) / request.maxBytesPerSecond);
+        }
+        nextSend = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(wait));
+    }
+    
+    connected--;
+    client->finished = true;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+#include "star.h"
+#include "stream_protocol.h"
+
+// Serves the running simulation to remote viewers over TCP (protocol in
+// stream_protocol.h). Each client gets its own thread, which picks the
+// stars inside the client's view frustum, thins them to its point budget
+// by distance, and sends the positions as changes from its last frame.
+// publish() only copies positions into a free frame buffer, and only while
+// someone is connected. A slow client simply skips to the newest frame
+// when it is ready again, so it never holds up the step loop or the other
+// clients.
+class StreamServer {
+public:
+    StreamServer() = default;
+    ~StreamServer();
+    
+    StreamServer(const StreamServer&) = delete;
+    StreamServer& operator=(const StreamServer&) = delete;
+    
+    // Listens on address:port, e.g. "127.0.0.1" or "0.0.0.0"
+    bool open(const std::string& address, uint16_t port);
+    void close();
+    bool isOpen() const { return listenFd >= 0; }
+    
+    void publish(const std::vector<Star>& stars, uint64_t step, double time);
+    
+    size_t clientCount() const { return connected.load(); }
+    uint64_t framesSent() const { return sent.load(); }
+    uint64_t bytesSent() const { return sentBytes.load(); }
+    
+private:
+    struct Frame {
+        std::vector<glm::vec3> positions;
+        std::vector<uint8_t> attributes; // As in the stream, refreshed with the positions
+        uint64_t step = 0;
+        double time = 0.0;
+    };
+    
+    struct Client {
+        int fd = -1;
+        std::thread thread;
+        std::atomic<bool> finished{false};
+    };
+    
+    void acceptClients();
+    void serve(Client* client);
+    void reapClients(bool all);
+    
+    int listenFd = -1;
+    std::thread acceptor;
+    
+    std::mutex mutex;
+    std::condition_variable frameReady;
+    bool stopping = false;
+    std::shared_ptr<const Frame> latest;
+    uint64_t generation = 0;
+    std::vector<std::shared_ptr<Frame>> frames; // Pool; free when only the pool holds one
+    std::vector<std::unique_ptr<Client>> clients;
+    
+    std::atomic<size_t> connected{0};
+    std::atomic<uint64_t> sent{0};
+    std::atomic<uint64_t> sentBytes{0};
+};
@@ -0,0 +1,523 @@
+// Regression checks of the simulation core, run by ctest. Each check
+// compares an integrator or codec against an exact answer and prints the
+// error it measured, so a failure shows by how much.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "galaxy_core.h"
+#include "snapshot.h"
+#include "trajectory.h"
+#include "gadget_io.h"
+#include "arrow_export.h"
+#include "stream_protocol.h"
+#include "wisdom_holman.h"
+#include "hermite.h"
+#include "composition.h"
+#include "parareal.h"
+#include "ks_regularization.h"
+
+static const float BLACK_HOLE_MASS = 4.154e6f;
+static const double MU = G * BLACK_HOLE_MASS;
+
+static int failures = 0;
+
+static void check(const std::string& name, bool passed, double measured) {
+    std::cout << (passed ? "ok     " : "FAILED ") << name << " (" << measured << ")" << std::endl;
+    if (!passed) failures++;
+}
+
+// An orbit of semi-major axis a and eccentricity e, starting at pericentre
+// in a tilted plane
+struct Orbit {
+    double a, e;
+    glm::dvec3 p, q; // Unit vectors to pericentre and along the motion there
+    
+    Orbit(double a, double e) : a(a), e(e) {
+        p = glm::normalize(glm::dvec3(-0.6, 0.3, 0.74));
+        q = glm::dvec3(0.3, 0.6, 0.0);
+        q = glm::normalize(q - glm::dot(q, p) * p);
+    }
+    
+    double period() const { return 2.0 * M_PI * std::sqrt(a * a * a / MU); }
+    glm::dvec3 position() const { return a * (1.0 - e) * p; }
+    glm::dvec3 velocity() const { return std::sqrt(MU * (1.0 + e) / (a * (1.0 - e))) * q; }
+    
+    // Solves Kepler's equation by Newton's method
+    glm::dvec3 positionAt(double t) const {
+        double meanAnomaly = 2.0 * M_PI * std::fmod(t / period(), 1.0);
+        double E = e < 0.8 ? meanAnomaly : M_PI;
+        for (int i = 0; i < 100; i++) E -= (E - e * std::sin(E) - meanAnomaly) / (1.0 - e * std::cos(E));
+        return a * (std::cos(E) - e) * p + a * std::sqrt(1.0 - e * e) * std::sin(E) * q;
+    }
+};
+
+// The black hole at the origin and one star on the orbit
+static std::vector<Star> twoBody(const Orbit& orbit) {
+    std::vector<Star> stars(2, centralBlackHole(BLACK_HOLE_MASS));
+    stars[1].isBlackHole = false;
+    stars[1].species = SPECIES_BULGE;
+    stars[1].mass = 1.0f;
+    stars[1].position = glm::vec3(orbit.position());
+    stars[1].velocity = glm::vec3(orbit.velocity());
+    return stars;
+}
+
+static void checkLossySnapshot() {
+    GalaxyParameters parameters;
+    parameters.starCount = 100000;
+    parameters.seed = 1;
+    std::vector<Star> stars;
+    generateGalaxy(parameters, stars);
+    
+    SnapshotOptions options;
+    options.positionTolerance = 0.01f;
+    options.velocityTolerance = 1e-4f;
+    const std::string path = "galaxy_core_tests.gsnap";
+    std::vector<Star> decoded;
+    bool written = writeSnapshot(path, stars, 0, 0.0, options) && readSnapshot(path, decoded);
+    std::remove(path.c_str());
+    if (!written || decoded.size() != stars.size()) {
+        check("Lossy snapshot round trip", false, (double)decoded.size());
+        return;
+    }
+    
+    double positionError = 0.0, velocityError = 0.0;
+    bool exact = true;
+    for (size_t i = 0; i < stars.size(); i++) {
+        for (int d = 0; d < 3; d++) {
+            positionError = std::max(positionError, (double)std::fabs(decoded[i].position[d] - stars[i].position[d]));
+            velocityError = std::max(velocityError, (double)std::fabs(decoded[i].velocity[d] - stars[i].velocity[d]));
+        }
+        exact = exact && decoded[i].mass == stars[i].mass && decoded[i].size == stars[i].size &&
+                decoded[i].isBlackHole == stars[i].isBlackHole && decoded[i].species == stars[i].species;
+    }
+    check("Lossy snapshot position error", positionError <= options.positionTolerance, positionError);
+    check("Lossy snapshot velocity error", velocityError <= options.velocityTolerance, velocityError);
+    check("Lossy snapshot other fields", exact, exact);
+}
+
+static bool sameStar(const Star& a, const Star& b) {
+    return a.position == b.position && a.velocity == b.velocity && a.mass == b.mass && a.size == b.size &&
+           a.isBlackHole == b.isBlackHole && a.species == b.species;
+}
+
+// Every frame reads back exactly, keyframe or not, and findFrame picks the
+// last frame at or before a time
+static void checkTrajectory() {
+    GalaxyParameters parameters;
+    parameters.starCount = 20000;
+    parameters.seed = 2;
+    std::vector<Star> stars;
+    generateGalaxy(parameters, stars);
+    
+    const std::string path = "galaxy_core_tests.gtraj";
+    const size_t frameCount = 20;
+    std::vector<std::vector<Star>> written;
+    TrajectoryWriter writer;
+    bool ok = writer.open(path, 8);
+    for (size_t f = 0; ok && f < frameCount; f++) {
+        ok = writer.append(stars, 10 * f, 2.0 * f);
+        written.push_back(stars);
+        integrateStars(stars, 2.0f);
+    }
+    ok = writer.close() && ok;
+    
+    TrajectoryReader reader;
+    ok = ok && reader.open(path) && reader.frameCount() == frameCount && reader.starCount() == stars.size();
+    size_t mismatches = 0;
+    std::vector<Star> decoded(stars.size());
+    for (size_t f = 0; ok && f < frameCount; f++) {
+        ok = reader.read(f, 0, decoded.size(), &decoded[0]) && reader.frame(f).step == 10 * f &&
+             reader.frame(f).time == 2.0 * f;
+        for (size_t i = 0; ok && i < decoded.size(); i++) mismatches += !sameStar(decoded[i], written[f][i]);
+    }
+    check("Trajectory frames read back exactly", ok && mismatches == 0, (double)mismatches);
+    
+    // A range of one field leaves everything else alone
+    std::vector<Star> partial = written[0];
+    ok = ok && reader.read(13, 1000, 500, &partial[1000], TRAJECTORY_VELOCITIES);
+    mismatches = 0;
+    for (size_t i = 0; ok && i < partial.size(); i++) {
+        bool inRange = i >= 1000 && i < 1500;
+        Star expected = written[0][i];
+        if (inRange) expected.velocity = written[13][i].velocity;
+        mismatches += !sameStar(partial[i], expected);
+    }
+    check("Trajectory partial read", ok && mismatches == 0, (double)mismatches);
+    
+    bool found = ok && reader.findFrame(-1.0) == 0 && reader.findFrame(0.0) == 0 && reader.findFrame(5.0) == 2 &&
+                 reader.findFrame(6.0) == 3 && reader.findFrame(1e9) == frameCount - 1;
+    check("Trajectory findFrame", found, reader.findFrame(5.0));
+    reader.close();
+    std::remove(path.c_str());
+}
+
+// Stars written in type-major order come back in the same order, within
+// the rounding of the unit conversion, and the header time is in GADGET's
+// time unit of kpc / (km/s), about 0.978 Gyr
+static void checkGadget() {
+    GalaxyParameters parameters;
+    parameters.starCount = 30000;
+    parameters.seed = 3;
+    std::vector<Star> stars;
+    generateGalaxy(parameters, stars);
+    stars.erase(stars.begin());
+    for (size_t i = 0; i < stars.size(); i++) {
+        stars[i].species = (uint8_t)(i * SPECIES_COUNT / stars.size());
+        stars[i].isBlackHole = stars[i].species == SPECIES_BLACK_HOLE;
+        stars[i].size = stars[i].isBlackHole ? BLACK_HOLE_DISPLAY_SIZE : starDisplaySize(stars[i].mass);
+    }
+    
+    std::vector<std::string> paths = {"galaxy_core_tests.gadget"};
+#ifdef GALAXY_HAVE_HDF5
+    paths.push_back("galaxy_core_tests.hdf5");
+#endif
+    for (const std::string& path : paths) {
+        std::vector<Star> decoded;
+        GadgetHeader header;
+        bool ok = writeGadget(path, stars, 1000.0) && readGadget(path, decoded, &header) &&
+                  decoded.size() == stars.size();
+        std::remove(path.c_str());
+        double error = 0.0;
+        size_t mismatches = 0;
+        for (size_t i = 0; ok && i < stars.size(); i++) {
+            const Star& a = stars[i];
+            const Star& b = decoded[i];
+            error = std::max(error, (double)glm::length(a.position - b.position) / glm::length(a.position));
+            error = std::max(error, (double)glm::length(a.velocity - b.velocity) / glm::length(a.velocity));
+            error = std::max(error, (double)std::fabs(a.mass - b.mass) / a.mass);
+            error = std::max(error, (double)std::fabs(a.size - b.size) / a.size);
+            mismatches += a.species != b.species || a.isBlackHole != b.isBlackHole;
+        }
+        check(path + " round trip", ok && error < 1e-6 && mismatches == 0, error);
+        double years = header.time * 9.7779e8;
+        check(path + " header time", ok && std::fabs(years / 1000.0 - 1.0) < 1e-4, years);
+    }
+}
+
+// Reads FlatBuffers tables independently of the writer's encoder
+struct FlatTable {
+    const unsigned char* data;
+    size_t position;
+    
+    template <class T>
+    T at(size_t offset) const {
+        T value;
+        std::memcpy(&value, data + offset, sizeof(T));
+        return value;
+    }
+    
+    // Offset of a field from the table start, 0 if absent
+    size_t field(int id) const {
+        size_t vtable = position - at<int32_t>(position);
+        size_t slot = 4 + 2 * (size_t)id;
+        return slot < at<uint16_t>(vtable) ? at<uint16_t>(vtable + slot) : 0;
+    }
+    
+    template <class T>
+    T scalar(int id) const {
+        size_t offset = field(id);
+        return offset ? at<T>(position + offset) : T(0);
+    }
+    
+    // Start of the referenced object, which is a vector's element count
+    size_t reference(int id) const {
+        size_t offset = position + field(id);
+        return offset + at<uint32_t>(offset);
+    }
+    
+    FlatTable table(int id) const { return {data, reference(id)}; }
+    uint32_t vectorLength(int id) const { return at<uint32_t>(reference(id)); }
+    FlatTable element(int id, size_t index) const {
+        size_t slot = reference(id) + 4 + 4 * index;
+        return {data, slot + at<uint32_t>(slot)};
+    }
+    std::string string(int id) const {
+        size_t start = reference(id);
+        return std::string((const char*)data + start + 4, at<uint32_t>(start));
+    }
+    
+    static FlatTable root(const unsigned char* data) {
+        FlatTable buffer = {data, 0};
+        return {data, buffer.at<uint32_t>(0)};
+    }
+};
+
+// The schema, the footer's record batch index and every batch's values,
+// read back through the IPC file format
+static void checkArrow() {
+    GalaxyParameters parameters;
+    parameters.starCount = 7000;
+    parameters.seed = 4;
+    std::vector<Star> stars;
+    generateGalaxy(parameters, stars);
+    stars[0].species = SPECIES_BLACK_HOLE;
+    
+    const std::string path = "galaxy_core_tests.arrow";
+    const size_t batchRows = 3000;
+    ArrowWriter writer;
+    bool ok = writer.open(path, batchRows) && writer.append(stars, 5, 1.5) && writer.append(stars, 6, 2.5) &&
+              writer.close();
+    std::ifstream in(path, std::ios::binary);
+    std::vector<unsigned char> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    std::remove(path.c_str());
+    ok = ok && file.size() > 20 && std::memcmp(&file[0], "ARROW1\0\0", 8) == 0 &&
+         std::memcmp(&file[file.size() - 6], "ARROW1", 6) == 0;
+    if (!ok) {
+        check("Arrow file framing", false, (double)file.size());
+        return;
+    }
+    
+    int32_t footerBytes;
+    std::memcpy(&footerBytes, &file[file.size() - 10], 4);
+    FlatTable footer = FlatTable::root(&file[file.size() - 10 - footerBytes]);
+    
+    // Field name, Type union tag, and bit width or precision
+    struct Expected {
+        const char* name;
+        uint8_t type;
+        int width;
+    };
+    static const Expected columns[] = {
+        {"step", 2, 64}, {"time", 3, 2}, {"species", 2, 8},
+        {"pos_x", 3, 1}, {"pos_y", 3, 1}, {"pos_z", 3, 1},
+        {"vel_x", 3, 1}, {"vel_y", 3, 1}, {"vel_z", 3, 1},
+        {"mass", 3, 1}, {"black_hole", 6, 0}
+    };
+    const size_t columnCount = sizeof(columns) / sizeof(columns[0]);
+    FlatTable schema = footer.table(1);
+    bool schemaOk = footer.scalar<int16_t>(0) == 4 && schema.vectorLength(1) == columnCount;
+    for (size_t c = 0; schemaOk && c < columnCount; c++) {
+        FlatTable field = schema.element(1, c);
+        FlatTable type = field.table(3);
+        int width = columns[c].type == 2 ? type.scalar<int32_t>(0) : columns[c].type == 3 ? type.scalar<int16_t>(0) : 0;
+        schemaOk = field.string(0) == columns[c].name && field.scalar<uint8_t>(2) == columns[c].type &&
+                   width == columns[c].width && (columns[c].type != 2 || type.scalar<uint8_t>(1) == 0);
+    }
+    check("Arrow schema", schemaOk, schemaOk);
+    
+    // Footer blocks { offset, metadata length, body length } point at
+    // RecordBatch messages whose buffers hold the stars in order
+    const size_t batchesPerSnapshot = (stars.size() + batchRows - 1) / batchRows;
+    size_t blockStart = footer.reference(3);
+    uint32_t blockCount = footer.at<uint32_t>(blockStart);
+    size_t mismatches = blockCount == 2 * batchesPerSnapshot ? 0 : 1;
+    for (uint32_t b = 0; mismatches == 0 && b < blockCount; b++) {
+        const unsigned char* block = footer.data + blockStart + 4 + 24 * b;
+        int64_t offset, bodyBytes;
+        int32_t metadataBytes;
+        std::memcpy(&offset, block, 8);
+        std::memcpy(&metadataBytes, block + 8, 4);
+        std::memcpy(&bodyBytes, block + 16, 8);
+        FlatTable message = FlatTable::root(&file[offset + 8]);
+        FlatTable batch = message.table(2);
+        const unsigned char* body = &file[offset + metadataBytes];
+        size_t first = (b % batchesPerSnapshot) * batchRows;
+        size_t rows = std::min(batchRows, stars.size() - first);
+        mismatches += std::memcmp(&file[offset], "\xFF\xFF\xFF\xFF", 4) != 0;
+        mismatches += message.scalar<uint8_t>(1) != 3 || message.scalar<int64_t>(3) != bodyBytes ||
+                      batch.scalar<int64_t>(0) != (int64_t)rows || batch.vectorLength(2) != 2 * columnCount;
+        if (mismatches) break;
+        
+        // Buffer c holds the values of column c / 2, after its validity bitmap
+        size_t buffers = batch.reference(2) + 4;
+        auto values = [&](size_t c) { return body + message.at<int64_t>(buffers + 16 * (2 * c + 1)); };
+        uint64_t step = b < batchesPerSnapshot ? 5 : 6;
+        double time = b < batchesPerSnapshot ? 1.5 : 2.5;
+        for (size_t i = 0; i < rows; i++) {
+            const Star& star = stars[first + i];
+            float floats[7] = {star.position.x, star.position.y, star.position.z,
+                               star.velocity.x, star.velocity.y, star.velocity.z, star.mass};
+            mismatches += ((const uint64_t*)values(0))[i] != step || ((const double*)values(1))[i] != time ||
+                          values(2)[i] != star.species || std::memcmp(values(3) + 4 * i, &floats[0], 4) != 0 ||
+                          ((values(10)[i / 8] >> (i % 8)) & 1) != star.isBlackHole;
+            for (size_t c = 1; c < 7; c++) mismatches += std::memcmp(values(3 + c) + 4 * i, &floats[c], 4) != 0;
+        }
+    }
+    check("Arrow record batches", mismatches == 0, (double)mismatches);
+}
+
+// A random selection of stars, moving a little each frame
+static StreamPoints streamSelection(std::mt19937& generator, const std::vector<glm::ivec3>& positions,
+                                    double keep) {
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    StreamPoints points;
+    points.quantum = 0.5f;
+    for (uint32_t id = 0; id < positions.size(); id++) {
+        if (uniform(generator) >= keep) continue;
+        points.ids.push_back(id);
+        points.quantized.push_back(positions[id]);
+        points.attributes.push_back((uint8_t)(id % SPECIES_COUNT | (id % 97 == 0 ? STREAM_ATTRIBUTE_BLACK_HOLE : 0)));
+        points.weights.push_back(1 + id % 5);
+    }
+    return points;
+}
+
+// The client rebuilds every frame exactly from key frames, deltas against
+// the points it holds, and frames with an unchanged selection
+static void checkStreamFrames() {
+    std::mt19937 generator(5);
+    std::uniform_int_distribution<int> start(-2000000000, 2000000000), drift(-40, 40);
+    std::vector<glm::ivec3> positions(5000);
+    for (glm::ivec3& p : positions) p = glm::ivec3(start(generator), start(generator), start(generator));
+    
+    StreamPoints sent, held;
+    size_t mismatches = 0;
+    bool ok = true;
+    for (int frame = 0; ok && frame < 12; frame++) {
+        for (glm::ivec3& p : positions) p += glm::ivec3(drift(generator), drift(generator), drift(generator));
+        StreamPoints next = frame == 5 ? sent : streamSelection(generator, positions, 0.3);
+        if (frame == 5) {
+            for (size_t i = 0; i < next.ids.size(); i++) next.quantized[i] = positions[next.ids[i]];
+        }
+        bool key = frame == 0 || frame == 8;
+        
+        StreamFrameHeader header;
+        std::vector<unsigned char> payload;
+        StreamPoints before = held;
+        encodeStreamFrame(sent, next, key, frame, frame * 0.5, (uint32_t)next.ids.size(), header, payload);
+        ok = (frame != 5 || (header.flags & STREAM_FRAME_SAME_SELECTION)) &&
+             decodeStreamFrame(header, payload.data(), held);
+        mismatches += held.ids != next.ids || held.quantized != next.quantized ||
+                      held.attributes != next.attributes || held.weights != next.weights ||
+                      held.quantum != next.quantum;
+        sent = next;
+        
+        // A truncated payload is refused rather than misread
+        if (ok && frame == 3) {
+            header.payloadBytes--;
+            ok = !decodeStreamFrame(header, payload.data(), before);
+        }
+    }
+    check("Stream frames decode to what was sent", ok && mismatches == 0, (double)mismatches);
+}
+
+static void checkKeplerDrift() {
+    for (double e : {0.0, 0.5, 0.9}) {
+        Orbit orbit(10.0, e);
+        glm::dvec3 x = orbit.position(), v = orbit.velocity();
+        double t = 3.37 * orbit.period();
+        bool converged = keplerDrift(x, v, MU, t);
+        double error = glm::length(x - orbit.positionAt(t)) / orbit.a;
+        std::ostringstream name;
+        name << "keplerDrift at e = " << e;
+        check(name.str(), converged && error < 1e-9, error);
+    }
+}
+
+// The Aarseth step goes as sqrt(eta), so quartering eta halves every block
+// step and a fourth-order scheme divides the error by 16
+static void checkHermiteOrder() {
+    Orbit orbit(10.0, 0.5);
+    TimestepCriteria criteria;
+    criteria.maxStep = 1e9f;
+    HermiteRegion region;
+    region.radius = 100.0f;
+    double error[2];
+    double eta[2] = {0.02, 0.005};
+    for (int k = 0; k < 2; k++) {
+        std::vector<Star> stars = twoBody(orbit);
+        HermiteIntegrator hermite(region, eta[k]);
+        float dt = (float)orbit.period();
+        hermite.step(stars, dt, criteria);
+        error[k] = glm::length(glm::dvec3(stars[1].position) - orbit.positionAt(dt)) / orbit.a;
+    }
+    double order = std::log2(error[0] / error[1]);
+    check("Hermite order", order > 3.5, order);
+}
+
+// Relative position error after one orbit in the given number of steps
+template <class Scheme>
+static double compositionError(int steps) {
+    Orbit orbit(10.0, 0.5);
+    std::vector<Star> stars = twoBody(orbit);
+    TimestepCriteria criteria;
+    float dt = (float)(orbit.period() / steps);
+    for (int n = 0; n < steps; n++) integrateComposition<Scheme>(stars, dt, criteria);
+    return glm::length(glm::dvec3(stars[1].position) - orbit.positionAt(dt * (double)steps)) / orbit.a;
+}
+
+// Halving the step divides the error by 2^order
+template <class Scheme>
+static void checkCompositionOrder(const std::string& name, int steps) {
+    double ratio = compositionError<Scheme>(steps) / compositionError<Scheme>(2 * steps);
+    check(name + " order", std::log2(ratio) > Scheme::ORDER - 0.5, std::log2(ratio));
+}
+
+// With as many iterations as slices, Parareal reproduces the serial fine
+// run exactly
+static void checkPararealMatchesSerial() {
+    std::mt19937 generator(1);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::vector<Star> stars(1, centralBlackHole(BLACK_HOLE_MASS));
+    for (int i = 0; i < 500; i++) {
+        Orbit orbit(15.0 + 10.0 * uniform(generator), 0.5 * uniform(generator));
+        std::vector<Star> pair = twoBody(orbit);
+        stars.push_back(pair[1]);
+    }
+    TimestepCriteria criteria;
+    PararealOptions options;
+    options.slices = 4;
+    options.fineSteps = 50;
+    options.tolerance = 0.0f;
+    options.maxIterations = (int)options.slices;
+    double horizon = Orbit(25.0, 0.0).period();
+    
+    std::vector<Star> serial = stars;
+    float dt = (float)(horizon / (options.slices * options.fineSteps));
+    for (size_t n = 0; n < options.slices * options.fineSteps; n++) integrateComposition<ForestRuth>(serial, dt, criteria);
+    
+    PararealReport report;
+    integrateParareal(stars, horizon, integrateComposition<ForestRuth>, integrateComposition<Leapfrog>,
+                      criteria, options, report);
+    double difference = 0.0;
+    for (size_t i = 0; i < stars.size(); i++) {
+        difference = std::max(difference, (double)glm::length(stars[i].position - serial[i].position));
+    }
+    check("Parareal matches the serial fine run", difference == 0.0, difference);
+}
+
+static void checkKSAdvance() {
+    for (double e : {0.5, 0.99, 0.999}) {
+        Orbit orbit(10.0, e);
+        glm::dvec3 x = orbit.position(), v = orbit.velocity();
+        double t = 3.37 * orbit.period();
+        ksAdvance(x, v, MU, t, 64);
+        double error = glm::length(x - orbit.positionAt(t)) / orbit.a;
+        std::ostringstream name;
+        name << "ksAdvance at e = " << e;
+        check(name.str(), error < 1e-5, error);
+    }
+}
+
+int main() {
+    checkLossySnapshot();
+    checkTrajectory();
+    checkGadget();
+    checkArrow();
+    checkStreamFrames();
+    checkKeplerDrift();
+    checkHermiteOrder();
+    checkCompositionOrder<Leapfrog>("Leapfrog", 100);
+    checkCompositionOrder<ForestRuth>("Forest-Ruth", 100);
+    checkCompositionOrder<Yoshida6>("Yoshida6", 50);
+    checkPararealMatchesSerial();
+    checkKSAdvance();
+    
+    if (failures > 0) {
+        std::cerr << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,348 @@
+#include "trajectory.h"
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char TRAJECTORY_MAGIC[8] = {'G', 'A', 'L', 'T', 'R', 'A', 'J', '\0'};
+static const char TRAJECTORY_END_MAGIC[8] = {'G', 'A', 'L', 'T', 'R', 'A', 'J', 'E'};
+static const uint32_t TRAJECTORY_VERSION = 1;
+static const size_t HEADER_BYTES = 8 + 4 + 4 + 8 + 8;
+static const size_t TRAILER_BYTES = 8 + 8;
+
+static unsigned columnFields(size_t column) {
+    if (column < 3) return TRAJECTORY_POSITIONS;
+    if (column < 6) return TRAJECTORY_VELOCITIES;
+    return TRAJECTORY_ATTRIBUTES;
+}
+
+static void xorBytes(unsigned char* data, const unsigned char* key, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++) {
+        data[i] ^= key[i];
+    }
+}
+
+// Writing
+
+TrajectoryWriter::~TrajectoryWriter() {
+    if (file.isOpen()) close();
+}
+
+bool TrajectoryWriter::open(const std::string& filePath, uint32_t interval, SnapshotCodec blockCodec, int threadCount) {
+    path = filePath;
+    keyframeInterval = std::max(interval, 1u);
+    codec = blockCodec == SnapshotCodec::Quantized ? defaultSnapshotCodec() : blockCodec;
+    threads = std::max(threadCount, 1);
+    failed = false;
+    count = 0;
+    keyColumns.clear();
+    frames.clear();
+    
+    if (!file.open(path)) {
+        std::cerr << "Failed to create trajectory " << path << std::endl;
+        return false;
+    }
+    
+    // The star count is only known at the first frame; the header is
+    // rewritten with it on close
+    std::vector<unsigned char> header(HEADER_BYTES, 0);
+    return file.append(header.data(), header.size());
+}
+
+bool TrajectoryWriter::append(const std::vector<Star>& stars, uint64_t step, double time) {
+    if (!file.isOpen() || failed) return false;
+    if (frames.empty()) {
+        count = stars.size();
+    } else if (stars.size() != count) {
+        std::cerr << "Trajectory " << path << " expects " << count << " stars per frame" << std::endl;
+        return false;
+    }
+    
+    const size_t blockCount = (count + SNAPSHOT_BLOCK_ELEMENTS - 1) / SNAPSHOT_BLOCK_ELEMENTS;
+    const bool keyframe = frames.size() % keyframeInterval == 0;
+    if (keyframe) {
+        keyColumns.resize(COLUMN_COUNT);
+        for (size_t c = 0; c < COLUMN_COUNT; c++) keyColumns[c].resize(count * COLUMNS[c].elementSize);
+    }
+    
+    Frame frame;
+    frame.info.step = step;
+    frame.info.time = time;
+    frame.info.keyframe = keyframe ? (uint32_t)frames.size() : frames.back().info.keyframe;
+    
+    // Encode every (column, block) of the frame in parallel, then append in order
+    std::vector<std::vector<unsigned char>> encoded(COLUMN_COUNT * blockCount);
+    #pragma omp parallel for num_threads(threads) schedule(dynamic)
+    for (size_t item = 0; item < encoded.size(); item++) {
+        const ColumnDesc& column = COLUMNS[item / blockCount];
+        size_t begin = (item % blockCount) * SNAPSHOT_BLOCK_ELEMENTS;
+        size_t n = std::min(SNAPSHOT_BLOCK_ELEMENTS, (size_t)count - begin);
+        size_t bytes = n * column.elementSize;
+        
+        std::vector<unsigned char> raw(bytes), shuffled;
+        gatherColumn(column, &stars[begin], n, raw.data());
+        std::vector<unsigned char>& key = keyColumns[item / blockCount];
+        if (keyframe) {
+            std::copy(raw.begin(), raw.end(), key.begin() + begin * column.elementSize);
+        } else {
+            xorBytes(raw.data(), &key[begin * column.elementSize], bytes);
+        }
+        
+        const unsigned char* source = raw.data();
+        if (column.type == COLUMN_FLOAT32) {
+            shuffled.resize(bytes);
+            shuffleBytes(raw.data(), shuffled.data(), n, column.elementSize);
+            source = shuffled.data();
+        }
+        
+        std::vector<unsigned char>& out = encoded[item];
+        out.resize(maxCompressedSize(codec, bytes));
+        size_t stored = compressBlock(codec, source, bytes, out.data(), out.size());
+        if (stored) {
+            out.resize(stored);
+        } else {
+            out.assign(source, source + bytes);
+        }
+    }
+    
+    bool ok = true;
+    for (size_t item = 0; item < encoded.size() && ok; item++) {
+        const ColumnDesc& column = COLUMNS[item / blockCount];
+        size_t begin = (item % blockCount) * SNAPSHOT_BLOCK_ELEMENTS;
+        size_t n = std::min(SNAPSHOT_BLOCK_ELEMENTS, (size_t)count - begin);
+        BlockRange block = {file.offset(), (uint32_t)(n * column.elementSize), (uint32_t)encoded[item].size()};
+        frame.blocks.push_back(block);
+        ok = file.append(encoded[item].data(), encoded[item].size());
+    }
+    if (!ok) {
+        std::cerr << "Failed to append to trajectory " << path << std::endl;
+        failed = true;
+        return false;
+    }
+    frames.push_back(std::move(frame));
+    return true;
+}
+
+bool TrajectoryWriter::close() {
+    if (!file.isOpen()) return false;
+    
+    std::vector<unsigned char> index;
+    uint64_t indexOffset = file.offset();
+    put(index, (uint32_t)frames.size());
+    put(index, (uint32_t)COLUMN_COUNT);
+    for (size_t c = 0; c < COLUMN_COUNT; c++) {
+        char name[16] = {0};
+        std::strncpy(name, COLUMNS[c].name, sizeof(name) - 1);
+        index.insert(index.end(), name, name + sizeof(name));
+        put(index, (uint8_t)COLUMNS[c].type);
+        put(index, COLUMNS[c].elementSize);
+        put(index, (uint8_t)(COLUMNS[c].type == COLUMN_FLOAT32));
+        put(index, (uint8_t)0);
+    }
+    for (const Frame& frame : frames) {
+        put(index, frame.info.step);
+        put(index, frame.info.time);
+        put(index, frame.info.keyframe);
+        put(index, (uint32_t)0);
+        for (const BlockRange& block : frame.blocks) {
+            put(index, block.offset);
+            put(index, block.rawBytes);
+            put(index, block.storedBytes);
+        }
+    }
+    put(index, indexOffset);
+    index.insert(index.end(), TRAJECTORY_END_MAGIC, TRAJECTORY_END_MAGIC + 8);
+    bool ok = !failed && file.append(index.data(), index.size());
+    ok = file.close() && ok;
+    
+    // Now that the star count is known, fill in the header
+    std::vector<unsigned char> header;
+    header.insert(header.end(), TRAJECTORY_MAGIC, TRAJECTORY_MAGIC + 8);
+    put(header, TRAJECTORY_VERSION);
+    put(header, keyframeInterval);
+    put(header, count);
+    put(header, (uint8_t)codec);
+    for (int i = 0; i < 7; i++) put(header, (uint8_t)0);
+    int fd = ::open(path.c_str(), O_WRONLY);
+    ok = ok && fd >= 0 && pwrite(fd, header.data(), header.size(), 0) == (ssize_t)header.size();
+    if (fd >= 0) ok = ::close(fd) == 0 && ok;
+    
+    keyColumns.clear();
+    if (!ok) std::cerr << "Failed to finish trajectory " << path << std::endl;
+    return ok;
+}
+
+// Reading
+
+TrajectoryReader::~TrajectoryReader() {
+    close();
+}
+
+void TrajectoryReader::close() {
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+    count = 0;
+    blockCount = 0;
+    columns.clear();
+    frames.clear();
+    hasSpecies = false;
+}
+
+bool TrajectoryReader::open(const std::string& filePath) {
+    close();
+    path = filePath;
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Failed to open trajectory " << path << std::endl;
+        return false;
+    }
+    
+    off_t fileSize = lseek(fd, 0, SEEK_END);
+    std::vector<unsigned char> header(HEADER_BYTES), trailer(TRAILER_BYTES);
+    if (fileSize < (off_t)(HEADER_BYTES + TRAILER_BYTES) ||
+        !readExact(fd, header.data(), HEADER_BYTES, 0) ||
+        !readExact(fd, trailer.data(), TRAILER_BYTES, fileSize - TRAILER_BYTES) ||
+        std::memcmp(header.data(), TRAJECTORY_MAGIC, 8) != 0 ||
+        std::memcmp(&trailer[8], TRAJECTORY_END_MAGIC, 8) != 0) {
+        std::cerr << path << " is not a complete trajectory" << std::endl;
+        close();
+        return false;
+    }
+    
+    size_t cursor = 8;
+    uint32_t version, interval;
+    uint8_t blockCodec;
+    get(header, cursor, version);
+    get(header, cursor, interval);
+    get(header, cursor, count);
+    get(header, cursor, blockCodec);
+    codec = (SnapshotCodec)blockCodec;
+    if (version != TRAJECTORY_VERSION) {
+        std::cerr << path << ": unsupported trajectory version " << version << std::endl;
+        close();
+        return false;
+    }
+    blockCount = (size_t)((count + SNAPSHOT_BLOCK_ELEMENTS - 1) / SNAPSHOT_BLOCK_ELEMENTS);
+    
+    uint64_t indexOffset;
+    cursor = 0;
+    get(trailer, cursor, indexOffset);
+    if (indexOffset < HEADER_BYTES || indexOffset > (uint64_t)(fileSize - TRAILER_BYTES)) {
+        close();
+        return false;
+    }
+    std::vector<unsigned char> index(fileSize - TRAILER_BYTES - indexOffset);
+    if (!readExact(fd, index.data(), index.size(), indexOffset)) {
+        close();
+        return false;
+    }
+    
+    cursor = 0;
+    uint32_t frameCount = 0, columnCount = 0;
+    bool ok = get(index, cursor, frameCount) && get(index, cursor, columnCount);
+    columns.resize(ok ? columnCount : 0);
+    for (Column& column : columns) {
+        char name[16];
+        uint8_t type = 0, shuffled = 0, reserved = 0;
+        ok = ok && cursor + sizeof(name) <= index.size();
+        if (!ok) break;
+        std::memcpy(name, &index[cursor], sizeof(name));
+        name[15] = '\0';
+        cursor += sizeof(name);
+        ok = get(index, cursor, type) && get(index, cursor, column.elementSize) &&
+             get(index, cursor, shuffled) && get(index, cursor, reserved);
+        column.field = findColumn(name, type, column.elementSize);
+        if (column.field >= 0 && std::strcmp(COLUMNS[column.field].name, "species") == 0) hasSpecies = true;
+        column.shuffled = shuffled != 0;
+    }
+    
+    frames.resize(ok ? frameCount : 0);
+    for (size_t f = 0; f < frames.size() && ok; f++) {
+        Frame& frame = frames[f];
+        uint32_t reserved;
+        ok = get(index, cursor, frame.info.step) && get(index, cursor, frame.info.time) &&
+             get(index, cursor, frame.info.keyframe) && get(index, cursor, reserved) &&
+             frame.info.keyframe <= f;
+        frame.blocks.resize(columns.size() * blockCount);
+        for (BlockRange& block : frame.blocks) {
+            ok = ok && get(index, cursor, block.offset) && get(index, cursor, block.rawBytes) &&
+                 get(index, cursor, block.storedBytes);
+        }
+    }
+    if (!ok) {
+        std::cerr << "Corrupt trajectory index in " << path << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+size_t TrajectoryReader::findFrame(double time) const {
+    auto later = std::upper_bound(frames.begin(), frames.end(), time,
+                                  [](double t, const Frame& frame) { return t < frame.info.time; });
+    return later == frames.begin() ? 0 : (size_t)(later - frames.begin()) - 1;
+}
+
+// Reads one block of a column as stored, undoing compression and shuffling
+bool TrajectoryReader::decodeColumnBlock(size_t frame, size_t column, size_t block,
+                                         std::vector<unsigned char>& out) const {
+    const BlockRange& range = frames[frame].blocks[column * blockCount + block];
+    std::vector<unsigned char> stored(range.storedBytes), raw(range.rawBytes);
+    if (!readExact(fd, stored.data(), stored.size(), range.offset) ||
+        !decompressBlock(codec, stored.data(), stored.size(), raw.data(), raw.size()))
+        return false;
+    
+    if (columns[column].shuffled) {
+        out.resize(raw.size());
+        unshuffleBytes(raw.data(), out.data(), raw.size() / columns[column].elementSize, columns[column].elementSize);
+    } else {
+        out.swap(raw);
+    }
+    return true;
+}
+
+bool TrajectoryReader::read(size_t frame, uint64_t first, uint64_t n, Star* out, unsigned fields) const {
+    if (fd < 0 || frame >= frames.size() || first + n > count) return false;
+    if (n == 0) return true;
+    
+    const uint64_t last = first + n;
+    const size_t firstBlock = first / SNAPSHOT_BLOCK_ELEMENTS;
+    const size_t blocks = (last - 1) / SNAPSHOT_BLOCK_ELEMENTS - firstBlock + 1;
+    const size_t keyframe = frames[frame].info.keyframe;
+    
+    std::atomic<bool> ok(true);
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t item = 0; item < columns.size() * blocks; item++) {
+        size_t c = item / blocks;
+        size_t block = firstBlock + item % blocks;
+        const Column& column = columns[c];
+        if (column.field < 0 || !(columnFields(column.field) & fields)) continue;
+        
+        std::vector<unsigned char> data, key;
+        if (!decodeColumnBlock(frame, c, block, data)) {
+            ok = false;
+            continue;
+        }
+        if (keyframe != frame) {
+            if (!decodeColumnBlock(keyframe, c, block, key) || key.size() != data.size()) {
+                ok = false;
+                continue;
+            }
+            xorBytes(data.data(), key.data(), data.size());
+        }
+        
+        uint64_t blockFirst = (uint64_t)block * SNAPSHOT_BLOCK_ELEMENTS;
+        uint64_t from = std::max(first, blockFirst);
+        uint64_t to = std::min(last, blockFirst + data.size() / column.elementSize);
+        if (to < from) {
+            ok = false;
+            continue;
+        }
+        scatterColumn(COLUMNS[column.field], &data[(from - blockFirst) * column.elementSize],
+                      to - from, out + (from - first));
+    }
+    if (!ok) std::cerr << "Corrupt or truncated trajectory " << path << std::endl;
+    if (ok && !hasSpecies && (fields & TRAJECTORY_ATTRIBUTES)) assignDefaultSpecies(out, n);
+    return ok;
+}
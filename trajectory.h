@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "snapshot.h"
+#include "snapshot_columns.h"
+
+// Trajectory file layout, all little-endian:
+//
+//   Header   "GALTRAJ\0", u32 version, u32 keyframeInterval, u64 count,
+//            u8 codec, u8 reserved[7]
+//   Frames   per frame, the blocks of every column as in snapshot files
+//   Index    u32 frameCount, u32 columnCount, then per column:
+//              char name[16], u8 type, u8 elementSize, u8 shuffled, u8 reserved
+//            then per frame:
+//              u64 step, f64 time, u32 keyframe, u32 reserved,
+//              per column, per block: u64 offset, u32 rawBytes, u32 storedBytes
+//   Trailer  u64 indexOffset, "GALTRAJE"
+//
+// Every keyframeInterval-th frame is a keyframe, stored like a lossless
+// snapshot. The frames in between are XORed with their keyframe before
+// shuffling, so bytes that barely move between frames turn to zero and
+// compress away. Any frame decodes from its own blocks plus its keyframe's,
+// so a seek costs the same anywhere in the run. Stars must keep the same
+// order in every frame. The index is written by close(); a trajectory that
+// was never closed cannot be read.
+
+enum TrajectoryFields : unsigned {
+    TRAJECTORY_POSITIONS = 1,
+    TRAJECTORY_VELOCITIES = 2,
+    TRAJECTORY_ATTRIBUTES = 4, // Mass, size, black hole flag, species
+    TRAJECTORY_ALL = 7
+};
+
+struct TrajectoryFrame {
+    uint64_t step;
+    double time;
+    uint32_t keyframe; // Frame whose blocks this one is XORed with
+};
+
+class TrajectoryWriter {
+public:
+    TrajectoryWriter() = default;
+    ~TrajectoryWriter();
+    
+    TrajectoryWriter(const TrajectoryWriter&) = delete;
+    TrajectoryWriter& operator=(const TrajectoryWriter&) = delete;
+    
+    bool open(const std::string& path, uint32_t keyframeInterval = 32,
+              SnapshotCodec codec = defaultSnapshotCodec(), int threads = 1);
+    
+    // Frames must be appended in time order with a constant star count
+    bool append(const std::vector<Star>& stars, uint64_t step, double time);
+    
+    // Writes the index; returns false if any frame failed
+    bool close();
+    
+    size_t frameCount() const { return frames.size(); }
+    
+private:
+    struct Frame {
+        TrajectoryFrame info;
+        std::vector<BlockRange> blocks; // Column-major, blockCount per column
+    };
+    
+    SequentialFile file;
+    std::string path;
+    uint32_t keyframeInterval = 32;
+    SnapshotCodec codec = SnapshotCodec::None;
+    int threads = 1;
+    bool failed = false;
+    
+    uint64_t count = 0;
+    std::vector<std::vector<unsigned char>> keyColumns; // Unshuffled raw keyframe columns
+    std::vector<Frame> frames;
+};
+
+// Random access to frames and star ranges through pread(); nothing outside
+// the requested blocks is read
+class TrajectoryReader {
+public:
+    TrajectoryReader() = default;
+    ~TrajectoryReader();
+    
+    TrajectoryReader(const TrajectoryReader&) = delete;
+    TrajectoryReader& operator=(const TrajectoryReader&) = delete;
+    
+    bool open(const std::string& path);
+    void close();
+    
+    uint64_t starCount() const { return count; }
+    size_t frameCount() const { return frames.size(); }
+    const TrajectoryFrame& frame(size_t index) const { return frames[index].info; }
+    
+    // Last frame at or before time; the first frame if time precedes the run
+    size_t findFrame(double time) const;
+    
+    // Decodes the chosen fields of stars [first, first + count) of a frame
+    // into out, leaving other fields untouched. Thread-safe.
+    bool read(size_t frame, uint64_t first, uint64_t count, Star* out,
+              unsigned fields = TRAJECTORY_ALL) const;
+    
+private:
+    struct Frame {
+        TrajectoryFrame info;
+        std::vector<BlockRange> blocks;
+    };
+    
+    struct Column {
+        int field; // Index into COLUMNS, -1 if unknown
+        bool shuffled;
+        uint8_t elementSize;
+    };
+    
+    bool decodeColumnBlock(size_t frame, size_t column, size_t block, std::vector<unsigned char>& out) const;
+    
+    std::string path;
+    int fd = -1;
+    uint64_t count = 0;
+    size_t blockCount = 0;
+    SnapshotCodec codec = SnapshotCodec::None;
+    std::vector<Column> columns;
+    std::vector<Frame> frames;
+    bool hasSpecies = false; // Older files have no species column
+};
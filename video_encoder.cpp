@@ -0,0 +1,130 @@
+#include "video_encoder.h"
+#include <csignal>
+#include <iostream>
+#include <sstream>
+
+// Single-quote a path for /bin/sh
+static std::string shellQuote(const std::string& s) {
+    std::string quoted = "'";
+    for (char c : s) {
+        if (c == '\'')
+            quoted += "'\\''";
+        else
+            quoted += c;
+    }
+    return quoted + "'";
+}
+
+VideoEncoder::VideoEncoder(const std::string& path, int width, int height, int fps, size_t queueDepth)
+    : width(width), height(height) {
+    // A dead ffmpeg must surface as a write error, not kill the process
+    std::signal(SIGPIPE, SIG_IGN);
+    
+    std::ostringstream cmd;
+    cmd << "ffmpeg -loglevel error -y -f rawvideo -pix_fmt rgb24"
+        << " -s " << width << "x" << height << " -r " << fps << " -i -"
+        << " -vf vflip -c:v libx264 -preset medium -crf 18 -pix_fmt yuv420p "
+        << shellQuote(path);
+    pipe = popen(cmd.str().c_str(), "w");
+    if (!pipe) {
+        std::cerr << "Failed to start ffmpeg for " << path << std::endl;
+        failed = true;
+        return;
+    }
+    
+    for (size_t i = 0; i < queueDepth; i++) {
+        pool.emplace_back(new unsigned char[frameBytes()]);
+        freeFrames.push_back(pool.back().get());
+    }
+    worker = std::thread(&VideoEncoder::run, this);
+}
+
+VideoEncoder::~VideoEncoder() {
+    close();
+}
+
+void VideoEncoder::close() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    frameReady.notify_all();
+    if (worker.joinable()) worker.join();
+    
+    if (pipe) {
+        if (pclose(pipe) != 0) {
+            std::cerr << "ffmpeg exited with an error" << std::endl;
+        }
+        pipe = NULL;
+    }
+}
+
+bool VideoEncoder::isOpen() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return !failed;
+}
+
+size_t VideoEncoder::stallCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stalls;
+}
+
+size_t VideoEncoder::framesWritten() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return written;
+}
+
+unsigned char* VideoEncoder::acquireFrame() {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (freeFrames.empty() && !failed) stalls++;
+    frameFreed.wait(lock, [this] { return !freeFrames.empty() || failed; });
+    if (failed) return NULL;
+    
+    unsigned char* frame = freeFrames.back();
+    freeFrames.pop_back();
+    return frame;
+}
+
+void VideoEncoder::submitFrame(unsigned char* frame) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pendingFrames.push_back(frame);
+    }
+    frameReady.notify_one();
+}
+
+void VideoEncoder::releaseFrame(unsigned char* frame) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        freeFrames.push_back(frame);
+    }
+    frameFreed.notify_one();
+}
+
+void VideoEncoder::run() {
+    for (;;) {
+        unsigned char* frame;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            frameReady.wait(lock, [this] { return !pendingFrames.empty() || stopping; });
+            // Drain everything already submitted before honouring stop
+            if (pendingFrames.empty()) return;
+            frame = pendingFrames.front();
+            pendingFrames.pop_front();
+        }
+        
+        bool ok = fwrite(frame, 1, frameBytes(), pipe) == frameBytes();
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            freeFrames.push_back(frame);
+            if (ok) {
+                written++;
+            } else if (!failed) {
+                std::cerr << "Video encoder pipe closed; recording stopped" << std::endl;
+                failed = true;
+            }
+        }
+        frameFreed.notify_one();
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Encodes raw RGB24 frames to a video file through an ffmpeg subprocess.
+// Frames travel through a fixed pool of buffers: the producer acquires a
+// free one, fills it and submits it, and a worker thread pipes submitted
+// frames to ffmpeg. When the encoder falls behind, acquireFrame() blocks
+// until a buffer is returned, throttling the simulation instead of growing
+// memory. Total memory is queueDepth frames regardless of run length.
+class VideoEncoder {
+public:
+    // Frames are expected bottom-up, as returned by glReadPixels
+    VideoEncoder(const std::string& path, int width, int height, int fps, size_t queueDepth = 4);
+    ~VideoEncoder();
+    
+    // Encodes every submitted frame and waits for ffmpeg to finish the file
+    void close();
+    
+    VideoEncoder(const VideoEncoder&) = delete;
+    VideoEncoder& operator=(const VideoEncoder&) = delete;
+    
+    // False if ffmpeg could not be started or has exited
+    bool isOpen() const;
+    
+    size_t frameBytes() const { return (size_t)width * height * 3; }
+    
+    // Blocks while every buffer is queued. Returns NULL once the encoder failed.
+    unsigned char* acquireFrame();
+    void submitFrame(unsigned char* frame);
+    
+    // Returns an acquired frame without encoding it
+    void releaseFrame(unsigned char* frame);
+    
+    // Number of times acquireFrame() had to wait for the encoder
+    size_t stallCount() const;
+    size_t framesWritten() const;
+    
+private:
+    void run();
+    
+    int width, height;
+    FILE* pipe = NULL;
+    
+    std::vector<std::unique_ptr<unsigned char[]>> pool;
+    std::vector<unsigned char*> freeFrames;
+    std::deque<unsigned char*> pendingFrames;
+    
+    mutable std::mutex mutex;
+    std::condition_variable frameReady;
+    std::condition_variable frameFreed;
+    bool stopping = false;
+    bool failed = false;
+    size_t stalls = 0;
+    size_t written = 0;
+    
+    std::thread worker;
+};
@@ -0,0 +1,121 @@
+#include "wisdom_holman.h"
+#include <algorithm>
+#include <cmath>
+
+static const int KEPLER_ITERATIONS = 50;
+static const double KEPLER_TOLERANCE = 1e-14;
+static const int KEPLER_SPLITS = 8; // Times a drift the solver fails on is halved
+
+// Stumpff functions c2(z) = (1 - cos sqrt z) / z and c3(z) = (sqrt z - sin sqrt z) / sqrt(z)^3,
+// continued to z <= 0; by series near 0, where the closed forms cancel
+static void stumpff(double z, double& c2, double& c3) {
+    if (std::fabs(z) < 0.1) {
+        c2 = 1.0/2 - z*(1.0/24 - z*(1.0/720 - z*(1.0/40320 - z/3628800)));
+        c3 = 1.0/6 - z*(1.0/120 - z*(1.0/5040 - z*(1.0/362880 - z/39916800)));
+    } else if (z > 0.0) {
+        double s = std::sqrt(z);
+        c2 = (1.0 - std::cos(s)) / z;
+        c3 = (s - std::sin(s)) / (s * z);
+    } else {
+        double s = std::sqrt(-z);
+        c2 = (std::cosh(s) - 1.0) / -z;
+        c3 = (std::sinh(s) - s) / (s * -z);
+    }
+}
+
+bool keplerDrift(glm::dvec3& position, glm::dvec3& velocity, double mu, double dt) {
+    double r0 = glm::length(position);
+    if (!(r0 > 0.0) || !(mu > 0.0)) return false;
+    double sqrtMu = std::sqrt(mu);
+    double sigma0 = glm::dot(position, velocity) / sqrtMu;
+    double alpha = 2.0 / r0 - glm::dot(velocity, velocity) / mu; // 1 / semi-major axis
+    double beta = 1.0 - alpha * r0;
+    
+    // Solve the universal Kepler equation for chi by Laguerre-Conway, which
+    // converges from the small-step guess for any orbit type
+    double chi = sqrtMu * dt / r0;
+    double c2, c3;
+    bool converged = false;
+    for (int i = 0; i < KEPLER_ITERATIONS && !converged; i++) {
+        double z = alpha * chi * chi;
+        stumpff(z, c2, c3);
+        double f = sigma0 * chi * chi * c2 + beta * chi * chi * chi * c3 + r0 * chi - sqrtMu * dt;
+        double df = sigma0 * chi * (1.0 - z * c3) + beta * chi * chi * c2 + r0; // The new radius
+        double ddf = sigma0 * (1.0 - z * c2) + beta * chi * (1.0 - z * c3);
+        const double n = 5.0;
+        double root = std::sqrt(std::fabs((n - 1) * (n - 1) * df * df - n * (n - 1) * f * ddf));
+        double delta = n * f / (df + (df < 0.0 ? -root : root));
+        if (!std::isfinite(delta)) return false;
+        chi -= delta;
+        converged = std::fabs(delta) <= KEPLER_TOLERANCE * std::max(1.0, std::fabs(chi));
+    }
+    if (!converged) return false;
+    
+    // Lagrange coefficients
+    double z = alpha * chi * chi;
+    stumpff(z, c2, c3);
+    double f = 1.0 - chi * chi * c2 / r0;
+    double g = dt - chi * chi * chi * c3 / sqrtMu;
+    glm::dvec3 newPosition = f * position + g * velocity;
+    double r = glm::length(newPosition);
+    double fDot = sqrtMu / (r * r0) * chi * (z * c3 - 1.0);
+    double gDot = 1.0 - chi * chi * c2 / r;
+    glm::dvec3 newVelocity = fDot * position + gDot * velocity;
+    if (!std::isfinite(r) || !std::isfinite(glm::dot(newVelocity, newVelocity))) return false;
+    
+    position = newPosition;
+    velocity = newVelocity;
+    return true;
+}
+
+// Drifts in halves, recursively, where the solver fails on the whole
+static bool splitDrift(glm::dvec3& position, glm::dvec3& velocity, double mu, double dt, int splits) {
+    if (keplerDrift(position, velocity, mu, dt)) return true;
+    if (splits == 0) return false;
+    return splitDrift(position, velocity, mu, dt / 2, splits - 1) &&
+           splitDrift(position, velocity, mu, dt / 2, splits - 1);
+}
+
+// Solved in double about the black hole; a star the solver gives up on
+// takes a plain kick-drift step instead
+static void driftStar(Star& star, const Star& blackHole, double mu, double dt) {
+    glm::dvec3 origin(blackHole.position);
+    glm::dvec3 position = glm::dvec3(star.position) - origin;
+    glm::dvec3 velocity(star.velocity);
+    if (splitDrift(position, velocity, mu, dt, KEPLER_SPLITS)) {
+        star.position = glm::vec3(origin + position);
+        star.velocity = glm::vec3(velocity);
+    } else {
+        advanceStar(star, blackHole, (float)dt);
+    }
+}
+
+float integrateWisdomHolman(std::vector<Star>& stars, float dt, const TimestepCriteria& criteria,
+                            const Perturbation& perturbation) {
+    const Star blackHole = stars[0];
+    double mu = G * blackHole.mass;
+    
+    // Half drifts compose exactly, so without kicks in between one will do
+    double drift = perturbation ? dt / 2.0 : dt;
+    if (dt > 0.0f) {
+        #pragma omp parallel for schedule(dynamic, 1024)
+        for (size_t i = 0; i < stars.size(); i++) {
+            if (stars[i].isBlackHole) continue;
+            driftStar(stars[i], blackHole, mu, drift);
+        }
+    }
+    if (!perturbation) return criteria.maxStep;
+    
+    std::vector<glm::vec3> accelerations(stars.size(), glm::vec3(0.0f));
+    perturbation(stars, accelerations);
+    float limit = criteria.maxStep / criteria.accuracy;
+    #pragma omp parallel for schedule(dynamic, 1024) reduction(min:limit)
+    for (size_t i = 0; i < stars.size(); i++) {
+        if (stars[i].isBlackHole) continue;
+        stars[i].velocity += accelerations[i] * dt;
+        float acceleration = glm::length(accelerations[i]);
+        if (acceleration > 0.0f) limit = std::min(limit, std::sqrt(criteria.softening / acceleration));
+        if (dt > 0.0f) driftStar(stars[i], blackHole, mu, drift);
+    }
+    return std::max(limit * criteria.accuracy, criteria.minStep);
+}
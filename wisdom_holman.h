@@ -0,0 +1,30 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+#include <glm/glm.hpp>
+#include "galaxy_core.h"
+
+// Wisdom-Holman mixed-variable integration. The central black hole
+// dominates, so each star's motion is split into its exact Kepler orbit
+// about the black hole and small kicks from everything else. Kepler drifts
+// are solved analytically, so the step is limited only by how fast the
+// perturbations change, not by the orbit itself, however deep in the well
+// a star is.
+
+// Accelerations on every star from forces other than the central black
+// hole, at the stars' current positions
+using Perturbation = std::function<void(const std::vector<Star>& stars, std::vector<glm::vec3>& accelerations)>;
+
+// Moves a body along its Kepler orbit about a fixed mass with
+// gravitational parameter mu for dt, in universal variables, so bound,
+// parabolic and unbound orbits are all handled. position is relative to
+// the mass. Returns false if the solver did not converge.
+bool keplerDrift(glm::dvec3& position, glm::dvec3& velocity, double mu, double dt);
+
+// One drift-kick-drift step: half a Kepler drift about stars[0], a kick
+// from the perturbation, another half drift. Without a perturbation the
+// drift is exact for any dt, so the stable step is criteria.maxStep;
+// otherwise it is sqrt(softening / |a|) of the perturbing accelerations.
+float integrateWisdomHolman(std::vector<Star>& stars, float dt, const TimestepCriteria& criteria,
+                            const Perturbation& perturbation = Perturbation());